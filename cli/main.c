@@ -15,8 +15,8 @@
 
 #define PRINT_USAGE(prog)                                                      \
   fprintf(stderr,                                                              \
-          "Usage: %s [-f INPUT_FILE] [-c MODE] [-a] [-t] [-i] [-d] [-v] [-h] " \
-          "OUTPUT_FILE\n",                                                     \
+          "Usage: %s [-f INPUT_FILE] [-c MODE] [-a] [-t] [-i] [-u] "           \
+          "[-s LEVEL] [-d] [-v] [-h] OUTPUT_FILE\n",                           \
           prog)
 
 int main(int argc, char *argv[]) {
@@ -25,7 +25,7 @@ int main(int argc, char *argv[]) {
   mode_t mode = 0;
 
   int opt;
-  while ((opt = getopt(argc, argv, "f:c:atidvh")) != -1) {
+  while ((opt = getopt(argc, argv, "f:c:atius:dvh")) != -1) {
     switch (opt) {
     case 'f':
       input_fname = optarg;
@@ -55,6 +55,23 @@ int main(int argc, char *argv[]) {
     case 'i':
       flags |= Z_IMMUTABLE;
       break;
+    case 'u':
+      flags |= Z_SKIP_IDENTICAL;
+      break;
+    case 's':
+      flags &= ~(Z_DURABLE_DATA | Z_DURABLE_FULL);
+      if (strcmp(optarg, "data") == 0) {
+        flags |= Z_DURABLE_DATA;
+      } else if (strcmp(optarg, "full") == 0) {
+        flags |= Z_DURABLE_FULL;
+      } else if (strcmp(optarg, "none") != 0) {
+        fprintf(stderr,
+                "Bad durability level '%s': Expected none, data or full\n",
+                optarg);
+        PRINT_USAGE(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
     case 'd':
 #if !NDEBUG
       zeugl_logger_enable();
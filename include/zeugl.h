@@ -6,22 +6,70 @@ extern "C" {
 #endif /* __cplusplus */
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define Z_CREATE 1 << 0
 #define Z_APPEND 1 << 1
 #define Z_TRUNCATE 1 << 2
 #define Z_NOBLOCK 1 << 3
 #define Z_IMMUTABLE 1 << 4
+#define Z_NOCACHE 1 << 5
+#define Z_DIRECT 1 << 6
+#define Z_SIZEHINT 1 << 7
+#define Z_PARALLEL 1 << 8
+#define Z_DURABLE_DATA 1 << 9
+#define Z_DURABLE_FULL 1 << 10
+#define Z_GROUP_COMMIT 1 << 11
+#define Z_TIMEOUT 1 << 12
+#define Z_OPTIMISTIC 1 << 13
+#define Z_NEWEST 1 << 14
+#define Z_SHMLOCK 1 << 15
+#define Z_SKIP_IDENTICAL 1 << 16
+
+/**
+ * Statistics about a file transaction.
+ */
+struct zstats {
+  /* Number of attempts needed to copy the original file in zopen(). More than
+   * one attempt means the original file was modified during the copy. */
+  unsigned int copy_attempts;
+  /* Number of bytes copied from the original file into the temporary file */
+  unsigned long long copy_bytes;
+  /* Number of bytes that had to be copied again, because the original file
+   * was modified during the copy */
+  unsigned long long wasted_bytes;
+  /* Nanoseconds spent waiting for the shared lock on the original file in
+   * zopen(), or for the lock taken with Z_SHMLOCK */
+  unsigned long long open_lock_wait_ns;
+  /* Nanoseconds spent waiting for the exclusive lock on the original file in
+   * zclose() */
+  unsigned long long commit_lock_wait_ns;
+  /* Set if the commit in zclose() was dropped, because a transaction that
+   * began later already committed (see Z_NEWEST) */
+  unsigned int superseded;
+  /* Set if the commit in zclose() left the original file in place, because it
+   * already had the same content and attributes (see Z_SKIP_IDENTICAL) */
+  unsigned int identical;
+  /* Set if the temporary file was flushed to disk by a syncfs(2) shared with
+   * other files (see Z_GROUP_COMMIT and zclose_many()), instead of on its own */
+  unsigned int fs_synced;
+};
 
 /**
  * @brief           Begins an atomic file transaction.
  * @param filename  The file to begin transaction on.
  * @param flags     File creation flags and file status flags.
  * @param mode      File mode bits to be applied when a new file is created.
+ * @param size      Expected size (off_t) of the file if Z_SIZEHINT is set.
+ * @param timeout   Maximum number of milliseconds (int) to wait for each lock
+ * on the original file if Z_TIMEOUT is set.
  * @return          A file descriptor on success or a negative number on error.
  * On error errno is set to indicate the error.
  */
-int zopen(const char *filename, int flags, ... /* mode_t mode */);
+int zopen(const char *filename, int flags,
+          ... /* mode_t mode, off_t size, int timeout */);
 
 /**
  * @brief           Commits or aborts an atomic file transaction.
@@ -33,6 +81,141 @@ int zopen(const char *filename, int flags, ... /* mode_t mode */);
  */
 int zclose(int fd, bool commit);
 
+/**
+ * @brief           Replaces the content of a file atomically in one call, as
+ * zopen() with Z_CREATE and Z_TRUNCATE, writing the buffers and zclose() would.
+ * @param filename  The file to replace.
+ * @param iov       Buffers holding the new content of the file.
+ * @param iovcnt    Number of buffers.
+ * @param flags     File status flags as for zopen(), except Z_APPEND,
+ * Z_SIZEHINT and Z_TIMEOUT.
+ * @param mode      File mode bits of the file, whether or not it exists.
+ * @return          Returns zero on success or a negative number on error. On
+ * error errno is set to indicate the error.
+ */
+int zreplace(const char *filename, const struct iovec *iov, int iovcnt,
+             int flags, mode_t mode);
+
+/**
+ * @brief           Commits or aborts several atomic file transactions at once.
+ * Disk flushes are shared between the files, with one flush per filesystem and
+ * one per directory.
+ * @param fds       File descriptors of files or -1 for no operation.
+ * @param errors    Filled in with zero for each transaction that succeeded, or
+ * the errno value of the transaction that failed.
+ * @param nfds      Number of file descriptors.
+ * @param commit    If true, the transactions are committed. Otherwise, the
+ * transactions are aborted.
+ * @return          Returns zero if all transactions succeeded or a negative
+ * number otherwise. On error errno is set to the first error in errors.
+ */
+int zclose_many(const int *fds, int *errors, size_t nfds, bool commit);
+
+/**
+ * @brief           Maps the temporary file of an atomic file transaction into
+ * memory, so that it can be edited in place. The mapping is shared with the
+ * file and can be read and written. It is written back and removed when the
+ * transaction is committed or aborted.
+ * @param fd        A file descriptor obtained from zopen() or zgroup_open().
+ * @param length    Set to the length of the mapping, which is the size of the
+ * file. An empty file cannot be mapped, see zremap().
+ * @return          The address of the mapping on success, or NULL on error. On
+ * error errno is set to indicate the error. Mapping the file again returns the
+ * same mapping.
+ */
+void *zmap(int fd, size_t *length);
+
+/**
+ * @brief           Resizes the temporary file of an atomic file transaction
+ * and its mapping.
+ * @param fd        A file descriptor obtained from zopen() or zgroup_open().
+ * @param length    New size of the file and length of the mapping in bytes,
+ * greater than zero. Disk space for a larger file is reserved.
+ * @return          The address of the mapping on success, which may have moved,
+ * or NULL on error. On error errno is set to indicate the error. The file is
+ * mapped if it was not.
+ */
+void *zremap(int fd, size_t length);
+
+/**
+ * A group of file transactions that are committed or aborted together.
+ */
+struct zgroup;
+
+/**
+ * @brief           Begins a group of atomic file transactions.
+ * @param record    Path of the intent record of the group. The suffixes ".zgp"
+ * and ".zgc" are appended to it. Only one group at a time can use a record.
+ * @param flags     Durability flags (Z_DURABLE_DATA or Z_DURABLE_FULL) applied
+ * to the group and all its members.
+ * @return          A transaction group on success or NULL on error. On error
+ * errno is set to indicate the error.
+ */
+struct zgroup *zgroup_begin(const char *record, int flags);
+
+/**
+ * @brief           Begins an atomic file transaction as part of a group.
+ * @param group     The group to add the transaction to.
+ * @param filename  The file to begin transaction on.
+ * @param flags     File creation flags and file status flags, as for zopen().
+ * @param mode      File mode bits to be applied when a new file is created.
+ * @param size      Expected size (off_t) of the file if Z_SIZEHINT is set.
+ * @param timeout   Maximum number of milliseconds (int) to wait for each lock
+ * on the original file if Z_TIMEOUT is set.
+ * @return          A file descriptor on success or a negative number on error.
+ * On error errno is set to indicate the error. The file descriptor must not be
+ * passed to zclose().
+ */
+int zgroup_open(struct zgroup *group, const char *filename, int flags,
+                ... /* mode_t mode, off_t size, int timeout */);
+
+/**
+ * @brief           Commits all file transactions of a group.
+ * @param group     The group to commit. It is freed in any case.
+ * @return          Returns zero on success or a negative number on error. On
+ * error errno is set to indicate the error. If the error happened after the
+ * group was committed, the intent record is kept for zgroup_recover().
+ */
+int zgroup_commit(struct zgroup *group);
+
+/**
+ * @brief           Aborts all file transactions of a group.
+ * @param group     The group to abort. It is freed in any case.
+ * @return          Returns zero.
+ */
+int zgroup_abort(struct zgroup *group);
+
+/**
+ * @brief           Completes a group that was interrupted by a crash. A
+ * committed group is rolled forward, any other group is rolled back.
+ * @param record    Path of the intent record given to zgroup_begin().
+ * @return          Returns zero on success or a negative number on error. On
+ * error errno is set to indicate the error.
+ * @note Must not be called while a group with the same record is in progress.
+ */
+int zgroup_recover(const char *record);
+
+/**
+ * @brief           Checks whether a file transaction was superseded by a
+ * transaction on the same file that began later and already committed with
+ * Z_NEWEST. Commits without Z_NEWEST record no sequence number.
+ * @param fd        A file descriptor obtained from zopen().
+ * @return          Returns 1 if the transaction was superseded, 0 if not, or a
+ * negative number on error. On error errno is set to indicate the error.
+ * @note A transaction that was superseded can be aborted right away. With
+ * Z_NEWEST its commit would be dropped, and without it, its commit would
+ * overwrite newer content.
+ */
+int zsuperseded(int fd);
+
+/**
+ * @brief           Retrieves statistics about the file transaction of the last
+ * call to zopen() or zclose() in the calling thread.
+ * @param stats     Structure to fill in.
+ * @note The statistics are recorded whether the call succeeded or failed.
+ */
+void zstats(struct zstats *stats);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,66 @@
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backoff.h"
+#include "logger.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+
+/* Initial and maximum delay between two attempts */
+#define BACKOFF_MIN_NSEC (1 * NSEC_PER_MSEC)
+#define BACKOFF_MAX_NSEC (128 * NSEC_PER_MSEC)
+
+uint64_t zeugl_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * NSEC_PER_SEC) + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t random_number(void) {
+  /* Per-thread xorshift generator, good enough for jitter */
+  static __thread uint64_t state = 0;
+  if (state == 0) {
+    state = zeugl_now() ^ ((uint64_t)getpid() << 32) ^ (uintptr_t)&state;
+    state |= 1;
+  }
+
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+void zeugl_backoff(unsigned int attempt, uint64_t deadline) {
+  uint64_t delay = BACKOFF_MAX_NSEC;
+  if (attempt < 8) {
+    delay = BACKOFF_MIN_NSEC << (attempt - 1);
+    if (delay > BACKOFF_MAX_NSEC) {
+      delay = BACKOFF_MAX_NSEC;
+    }
+  }
+  delay = random_number() % (delay + 1);
+
+  const uint64_t now = zeugl_now();
+  if (now >= deadline) {
+    return;
+  }
+  if (delay > deadline - now) {
+    delay = deadline - now;
+  }
+
+  LOG_DEBUG("Backing off for %llu us after attempt %u",
+            (unsigned long long)(delay / 1000), attempt);
+
+  struct timespec ts = {
+      .tv_sec = (time_t)(delay / NSEC_PER_SEC),
+      .tv_nsec = (long)(delay % NSEC_PER_SEC),
+  };
+  while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR)) {
+    /* Interrupted! It happens, just continue sleeping... */
+  }
+}
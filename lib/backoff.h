@@ -0,0 +1,21 @@
+#ifndef __ZEUGL_BACKOFF_H__
+#define __ZEUGL_BACKOFF_H__
+
+#include <stdint.h>
+
+/**
+ * @brief Get the current time of a monotonic clock.
+ * @return Current time in nanoseconds.
+ */
+uint64_t zeugl_now(void);
+
+/**
+ * @brief Sleep before the next attempt of a retry loop.
+ * @param attempt Number of failed attempts so far (starting at 1).
+ * @param deadline Point in time (see zeugl_now()) not to sleep past.
+ * @note The delay doubles for each attempt and is randomized (full jitter), so
+ * that competing agents do not retry in lockstep.
+ */
+void zeugl_backoff(unsigned int attempt, uint64_t deadline);
+
+#endif /* __ZEUGL_BACKOFF_H__ */
@@ -0,0 +1,102 @@
+#include "config.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cache.h"
+#include "logger.h"
+
+struct cached_object {
+  void *object;
+  size_t size;
+  void (*release)(void *object);
+};
+
+struct thread_cache {
+  struct cached_object slots[ZEUGL_CACHE_NUM_SLOTS];
+  bool registered; /* Released at thread exit */
+};
+
+static __thread struct thread_cache CACHE;
+
+#ifdef HAVE_PTHREAD
+/**
+ * Key whose destructor releases the cached objects of exiting threads
+ */
+static pthread_key_t CACHE_KEY;
+static pthread_once_t CACHE_KEY_ONCE = PTHREAD_ONCE_INIT;
+static bool CACHE_KEY_CREATED = false;
+
+static void release_cache(void *arg) {
+  struct thread_cache *cache = arg;
+  for (size_t i = 0; i < ZEUGL_CACHE_NUM_SLOTS; i++) {
+    struct cached_object *slot = &cache->slots[i];
+    if (slot->object != NULL) {
+      slot->release(slot->object);
+      slot->object = NULL;
+    }
+  }
+}
+
+static void create_cache_key(void) {
+  int ret = pthread_key_create(&CACHE_KEY, release_cache);
+  if (ret != 0) {
+    LOG_DEBUG("Failed to create thread cache key: %s", strerror(ret));
+    return;
+  }
+  CACHE_KEY_CREATED = true;
+}
+#endif /* HAVE_PTHREAD */
+
+/**
+ * Make sure the cache of the calling thread is released when it exits. The
+ * main thread is not covered, but its objects go away with the process.
+ */
+static bool register_cache(void) {
+  if (CACHE.registered) {
+    return true;
+  }
+
+#ifdef HAVE_PTHREAD
+  if ((pthread_once(&CACHE_KEY_ONCE, create_cache_key) != 0) ||
+      !CACHE_KEY_CREATED) {
+    return false;
+  }
+
+  int ret = pthread_setspecific(CACHE_KEY, &CACHE);
+  if (ret != 0) {
+    LOG_DEBUG("Failed to register thread cache: %s", strerror(ret));
+    return false;
+  }
+#endif /* HAVE_PTHREAD */
+
+  CACHE.registered = true;
+  return true;
+}
+
+void *zeugl_cache_take(enum zeugl_cache_slot slot, size_t *size) {
+  struct cached_object *cached = &CACHE.slots[slot];
+  void *object = cached->object;
+  if (size != NULL) {
+    *size = cached->size;
+  }
+  cached->object = NULL;
+  return object;
+}
+
+void zeugl_cache_give(enum zeugl_cache_slot slot, void *object, size_t size,
+                      void (*release)(void *object)) {
+  struct cached_object *cached = &CACHE.slots[slot];
+  if ((object == NULL) || (cached->object != NULL) || !register_cache()) {
+    if (object != NULL) {
+      release(object);
+    }
+    return;
+  }
+
+  cached->object = object;
+  cached->size = size;
+  cached->release = release;
+}
@@ -0,0 +1,35 @@
+#ifndef __ZEUGL_CACHE_H__
+#define __ZEUGL_CACHE_H__
+
+#include <stddef.h>
+
+/**
+ * Kinds of objects that each thread keeps one of between transactions, so
+ * that a steady stream of transactions does not allocate.
+ */
+enum zeugl_cache_slot {
+  ZEUGL_CACHE_FILE,   /* Transaction record */
+  ZEUGL_CACHE_BUFFER, /* Copy buffer */
+  ZEUGL_CACHE_NUM_SLOTS,
+};
+
+/**
+ * @brief Take the object the calling thread has cached in a slot.
+ * @param slot Slot to take the object from. The slot is empty afterwards.
+ * @param size Set to the size given with the object, if any.
+ * @return The cached object, or NULL if the slot is empty.
+ */
+void *zeugl_cache_take(enum zeugl_cache_slot slot, size_t *size);
+
+/**
+ * @brief Cache an object in a slot of the calling thread.
+ * @param slot Slot to cache the object in.
+ * @param object Object to cache.
+ * @param size Size of the object, handed back by zeugl_cache_take().
+ * @param release Function that releases the object. It is called right away
+ * if the slot is already taken, or when the thread exits.
+ */
+void zeugl_cache_give(enum zeugl_cache_slot slot, void *object, size_t size,
+                      void (*release)(void *object));
+
+#endif /* __ZEUGL_CACHE_H__ */
@@ -0,0 +1,195 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "dircache.h"
+#include "logger.h"
+
+/* Number of directories kept open, for writers that update many files in the
+ * same few directories */
+#define DIRCACHE_SIZE 8
+
+struct cached_dir {
+  char path[PATH_MAX]; /* Empty if the directory was replaced */
+  int fd;
+  dev_t dev;
+  ino_t ino;
+  size_t refs;            /* Transactions using the file descriptor */
+  unsigned long last_use; /* For evicting the least recently used entry */
+  bool used;
+};
+
+static struct cached_dir DIRCACHE[DIRCACHE_SIZE];
+static unsigned long DIRCACHE_CLOCK = 0;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t DIRCACHE_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+#endif /* HAVE_PTHREAD */
+
+static void dircache_lock(void) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&DIRCACHE_MUTEX);
+#endif /* HAVE_PTHREAD */
+}
+
+static void dircache_unlock(void) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&DIRCACHE_MUTEX);
+#endif /* HAVE_PTHREAD */
+}
+
+static void evict(struct cached_dir *entry) {
+  if (close(entry->fd) == 0) {
+    LOG_DEBUG("Closed cached directory (fd = %d)", entry->fd);
+  } else {
+    LOG_DEBUG("Failed to close cached directory (fd = %d): %s", entry->fd,
+              strerror(errno));
+  }
+  entry->used = false;
+}
+
+/**
+ * Look up a cached directory and take a reference to it. Entries whose path
+ * now resolves to another directory are dropped. Must be called with the lock
+ * held.
+ */
+static int lookup(const char *path, const struct stat *sb) {
+  for (size_t i = 0; i < DIRCACHE_SIZE; i++) {
+    struct cached_dir *entry = &DIRCACHE[i];
+    if (!entry->used || (strcmp(entry->path, path) != 0)) {
+      continue;
+    }
+
+    if ((entry->dev == sb->st_dev) && (entry->ino == sb->st_ino)) {
+      entry->refs += 1;
+      entry->last_use = ++DIRCACHE_CLOCK;
+      return entry->fd;
+    }
+
+    LOG_DEBUG("Cached directory '%s' (fd = %d) was replaced", path, entry->fd);
+    if (entry->refs == 0) {
+      evict(entry);
+    } else {
+      /* Closed once the last transaction using it releases it */
+      entry->path[0] = '\0';
+    }
+  }
+  return -1;
+}
+
+/**
+ * Cache a newly opened directory with one reference, evicting the least
+ * recently used entry that is not in use. Must be called with the lock held.
+ */
+static void insert(const char *path, int fd, const struct stat *sb) {
+  struct cached_dir *victim = NULL;
+  for (size_t i = 0; i < DIRCACHE_SIZE; i++) {
+    struct cached_dir *entry = &DIRCACHE[i];
+    if (!entry->used) {
+      victim = entry;
+      break;
+    }
+    if ((entry->refs == 0) &&
+        ((victim == NULL) || (entry->last_use < victim->last_use))) {
+      victim = entry;
+    }
+  }
+
+  if (victim == NULL) {
+    LOG_DEBUG("Directory cache is full: Not caching '%s' (fd = %d)", path, fd);
+    return;
+  }
+
+  if (victim->used) {
+    evict(victim);
+  }
+
+  strcpy(victim->path, path);
+  victim->fd = fd;
+  victim->dev = sb->st_dev;
+  victim->ino = sb->st_ino;
+  victim->refs = 1;
+  victim->last_use = ++DIRCACHE_CLOCK;
+  victim->used = true;
+}
+
+int zeugl_dircache_open(const char *path, struct stat *sb) {
+  if (strlen(path) >= PATH_MAX) {
+    LOG_DEBUG("Directory name '%s' is too long", path);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  if (stat(path, sb) != 0) {
+    LOG_DEBUG("Failed to stat directory '%s': %s", path, strerror(errno));
+    return -1;
+  }
+
+  dircache_lock();
+  int fd = lookup(path, sb);
+  dircache_unlock();
+  if (fd >= 0) {
+    LOG_DEBUG("Reusing cached directory '%s' (fd = %d)", path, fd);
+    return fd;
+  }
+
+  fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG_DEBUG("Failed to open directory '%s': %s", path, strerror(errno));
+    return -1;
+  }
+  LOG_DEBUG("Opened directory '%s' (fd = %d)", path, fd);
+
+  /* The path may have changed since we looked, so remember what we opened */
+  if (fstat(fd, sb) != 0) {
+    LOG_DEBUG("Failed to stat directory '%s' (fd = %d): %s", path, fd,
+              strerror(errno));
+    int save_errno = errno;
+    close(fd);
+    errno = save_errno;
+    return -1;
+  }
+
+  dircache_lock();
+  insert(path, fd, sb);
+  dircache_unlock();
+
+  return fd;
+}
+
+void zeugl_dircache_close(int dirfd) {
+  if (dirfd < 0) {
+    return;
+  }
+
+  dircache_lock();
+  for (size_t i = 0; i < DIRCACHE_SIZE; i++) {
+    struct cached_dir *entry = &DIRCACHE[i];
+    if (entry->used && (entry->fd == dirfd)) {
+      entry->refs -= 1;
+      if ((entry->refs == 0) && (entry->path[0] == '\0')) {
+        evict(entry);
+      }
+      dircache_unlock();
+      return;
+    }
+  }
+  dircache_unlock();
+
+  /* The directory was never cached */
+  if (close(dirfd) == 0) {
+    LOG_DEBUG("Closed directory (fd = %d)", dirfd);
+  } else {
+    LOG_DEBUG("Failed to close directory (fd = %d): %s", dirfd,
+              strerror(errno));
+  }
+}
@@ -0,0 +1,26 @@
+#ifndef __ZEUGL_DIRCACHE_H__
+#define __ZEUGL_DIRCACHE_H__
+
+#include <sys/stat.h>
+
+/**
+ * @brief Open a directory, reusing a cached file descriptor if the directory
+ * was opened before.
+ * @param path Path of the directory.
+ * @param sb Set to the status of the directory that was opened, so that
+ * callers can tell it apart from others without another fstat(2).
+ * @return File descriptor of the directory, which must be released with
+ * zeugl_dircache_close(). On error -1 is returned and errno is set.
+ * @note A cached file descriptor is only reused if the path still resolves to
+ * the same directory.
+ */
+int zeugl_dircache_open(const char *path, struct stat *sb);
+
+/**
+ * @brief Release a file descriptor returned by zeugl_dircache_open().
+ * @param dirfd File descriptor of the directory.
+ * @note The file descriptor stays open while it is cached.
+ */
+void zeugl_dircache_close(int dirfd);
+
+#endif /* __ZEUGL_DIRCACHE_H__ */
@@ -1,24 +1,120 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#ifdef HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif /* HAVE_SYS_IOCTL_H */
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif /* HAVE_LINUX_FS_H */
+
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif /* HAVE_SYS_SENDFILE_H */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif /* HAVE_PTHREAD */
+
+#include "backoff.h"
+#include "cache.h"
 #include "filecopy.h"
+#include "lock.h"
 #include "logger.h"
+#include "tunables.h"
+#include "uring.h"
+#include "utils.h"
+#include "zeugl.h"
 
-bool zeugl_filecopy(int src, int dst) {
-  char buffer[BUFFER_SIZE];
+#ifndef IOV_MAX
+/* Minimum that POSIX allows for the number of buffers per pwritev() call */
+#define IOV_MAX 16
+#endif /* IOV_MAX */
+
+/* Maximum number of bytes to request per copy_file_range() call */
+#define COPY_RANGE_CHUNK_SIZE ((size_t)1 << 30)
+
+/* Maximum number of bytes to request per sendfile() call */
+#define SENDFILE_CHUNK_SIZE ((size_t)1 << 30)
+
+/* Maximum number of bytes to request per splice() call */
+#define SPLICE_CHUNK_SIZE ((size_t)1 << 20)
+
+/* Alignment of buffers, offsets and sizes for direct I/O */
+#define DIRECT_IO_ALIGNMENT ((size_t)4096)
+
+/**
+ * Allocate a copy buffer. The buffer is allocated on the heap, so that threads
+ * with small stacks can copy safely, and aligned for direct I/O. The buffer of
+ * the previous copy in the calling thread is reused if it has the same size.
+ */
+static char *buffer_alloc(size_t *size) {
+  *size = zeugl_buffer_size();
+
+  /* Round up to a multiple of the alignment required by direct I/O */
+  *size = (*size + DIRECT_IO_ALIGNMENT - 1) & ~(DIRECT_IO_ALIGNMENT - 1);
+
+  size_t cached_size = 0;
+  void *buffer = zeugl_cache_take(ZEUGL_CACHE_BUFFER, &cached_size);
+  if (buffer != NULL) {
+    if (cached_size == *size) {
+      return buffer;
+    }
+    free(buffer);
+    buffer = NULL;
+  }
+
+  int ret = posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, *size);
+  if (ret != 0) {
+    LOG_DEBUG("Failed to allocate memory: %s", strerror(ret));
+    errno = ret;
+    return NULL;
+  }
 
+  return buffer;
+}
+
+/**
+ * Give a copy buffer back, so that the next copy in the calling thread can
+ * reuse it.
+ */
+static void buffer_free(char *buffer, size_t size) {
+  if (buffer != NULL) {
+    zeugl_cache_give(ZEUGL_CACHE_BUFFER, buffer, size, free);
+  }
+}
+
+/**
+ * Copy through a buffer. With direct I/O, COPY_UNSUPPORTED is returned if the
+ * filesystem rejects the first read or write (e.g., due to its alignment
+ * requirements), in which case nothing was written to dst.
+ */
+static enum copy_result filecopy_readwrite(int src, int dst, bool direct) {
+  size_t size;
+  char *buffer = buffer_alloc(&size);
+  if (buffer == NULL) {
+    return COPY_FAILURE;
+  }
+
+  enum copy_result result = COPY_FAILURE;
+  bool first = true;
   int eof = 0;
   do {
     size_t n_read = 0;
     do {
-      ssize_t ret = read(src, buffer + n_read, sizeof(buffer) - n_read);
+      ssize_t ret = read(src, buffer + n_read, size - n_read);
       if (ret < 0) {
         if (errno == EINTR) {
           /* Interrupted! It happens, just continue... */
@@ -27,16 +123,31 @@ bool zeugl_filecopy(int src, int dst) {
 
         LOG_DEBUG("Failed to read from source file (fd = %d): %s", src,
                   strerror(errno));
-        return false;
+        if (direct && first && (errno == EINVAL)) {
+          result = COPY_UNSUPPORTED;
+        }
+        goto FAIL;
       }
 
       /* Is End-of-File reached? */
       eof = (ret == 0);
 
       n_read += (size_t)ret;
-    } while (!eof && (n_read < sizeof(buffer)));
+    } while (!eof && (n_read < size));
     LOG_DEBUG("Read %zu bytes from source file (fd = %d)", n_read, src);
 
+    if (direct && ((n_read % DIRECT_IO_ALIGNMENT) != 0)) {
+      /* Direct I/O can only write whole blocks. This is the tail of the file,
+       * so write the rest through the page cache. */
+      int flags = fcntl(dst, F_GETFL);
+      if ((flags < 0) || (fcntl(dst, F_SETFL, flags & ~O_DIRECT) != 0)) {
+        LOG_DEBUG("Failed to disable direct I/O on destination file "
+                  "(fd = %d): %s",
+                  dst, strerror(errno));
+        goto FAIL;
+      }
+    }
+
     size_t n_written = 0;
     do {
       ssize_t ret = write(dst, buffer + n_written, n_read - n_written);
@@ -48,81 +159,1391 @@ bool zeugl_filecopy(int src, int dst) {
 
         LOG_DEBUG("Failed to write content to destination file (fd = %d): %s",
                   dst, strerror(errno));
-        return false;
+        if (direct && first && (errno == EINVAL)) {
+          result = COPY_UNSUPPORTED;
+        }
+        goto FAIL;
       }
 
       n_written += (size_t)ret;
+      first = false;
     } while (n_written < n_read);
     LOG_DEBUG("Wrote %zu bytes to destination file (fd = %d)", n_written, dst);
   } while (!eof);
 
-  return true;
+  result = COPY_SUCCESS;
+FAIL:;
+  int save_errno = errno;
+  buffer_free(buffer, size);
+  errno = save_errno;
+
+  return result;
 }
 
-bool zeugl_safe_filecopy(int src, int dst, bool no_block) {
-  struct stat sb_before, sb_after;
+static enum copy_result filecopy_direct(int src, int dst) {
+#ifdef O_DIRECT
+  /* Where to resume if the filesystem rejects direct I/O */
+  const off_t src_offset = lseek(src, 0, SEEK_CUR);
+  const off_t dst_offset = lseek(dst, 0, SEEK_CUR);
+  if ((src_offset < 0) || (dst_offset < 0)) {
+    LOG_DEBUG("Failed to get file offsets (src = %d, dst = %d): %s", src, dst,
+              strerror(errno));
+    return COPY_FAILURE;
+  }
 
-  bool done = false;
-  do {
-    if (fstat(src, &sb_before) != 0) {
-      LOG_DEBUG("Failed to retrieve mtime from source file (fd = %d): %s", src,
+  int src_flags = fcntl(src, F_GETFL);
+  int dst_flags = fcntl(dst, F_GETFL);
+  if ((src_flags < 0) || (dst_flags < 0)) {
+    LOG_DEBUG("Failed to get file status flags (src = %d, dst = %d): %s", src,
+              dst, strerror(errno));
+    return COPY_FAILURE;
+  }
+
+  if (fcntl(src, F_SETFL, src_flags | O_DIRECT) != 0) {
+    LOG_DEBUG("Direct I/O is not supported on source file (fd = %d): %s", src,
+              strerror(errno));
+    return COPY_UNSUPPORTED;
+  }
+
+  if (fcntl(dst, F_SETFL, dst_flags | O_DIRECT) != 0) {
+    LOG_DEBUG("Direct I/O is not supported on destination file (fd = %d): %s",
+              dst, strerror(errno));
+    fcntl(src, F_SETFL, src_flags);
+    return COPY_UNSUPPORTED;
+  }
+  LOG_DEBUG("Enabled direct I/O (src = %d, dst = %d)", src, dst);
+
+  enum copy_result result = filecopy_readwrite(src, dst, true);
+  int save_errno = errno;
+
+  /* The destination file is handed to the caller, so restore its flags */
+  if ((fcntl(src, F_SETFL, src_flags) != 0) ||
+      (fcntl(dst, F_SETFL, dst_flags) != 0)) {
+    LOG_DEBUG("Failed to disable direct I/O (src = %d, dst = %d): %s", src, dst,
+              strerror(errno));
+    return COPY_FAILURE;
+  }
+  LOG_DEBUG("Disabled direct I/O (src = %d, dst = %d)", src, dst);
+
+  if (result == COPY_UNSUPPORTED) {
+    LOG_DEBUG("Direct I/O was rejected (src = %d, dst = %d): %s", src, dst,
+              strerror(save_errno));
+
+    /* Let the fallback start over where we started. Truncating to the same
+     * size would release the space reserved by zeugl_preallocate(). */
+    struct stat sb;
+    if ((lseek(src, src_offset, SEEK_SET) != src_offset) ||
+        (lseek(dst, dst_offset, SEEK_SET) != dst_offset) ||
+        (fstat(dst, &sb) != 0) ||
+        ((sb.st_size > dst_offset) && (ftruncate(dst, dst_offset) != 0))) {
+      LOG_DEBUG("Failed to rewind files (src = %d, dst = %d): %s", src, dst,
                 strerror(errno));
+      return COPY_FAILURE;
+    }
+    return COPY_UNSUPPORTED;
+  }
+
+  errno = save_errno;
+  return result;
+#else  /* O_DIRECT */
+  LOG_DEBUG("Direct I/O is not supported on this platform (src = %d, dst = "
+            "%d)",
+            src, dst);
+  return COPY_UNSUPPORTED;
+#endif /* O_DIRECT */
+}
+
+static enum copy_result filecopy_range(int src, int dst) {
+#ifdef HAVE_COPY_FILE_RANGE
+  size_t n_copied = 0;
+
+  while (true) {
+    /* Let the kernel copy the data. Passing NULL offsets makes it use and
+     * update the file offsets, so a fallback can pick up where we stopped. */
+    ssize_t ret =
+        copy_file_range(src, NULL, dst, NULL, COPY_RANGE_CHUNK_SIZE, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        /* Interrupted! It happens, just continue... */
+        continue;
+      }
+
+      if ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) ||
+          (errno == EOPNOTSUPP) || (errno == EBADF)) {
+        LOG_DEBUG("Kernel copy from source file (fd = %d) to destination file "
+                  "(fd = %d) is not supported after %zu bytes: %s",
+                  src, dst, n_copied, strerror(errno));
+        return COPY_UNSUPPORTED;
+      }
+
+      LOG_DEBUG("Failed to copy from source file (fd = %d) to destination "
+                "file (fd = %d) in kernel: %s",
+                src, dst, strerror(errno));
+      return COPY_FAILURE;
+    }
+
+    if (ret == 0) {
+      /* End-of-File reached */
+      break;
+    }
+
+    n_copied += (size_t)ret;
+  }
+
+  LOG_DEBUG("Copied %zu bytes from source file (fd = %d) to destination file "
+            "(fd = %d) in kernel",
+            n_copied, src, dst);
+  return COPY_SUCCESS;
+#else  /* HAVE_COPY_FILE_RANGE */
+  LOG_DEBUG("Kernel copy is not supported on this platform (src = %d, dst = "
+            "%d)",
+            src, dst);
+  return COPY_UNSUPPORTED;
+#endif /* HAVE_COPY_FILE_RANGE */
+}
+
+static enum copy_result filecopy_splice(int src, int dst) {
+#ifdef HAVE_SPLICE
+  size_t n_copied = 0;
+
+  while (true) {
+    /* Move pages from the pipe straight into the destination file */
+    ssize_t ret = splice(src, NULL, dst, NULL, SPLICE_CHUNK_SIZE,
+                         SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        /* Interrupted! It happens, just continue... */
+        continue;
+      }
+
+      if ((errno == ENOSYS) || (errno == EINVAL)) {
+        LOG_DEBUG("Splicing from source pipe (fd = %d) to destination file "
+                  "(fd = %d) is not supported after %zu bytes: %s",
+                  src, dst, n_copied, strerror(errno));
+        return COPY_UNSUPPORTED;
+      }
+
+      LOG_DEBUG("Failed to splice from source pipe (fd = %d) to destination "
+                "file (fd = %d): %s",
+                src, dst, strerror(errno));
+      return COPY_FAILURE;
+    }
+
+    if (ret == 0) {
+      /* End-of-File reached */
+      break;
+    }
+
+    n_copied += (size_t)ret;
+  }
+
+  LOG_DEBUG("Spliced %zu bytes from source pipe (fd = %d) to destination file "
+            "(fd = %d)",
+            n_copied, src, dst);
+  return COPY_SUCCESS;
+#else  /* HAVE_SPLICE */
+  LOG_DEBUG("Splicing is not supported on this platform (src = %d, dst = %d)",
+            src, dst);
+  return COPY_UNSUPPORTED;
+#endif /* HAVE_SPLICE */
+}
+
+static enum copy_result filecopy_sendfile(int src, int dst) {
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+  size_t n_copied = 0;
+
+  while (true) {
+    /* Passing a NULL offset makes it use and update the source file offset */
+    ssize_t ret = sendfile(dst, src, NULL, SENDFILE_CHUNK_SIZE);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        /* Interrupted! It happens, just continue... */
+        continue;
+      }
+
+      if ((errno == ENOSYS) || (errno == EINVAL)) {
+        LOG_DEBUG("Sending source file (fd = %d) to destination file "
+                  "(fd = %d) is not supported after %zu bytes: %s",
+                  src, dst, n_copied, strerror(errno));
+        return COPY_UNSUPPORTED;
+      }
+
+      LOG_DEBUG("Failed to send source file (fd = %d) to destination file "
+                "(fd = %d): %s",
+                src, dst, strerror(errno));
+      return COPY_FAILURE;
+    }
+
+    if (ret == 0) {
+      /* End-of-File reached */
+      break;
+    }
+
+    n_copied += (size_t)ret;
+  }
+
+  LOG_DEBUG("Sent %zu bytes from source file (fd = %d) to destination file "
+            "(fd = %d)",
+            n_copied, src, dst);
+  return COPY_SUCCESS;
+#else  /* HAVE_SENDFILE && HAVE_SYS_SENDFILE_H */
+  LOG_DEBUG("Sending files is not supported on this platform (src = %d, dst = "
+            "%d)",
+            src, dst);
+  return COPY_UNSUPPORTED;
+#endif /* HAVE_SENDFILE && HAVE_SYS_SENDFILE_H */
+}
+
+static bool filecopy_clone(int src, int dst) {
+#ifdef FICLONE
+  if (ioctl(dst, FICLONE, src) == 0) {
+    LOG_DEBUG("Cloned source file (fd = %d) into destination file (fd = %d)",
+              src, dst);
+    return true;
+  }
+
+  LOG_DEBUG("Failed to clone source file (fd = %d) into destination file "
+            "(fd = %d): %s",
+            src, dst, strerror(errno));
+#else  /* FICLONE */
+  LOG_DEBUG("Cloning files is not supported on this platform (src = %d, dst = "
+            "%d)",
+            src, dst);
+#endif /* FICLONE */
+  return false;
+}
+
+bool zeugl_filecopy(int src, int dst) {
+  struct stat sb;
+  if (fstat(src, &sb) != 0) {
+    LOG_DEBUG("Failed to retrieve file type of source file (fd = %d): %s", src,
+              strerror(errno));
+    return false;
+  }
+
+  /* Pick a zero-copy method based on the type of the source file */
+  enum copy_result result = COPY_UNSUPPORTED;
+  if (S_ISFIFO(sb.st_mode)) {
+    result = filecopy_splice(src, dst);
+  } else if (S_ISREG(sb.st_mode)) {
+    if (zeugl_tunable_has(ZEUGL_ENV_COPY_POLICY, "uring")) {
+      result = zeugl_uring_copy(src, dst);
+    }
+    if (result == COPY_UNSUPPORTED) {
+      result = filecopy_range(src, dst);
+    }
+    if (result == COPY_UNSUPPORTED) {
+      result = filecopy_sendfile(src, dst);
+    }
+  }
+
+  switch (result) {
+  case COPY_SUCCESS:
+    return true;
+  case COPY_FAILURE:
+    return false;
+  case COPY_UNSUPPORTED:
+    break;
+  }
+
+  return filecopy_readwrite(src, dst, false) == COPY_SUCCESS;
+}
+
+static ssize_t read_at(int fd, char *buf, size_t count, off_t offset) {
+  size_t n_read = 0;
+  while (n_read < count) {
+    ssize_t ret = pread(fd, buf + n_read, count - n_read,
+                        offset + (off_t)n_read);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        /* Interrupted! It happens, just continue... */
+        continue;
+      }
+      return -1;
+    }
+
+    if (ret == 0) {
+      /* End-of-File reached */
+      break;
+    }
+
+    n_read += (size_t)ret;
+  }
+  return (ssize_t)n_read;
+}
+
+static bool write_at(int fd, const char *buf, size_t count, off_t offset) {
+  size_t n_written = 0;
+  while (n_written < count) {
+    ssize_t ret = pwrite(fd, buf + n_written, count - n_written,
+                         offset + (off_t)n_written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        /* Interrupted! It happens, just continue... */
+        continue;
+      }
       return false;
     }
 
-    if (!zeugl_filecopy(src, dst)) {
+    if (ret == 0) {
+      /* No progress, and no error to tell why */
+      errno = EIO;
       return false;
     }
 
-    if (fstat(src, &sb_after) != 0) {
-      LOG_DEBUG("Failed to retrieve mtime from source file (fd = %d): %s", src,
+    n_written += (size_t)ret;
+  }
+  return true;
+}
+
+bool zeugl_writev(int fd, const struct iovec *iov, int iovcnt) {
+  off_t offset = 0;
+  int i = 0;
+  while (i < iovcnt) {
+#ifdef HAVE_PWRITEV
+    /* Write as many buffers at once as we may */
+    const int count = (iovcnt - i < IOV_MAX) ? iovcnt - i : IOV_MAX;
+    ssize_t ret = pwritev(fd, iov + i, count, offset);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        /* Interrupted! It happens, just continue... */
+        continue;
+      }
+      LOG_DEBUG("Failed to write %d buffers to file (fd = %d): %s", count, fd,
                 strerror(errno));
       return false;
     }
+    offset += (off_t)ret;
 
-    if (
-#ifdef __APPLE__
-        (sb_before.st_mtimespec.tv_sec == sb_after.st_mtimespec.tv_sec) &&
-        (sb_before.st_mtimespec.tv_nsec == sb_after.st_mtimespec.tv_nsec)
+    /* Skip the buffers that were written completely */
+    size_t n_written = (size_t)ret;
+    while ((i < iovcnt) && (n_written >= iov[i].iov_len)) {
+      n_written -= iov[i].iov_len;
+      i++;
+    }
+    if ((i == iovcnt) || ((n_written == 0) && (ret > 0))) {
+      continue;
+    }
+
+    /* Finish the buffer that was written partially, or not at all if nothing
+     * was written, in which case write_at() fails rather than spin */
+    const size_t len = iov[i].iov_len - n_written;
+    if (!write_at(fd, (const char *)iov[i].iov_base + n_written, len,
+                  offset)) {
+      LOG_DEBUG("Failed to write to file (fd = %d): %s", fd, strerror(errno));
+      return false;
+    }
+    offset += (off_t)len;
+    i++;
 #else
-        (sb_before.st_mtim.tv_sec == sb_after.st_mtim.tv_sec) &&
-        (sb_before.st_mtim.tv_nsec == sb_after.st_mtim.tv_nsec)
-#endif
-    ) {
-      LOG_DEBUG(
-          "Source file (fd = %d) appears to not be modified during file copy",
-          src);
-      done = true;
-    } else {
-      LOG_DEBUG("Source file (fd = %d) was modified while copying contents to "
-                "destination file (%d)",
-                src, dst);
-      if (no_block) {
-        errno = EBUSY;
+    if (!write_at(fd, iov[i].iov_base, iov[i].iov_len, offset)) {
+      LOG_DEBUG("Failed to write to file (fd = %d): %s", fd, strerror(errno));
+      return false;
+    }
+    offset += (off_t)iov[i].iov_len;
+    i++;
+#endif /* HAVE_PWRITEV */
+  }
+  return true;
+}
+
+static bool preallocate_range(int fd, off_t offset, off_t len) {
+  if (len <= 0) {
+    return true;
+  }
+
+#ifdef HAVE_FALLOCATE
+  /* Keep the file size, so that the reserved space is invisible to the
+   * caller, and writes and appends behave as usual */
+  while (fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, len) != 0) {
+    if (errno == EINTR) {
+      /* Interrupted! It happens, just continue... */
+      continue;
+    }
+
+    if ((errno == EOPNOTSUPP) || (errno == ENOSYS)) {
+      LOG_DEBUG("Preallocating file (fd = %d) is not supported: %s", fd,
+                strerror(errno));
+      return true;
+    }
+
+    LOG_DEBUG("Failed to preallocate %jd bytes at offset %jd for file "
+              "(fd = %d): %s",
+              (intmax_t)len, (intmax_t)offset, fd, strerror(errno));
+    return false;
+  }
+
+  LOG_DEBUG("Preallocated %jd bytes at offset %jd for file (fd = %d)",
+            (intmax_t)len, (intmax_t)offset, fd);
+#else  /* HAVE_FALLOCATE */
+  LOG_DEBUG("Preallocating file (fd = %d) is not supported on this platform",
+            fd);
+  (void)offset;
+#endif /* HAVE_FALLOCATE */
+  return true;
+}
+
+bool zeugl_preallocate(int fd, off_t size) {
+  return preallocate_range(fd, 0, size);
+}
+
+/**
+ * Copy len bytes at offset from src to the same offset in dst, without using
+ * or moving the file offsets. The buffer for the fallback is allocated on
+ * first use.
+ */
+static bool copy_extent(int src, int dst, off_t offset, off_t len,
+                        char **buffer, size_t *size) {
+  off_t end = offset + len;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  if (*buffer == NULL) {
+    while (offset < end) {
+      off_t off_in = offset;
+      off_t off_out = offset;
+      size_t count = (size_t)(end - offset);
+      ssize_t ret =
+          copy_file_range(src, &off_in, dst, &off_out,
+                          (count < COPY_RANGE_CHUNK_SIZE) ? count
+                                                          : COPY_RANGE_CHUNK_SIZE,
+                          0);
+      if (ret < 0) {
+        if (errno == EINTR) {
+          /* Interrupted! It happens, just continue... */
+          continue;
+        }
+
+        if ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) ||
+            (errno == EOPNOTSUPP) || (errno == EBADF)) {
+          LOG_DEBUG("Kernel copy from source file (fd = %d) to destination "
+                    "file (fd = %d) is not supported: %s",
+                    src, dst, strerror(errno));
+          break;
+        }
+
+        LOG_DEBUG("Failed to copy from source file (fd = %d) to destination "
+                  "file (fd = %d) in kernel: %s",
+                  src, dst, strerror(errno));
+        return false;
+      }
+
+      if (ret == 0) {
+        /* The source file has shrunk, the caller detects that */
+        return true;
+      }
+
+      offset += (off_t)ret;
+    }
+
+    if (offset >= end) {
+      return true;
+    }
+  }
+#endif /* HAVE_COPY_FILE_RANGE */
+
+  if ((*buffer == NULL) && ((*buffer = buffer_alloc(size)) == NULL)) {
+    return false;
+  }
+
+  while (offset < end) {
+    size_t count = (size_t)(end - offset);
+    ssize_t n_read = read_at(src, *buffer, (count < *size) ? count : *size,
+                             offset);
+    if (n_read < 0) {
+      LOG_DEBUG("Failed to read from source file (fd = %d): %s", src,
+                strerror(errno));
+      return false;
+    }
+
+    if (n_read == 0) {
+      /* The source file has shrunk, the caller detects that */
+      break;
+    }
+
+    if (!write_at(dst, *buffer, (size_t)n_read, offset)) {
+      LOG_DEBUG("Failed to write content to destination file (fd = %d): %s",
+                dst, strerror(errno));
+      return false;
+    }
+
+    offset += (off_t)n_read;
+  }
+
+  return true;
+}
+
+/**
+ * Find the next data extent of src at or after offset. The extent is clamped
+ * to size, and is empty if there is no more data.
+ */
+static enum copy_result next_extent(int src, off_t offset, off_t size,
+                                    off_t *data, off_t *hole) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  *data = lseek(src, offset, SEEK_DATA);
+  if (*data < 0) {
+    if (errno == ENXIO) {
+      /* Only a hole is left */
+      *data = *hole = size;
+      return COPY_SUCCESS;
+    }
+
+    if (errno == EINVAL) {
+      LOG_DEBUG("Seeking data in source file (fd = %d) is not supported: %s",
+                src, strerror(errno));
+      return COPY_UNSUPPORTED;
+    }
+
+    LOG_DEBUG("Failed to seek data in source file (fd = %d): %s", src,
+              strerror(errno));
+    return COPY_FAILURE;
+  }
+
+  *hole = lseek(src, *data, SEEK_HOLE);
+  if (*hole < 0) {
+    if (errno == ENXIO) {
+      /* The source file has shrunk, the caller detects that */
+      *hole = *data;
+      return COPY_SUCCESS;
+    }
+
+    LOG_DEBUG("Failed to seek hole in source file (fd = %d): %s", src,
+              strerror(errno));
+    return COPY_FAILURE;
+  }
+
+  if (*data > size) {
+    *data = size;
+  }
+  if (*hole > size) {
+    *hole = size;
+  }
+  return COPY_SUCCESS;
+#else  /* SEEK_DATA && SEEK_HOLE */
+  LOG_DEBUG("Seeking data is not supported on this platform (fd = %d)", src);
+  (void)offset;
+  (void)size;
+  (void)data;
+  (void)hole;
+  return COPY_UNSUPPORTED;
+#endif /* SEEK_DATA && SEEK_HOLE */
+}
+
+/**
+ * Copy a sparse file by only copying its data extents. The holes in between
+ * are left unwritten, so they are holes in dst as well.
+ */
+static enum copy_result filecopy_sparse(int src, int dst, off_t size,
+                                        uint64_t *n_bytes) {
+  /* Reserve space for the data only, before copying any of it */
+  off_t data, hole;
+  for (off_t offset = 0; offset < size; offset = hole) {
+    enum copy_result result = next_extent(src, offset, size, &data, &hole);
+    if (result != COPY_SUCCESS) {
+      return result;
+    }
+
+    if (hole <= data) {
+      break;
+    }
+
+    if (!preallocate_range(dst, data, hole - data)) {
+      return COPY_FAILURE;
+    }
+  }
+
+  char *buffer = NULL;
+  size_t buffer_size = 0;
+  enum copy_result result = COPY_FAILURE;
+  *n_bytes = 0;
+  for (off_t offset = 0; offset < size; offset = hole) {
+    if (next_extent(src, offset, size, &data, &hole) != COPY_SUCCESS) {
+      goto FAIL;
+    }
+
+    if (hole <= data) {
+      break;
+    }
+
+    if (!copy_extent(src, dst, data, hole - data, &buffer, &buffer_size)) {
+      goto FAIL;
+    }
+    LOG_DEBUG("Copied data extent of %jd bytes at offset %jd from source file "
+              "(fd = %d) to destination file (fd = %d)",
+              (intmax_t)(hole - data), (intmax_t)data, src, dst);
+    *n_bytes += (uint64_t)(hole - data);
+  }
+
+  /* Recreate the trailing hole, if any */
+  if (ftruncate(dst, size) != 0) {
+    LOG_DEBUG("Failed to extend destination file (fd = %d) to %jd bytes: %s",
+              dst, (intmax_t)size, strerror(errno));
+    goto FAIL;
+  }
+
+  LOG_DEBUG("Copied %ju bytes of data from sparse source file (fd = %d) of "
+            "%jd bytes to destination file (fd = %d)",
+            (uintmax_t)*n_bytes, src, (intmax_t)size, dst);
+  result = COPY_SUCCESS;
+FAIL:;
+  int save_errno = errno;
+  buffer_free(buffer, buffer_size);
+  errno = save_errno;
+
+  return result;
+}
+
+#ifdef HAVE_PTHREAD
+/**
+ * State shared by the threads of a parallel copy. The chunks are handed out in
+ * order, so the file is written roughly front to back.
+ */
+struct parallel_copy {
+  int src;
+  int dst;
+  off_t size;
+  off_t chunk_size;
+  pthread_mutex_t mutex; /* Protects the fields below */
+  off_t next;            /* Offset of the next chunk to copy */
+  int error;             /* errno of the first failure, or 0 */
+};
+
+static void *parallel_worker(void *arg) {
+  struct parallel_copy *copy = arg;
+  char *buffer = NULL;
+  size_t buffer_size = 0;
+
+  while (true) {
+    pthread_mutex_lock(&copy->mutex);
+    const off_t offset = copy->next;
+    const bool done = (copy->error != 0) || (offset >= copy->size);
+    if (!done) {
+      copy->next += copy->chunk_size;
+    }
+    pthread_mutex_unlock(&copy->mutex);
+
+    if (done) {
+      break;
+    }
+
+    const off_t len = (copy->size - offset < copy->chunk_size)
+                          ? copy->size - offset
+                          : copy->chunk_size;
+    if (!copy_extent(copy->src, copy->dst, offset, len, &buffer,
+                     &buffer_size)) {
+      pthread_mutex_lock(&copy->mutex);
+      if (copy->error == 0) {
+        copy->error = (errno != 0) ? errno : EIO;
+      }
+      pthread_mutex_unlock(&copy->mutex);
+      break;
+    }
+  }
+
+  buffer_free(buffer, buffer_size);
+  return NULL;
+}
+#endif /* HAVE_PTHREAD */
+
+/**
+ * Copy a large file by splitting it into chunks that are copied by a pool of
+ * threads. The calling thread copies chunks as well.
+ */
+static enum copy_result filecopy_parallel(int src, int dst, off_t size) {
+#ifdef HAVE_PTHREAD
+  const size_t n_threads = zeugl_copy_threads();
+  const off_t chunk_size = (off_t)zeugl_copy_chunk_size();
+  if ((n_threads < 2) || (size <= chunk_size)) {
+    LOG_DEBUG("Parallel copy of source file (fd = %d) is not worth it for %jd "
+              "bytes with %zu threads and chunks of %jd bytes",
+              src, (intmax_t)size, n_threads, (intmax_t)chunk_size);
+    return COPY_UNSUPPORTED;
+  }
+
+  struct parallel_copy copy = {
+      .src = src,
+      .dst = dst,
+      .size = size,
+      .chunk_size = chunk_size,
+      .next = 0,
+      .error = 0,
+  };
+  int ret = pthread_mutex_init(&copy.mutex, NULL);
+  if (ret != 0) {
+    LOG_DEBUG("Failed to initialize mutex: %s", strerror(ret));
+    return COPY_UNSUPPORTED;
+  }
+
+  pthread_t *threads = calloc(n_threads - 1, sizeof(pthread_t));
+  if (threads == NULL) {
+    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+    pthread_mutex_destroy(&copy.mutex);
+    return COPY_FAILURE;
+  }
+
+  size_t n_started = 0;
+  while (n_started < n_threads - 1) {
+    ret = pthread_create(&threads[n_started], NULL, parallel_worker, &copy);
+    if (ret != 0) {
+      /* Make do with the threads we got */
+      LOG_DEBUG("Failed to create copy thread: %s", strerror(ret));
+      break;
+    }
+    n_started += 1;
+  }
+
+  parallel_worker(&copy);
+
+  for (size_t i = 0; i < n_started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  pthread_mutex_destroy(&copy.mutex);
+
+  if (copy.error != 0) {
+    LOG_DEBUG("Failed to copy source file (fd = %d) to destination file "
+              "(fd = %d) in parallel: %s",
+              src, dst, strerror(copy.error));
+    errno = copy.error;
+    return COPY_FAILURE;
+  }
+
+  LOG_DEBUG("Copied %jd bytes from source file (fd = %d) to destination file "
+            "(fd = %d) with %zu threads in chunks of %jd bytes",
+            (intmax_t)size, src, dst, n_started + 1, (intmax_t)chunk_size);
+  return COPY_SUCCESS;
+#else  /* HAVE_PTHREAD */
+  LOG_DEBUG("Parallel copy is not supported on this platform (src = %d, dst = "
+            "%d)",
+            src, dst);
+  (void)size;
+  return COPY_UNSUPPORTED;
+#endif /* HAVE_PTHREAD */
+}
+
+static bool filecopy_whole(int src, int dst, int flags, uint64_t *n_bytes) {
+  /* Always start from a clean slate */
+  if (lseek(src, 0, SEEK_SET) != 0) {
+    LOG_DEBUG("Failed to rewind source file (fd = %d): %s", src,
+              strerror(errno));
+    return false;
+  }
+
+  if (lseek(dst, 0, SEEK_SET) != 0) {
+    LOG_DEBUG("Failed to rewind destination file (fd = %d): %s", dst,
+              strerror(errno));
+    return false;
+  }
+
+  if (ftruncate(dst, 0) != 0) {
+    LOG_DEBUG("Failed to truncate destination file (fd = %d): %s", dst,
+              strerror(errno));
+    return false;
+  }
+
+  bool sparse = false;
+  if (!filecopy_clone(src, dst)) {
+    struct stat sb;
+    if (fstat(src, &sb) != 0) {
+      LOG_DEBUG("Failed to retrieve size of source file (fd = %d): %s", src,
+                strerror(errno));
+      return false;
+    }
+
+    enum copy_result result = COPY_UNSUPPORTED;
+
+    /* A regular file with fewer blocks than its size needs has holes */
+    if (S_ISREG(sb.st_mode) && ((off_t)sb.st_blocks * 512 < sb.st_size)) {
+      result = filecopy_sparse(src, dst, sb.st_size, n_bytes);
+      sparse = (result == COPY_SUCCESS);
+    }
+
+    if (result == COPY_UNSUPPORTED) {
+      if (!zeugl_preallocate(dst, sb.st_size)) {
         return false;
       }
+
+      if (flags & Z_PARALLEL) {
+        result = filecopy_parallel(src, dst, sb.st_size);
+      }
+
+      /* Direct I/O bypasses the page cache, so try it before the methods
+       * that go through it */
+      if ((result == COPY_UNSUPPORTED) && (flags & Z_DIRECT)) {
+        result = filecopy_direct(src, dst);
+      }
+      if (result == COPY_UNSUPPORTED) {
+        result = zeugl_filecopy(src, dst) ? COPY_SUCCESS : COPY_FAILURE;
+      }
+    }
+
+    if (result == COPY_FAILURE) {
+      return false;
+    }
+  }
+
+  /* Cloning and sparse copies do not move the file offset, but callers expect
+   * it to be positioned at the end of the copied content. */
+  off_t end = lseek(dst, 0, SEEK_END);
+  if (end < 0) {
+    LOG_DEBUG("Failed to reposition file offset to the end of destination "
+              "file (fd = %d): %s",
+              dst, strerror(errno));
+    return false;
+  }
+
+  /* Holes are not copied, so only count the data */
+  if (!sparse) {
+    *n_bytes = (uint64_t)end;
+  }
+  return true;
+}
+
+/**
+ * Checksums of the blocks of the destination file, as written by the previous
+ * call to filecopy_update()
+ */
+struct block_sums {
+  uint64_t *sums;
+  size_t count;      /* Number of blocks with a checksum */
+  size_t capacity;   /* Number of checksums there is room for */
+  size_t block_size; /* Size of the blocks the checksums are of */
+};
+
+static uint64_t rotl64(uint64_t x, unsigned int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+/**
+ * Checksum a block, eight bytes at a time. The length is mixed in, so that a
+ * block that grew or shrank differs as well.
+ */
+static uint64_t block_sum(const char *block, size_t len) {
+  /* Mixing steps and constants of MurmurHash3 */
+  uint64_t hash = (uint64_t)len;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, block + i, sizeof(word));
+    word *= 0x87c37b91114253d5ULL;
+    word = rotl64(word, 31);
+    word *= 0x4cf5ad432745937fULL;
+    hash ^= word;
+    hash = rotl64(hash, 27) * 5 + 0x52dce729;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, block + i, len - i);
+  hash ^= tail * 0x87c37b91114253d5ULL;
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/**
+ * Position in the data extents of a file, to tell which blocks lie in holes
+ */
+struct extents {
+  int fd;
+  off_t size; /* Size of the file, beyond which nothing is a hole */
+  bool seek;  /* Cleared if seeking data is not supported */
+  off_t data; /* Start of the next data extent */
+  off_t hole; /* End of the next data extent */
+};
+
+/**
+ * Tell whether the block from offset to end lies entirely in a hole, looking up
+ * the next data extent once the previous one is passed. Blocks are never
+ * reported to lie in holes if seeking data is not supported.
+ */
+static bool in_hole(struct extents *ext, off_t offset, off_t end,
+                    bool *hole) {
+  *hole = false;
+  if (!ext->seek || (offset >= ext->size)) {
+    return true;
+  }
+
+  if (offset >= ext->hole) {
+    switch (next_extent(ext->fd, offset, ext->size, &ext->data, &ext->hole)) {
+    case COPY_SUCCESS:
+      break;
+    case COPY_FAILURE:
+      return false;
+    case COPY_UNSUPPORTED:
+      ext->seek = false;
+      return true;
+    }
+  }
+
+  *hole = (end <= ext->data);
+  return true;
+}
+
+/**
+ * Read the block of fd at offset, or zero it without reading if it lies in a
+ * hole. Returns the length of the block, which is zero at the End-of-File, or
+ * -1 on error.
+ */
+static ssize_t read_block(struct extents *ext, char *block, size_t block_size,
+                          off_t offset, bool *hole) {
+  off_t end = offset + (off_t)block_size;
+  if (end > ext->size) {
+    end = ext->size;
+  }
+
+  if (!in_hole(ext, offset, end, hole)) {
+    return -1;
+  }
+  if (*hole) {
+    memset(block, 0, (size_t)(end - offset));
+    return (ssize_t)(end - offset);
+  }
+  return read_at(ext->fd, block, block_size, offset);
+}
+
+static bool extents_init(struct extents *ext, int fd) {
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    LOG_DEBUG("Failed to retrieve size of file (fd = %d): %s", fd,
+              strerror(errno));
+    return false;
+  }
+
+  ext->fd = fd;
+  ext->size = sb.st_size;
+  ext->seek = true;
+  ext->data = ext->hole = 0;
+  return true;
+}
+
+static bool block_sums_grow(struct block_sums *sums, size_t index) {
+  if (index < sums->capacity) {
+    return true;
+  }
+
+  const size_t capacity = (sums->capacity == 0) ? 64 : sums->capacity * 2;
+  uint64_t *grown = realloc(sums->sums, capacity * sizeof(uint64_t));
+  if (grown == NULL) {
+    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+    return false;
+  }
+  sums->sums = grown;
+  sums->capacity = capacity;
+  return true;
+}
+
+/**
+ * Record the checksums of the blocks of dst after the first copy, which may be
+ * done in kernel without the data passing through here. Holes are not read.
+ */
+static bool filecopy_checksum(int dst, struct block_sums *sums) {
+  size_t block_size;
+  char *block = buffer_alloc(&block_size);
+  if (block == NULL) {
+    return false;
+  }
+  sums->block_size = block_size;
+  sums->count = 0;
+
+  bool success = false;
+  struct extents ext;
+  if (!extents_init(&ext, dst)) {
+    goto FAIL;
+  }
+
+  off_t offset = 0;
+  while (true) {
+    bool hole;
+    ssize_t n_dst = read_block(&ext, block, block_size, offset, &hole);
+    if (n_dst < 0) {
+      LOG_DEBUG("Failed to read from destination file (fd = %d): %s", dst,
+                strerror(errno));
+      goto FAIL;
+    }
+
+    if (n_dst == 0) {
+      /* End-of-File reached */
+      break;
+    }
+
+    if (!block_sums_grow(sums, sums->count)) {
+      goto FAIL;
+    }
+    sums->sums[sums->count] = block_sum(block, (size_t)n_dst);
+    sums->count += 1;
+    offset += (off_t)n_dst;
+  }
+
+  LOG_DEBUG("Recorded checksums of %zu blocks of destination file (fd = %d)",
+            sums->count, dst);
+  success = true;
+FAIL:;
+  int save_errno = errno;
+  buffer_free(block, block_size);
+  errno = save_errno;
+
+  return success;
+}
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+static bool punch_hole(int fd, off_t offset, off_t len) {
+  while (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+                   len) != 0) {
+    if (errno == EINTR) {
+      /* Interrupted! It happens, just continue... */
+      continue;
+    }
+
+    LOG_DEBUG("Failed to punch hole of %jd bytes at offset %jd in file "
+              "(fd = %d): %s",
+              (intmax_t)len, (intmax_t)offset, fd, strerror(errno));
+    return false;
+  }
+  return true;
+}
+#else  /* HAVE_FALLOCATE && FALLOC_FL_PUNCH_HOLE */
+static bool punch_hole(int fd, off_t offset, off_t len) {
+  LOG_DEBUG("Punching holes in file (fd = %d) is not supported on this "
+            "platform",
+            fd);
+  (void)offset;
+  (void)len;
+  return false;
+}
+#endif /* HAVE_FALLOCATE && FALLOC_FL_PUNCH_HOLE */
+
+/**
+ * Bring dst up to date with src after a previous copy, by only rewriting the
+ * blocks whose checksum differs from the one recorded when they were last
+ * written (see filecopy_checksum()). The source file is read once, except for
+ * its holes, and the destination file not at all. A block in a hole of src
+ * that differs is punched out of dst rather than written as zeros, where
+ * supported.
+ */
+static bool filecopy_update(int src, int dst, struct block_sums *sums,
+                            uint64_t *n_bytes) {
+  size_t block_size;
+  char *block = buffer_alloc(&block_size);
+  if (block == NULL) {
+    return false;
+  }
+
+  /* Checksums of blocks of another size are of no use */
+  if (sums->block_size != block_size) {
+    sums->block_size = block_size;
+    sums->count = 0;
+  }
+
+  bool success = false;
+  struct extents ext;
+  if (!extents_init(&ext, src)) {
+    goto FAIL;
+  }
+
+  size_t index = 0;
+  off_t offset = 0;
+  while (true) {
+    bool hole;
+    ssize_t n_src = read_block(&ext, block, block_size, offset, &hole);
+    if (n_src < 0) {
+      LOG_DEBUG("Failed to read from source file (fd = %d): %s", src,
+                strerror(errno));
+      goto FAIL;
+    }
+
+    if (n_src == 0) {
+      /* End-of-File reached */
+      break;
+    }
+
+    if (!block_sums_grow(sums, index)) {
+      goto FAIL;
+    }
+
+    const uint64_t sum = block_sum(block, (size_t)n_src);
+    if ((index >= sums->count) || (sums->sums[index] != sum)) {
+      if (!(hole && punch_hole(dst, offset, (off_t)n_src)) &&
+          !write_at(dst, block, (size_t)n_src, offset)) {
+        LOG_DEBUG("Failed to write content to destination file (fd = %d): %s",
+                  dst, strerror(errno));
+        goto FAIL;
+      }
+      *n_bytes += (uint64_t)n_src;
+    }
+    sums->sums[index] = sum;
+    index += 1;
+    if (sums->count < index) {
+      sums->count = index;
+    }
+
+    offset += (off_t)n_src;
+  }
+
+  /* The source file may have shrunk */
+  sums->count = index;
+  if (ftruncate(dst, offset) != 0) {
+    LOG_DEBUG("Failed to truncate destination file (fd = %d) to %jd bytes: %s",
+              dst, (intmax_t)offset, strerror(errno));
+    goto FAIL;
+  }
+
+  if (lseek(dst, offset, SEEK_SET) != offset) {
+    LOG_DEBUG("Failed to reposition file offset to the end of destination "
+              "file (fd = %d): %s",
+              dst, strerror(errno));
+    goto FAIL;
+  }
+
+  LOG_DEBUG("Rewrote %ju bytes of destination file (fd = %d) that differed "
+            "from source file (fd = %d)",
+            (uintmax_t)*n_bytes, dst, src);
+  success = true;
+FAIL:;
+  int save_errno = errno;
+  buffer_free(block, block_size);
+  errno = save_errno;
+
+  return success;
+}
+
+bool zeugl_same_content(int a, int b, bool *same) {
+  *same = false;
+
+  struct stat st_a, st_b;
+  if ((fstat(a, &st_a) != 0) || (fstat(b, &st_b) != 0)) {
+    LOG_DEBUG("Failed to get file status of file (fd = %d or %d): %s", a, b,
+              strerror(errno));
+    return false;
+  }
+  if (st_a.st_size != st_b.st_size) {
+    LOG_DEBUG("File (fd = %d) has %jd bytes, file (fd = %d) has %jd bytes", a,
+              (intmax_t)st_a.st_size, b, (intmax_t)st_b.st_size);
+    return true;
+  }
+
+  size_t size;
+  char *buffer = buffer_alloc(&size);
+  if (buffer == NULL) {
+    return false;
+  }
+
+  /* Split the buffer in two, one half for each file */
+  const size_t block_size = size / 2;
+  char *block_a = buffer;
+  char *block_b = buffer + block_size;
+
+  bool success = false;
+  off_t offset = 0;
+  while (true) {
+    ssize_t n_a = read_at(a, block_a, block_size, offset);
+    if (n_a < 0) {
+      LOG_DEBUG("Failed to read from file (fd = %d): %s", a, strerror(errno));
+      goto FAIL;
     }
-  } while (!done);
 
+    ssize_t n_b = read_at(b, block_b, block_size, offset);
+    if (n_b < 0) {
+      LOG_DEBUG("Failed to read from file (fd = %d): %s", b, strerror(errno));
+      goto FAIL;
+    }
+
+    /* A file that changed size in the meantime differs as well */
+    if ((n_a != n_b) || (memcmp(block_a, block_b, (size_t)n_a) != 0)) {
+      LOG_DEBUG("File (fd = %d) differs from file (fd = %d) after offset %jd",
+                a, b, (intmax_t)offset);
+      success = true;
+      goto FAIL;
+    }
+
+    if (n_a == 0) {
+      /* End-of-File reached */
+      break;
+    }
+
+    offset += (off_t)n_a;
+  }
+
+  LOG_DEBUG("File (fd = %d) has the same %jd bytes as file (fd = %d)", a,
+            (intmax_t)offset, b);
+  *same = true;
+  success = true;
+FAIL:;
+  int save_errno = errno;
+  buffer_free(buffer, size);
+  errno = save_errno;
+
+  return success;
+}
+
+static bool same_mtime(const struct stat *a, const struct stat *b) {
+#ifdef __APPLE__
+  return (a->st_mtimespec.tv_sec == b->st_mtimespec.tv_sec) &&
+         (a->st_mtimespec.tv_nsec == b->st_mtimespec.tv_nsec);
+#else
+  return (a->st_mtim.tv_sec == b->st_mtim.tv_sec) &&
+         (a->st_mtim.tv_nsec == b->st_mtim.tv_nsec);
+#endif
+}
+
+static void advise(ZEUGL_NDEBUG_UNUSED const char *name, int fd,
+                   int advice) {
+#ifdef HAVE_POSIX_FADVISE
+  int ret = posix_fadvise(fd, 0, 0, advice);
+  if (ret != 0) {
+    LOG_DEBUG("Failed to give %s advice on file (fd = %d): %s", name, fd,
+              strerror(ret));
+  }
+#else  /* HAVE_POSIX_FADVISE */
+  LOG_DEBUG("Cannot give %s advice on file (fd = %d): Not supported on this "
+            "platform",
+            name, fd);
+  (void)advice;
+#endif /* HAVE_POSIX_FADVISE */
+}
+
+bool zeugl_trim(int fd) {
+#ifdef HAVE_FALLOCATE
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    LOG_DEBUG("Failed to retrieve size of file (fd = %d): %s", fd,
+              strerror(errno));
+    return false;
+  }
+
+  /* Truncating to the current size releases the blocks reserved beyond the
+   * End-of-File */
+  if (ftruncate(fd, sb.st_size) != 0) {
+    LOG_DEBUG("Failed to trim file (fd = %d) to %jd bytes: %s", fd,
+              (intmax_t)sb.st_size, strerror(errno));
+    return false;
+  }
+  LOG_DEBUG("Trimmed file (fd = %d) to %jd bytes", fd, (intmax_t)sb.st_size);
+#else  /* HAVE_FALLOCATE */
+  LOG_DEBUG("Nothing to trim for file (fd = %d) on this platform", fd);
+#endif /* HAVE_FALLOCATE */
   return true;
 }
 
-bool zeugl_atomic_filecopy(int src, int dst, bool no_block) {
+void zeugl_drop_cache(int fd) {
+#ifdef HAVE_POSIX_FADVISE
+  advise("DONTNEED", fd, POSIX_FADV_DONTNEED);
+#else  /* HAVE_POSIX_FADVISE */
+  advise("DONTNEED", fd, 0);
+#endif /* HAVE_POSIX_FADVISE */
+}
+
+bool zeugl_safe_filecopy(int src, int dst, int flags, struct zstats *stats) {
+  const uint64_t deadline =
+      zeugl_now() + ((uint64_t)COPY_TIMEOUT * 1000000ULL);
+
+#ifdef HAVE_POSIX_FADVISE
+  if (flags & Z_NOCACHE) {
+    /* Read ahead aggressively and drop pages behind */
+    advise("SEQUENTIAL", src, POSIX_FADV_SEQUENTIAL);
+  }
+#endif /* HAVE_POSIX_FADVISE */
+
+  /* Only filled in once the source file was modified during a copy */
+  struct block_sums sums = {NULL, 0, 0, 0};
   bool success = false;
 
-  int lock = LOCK_SH;
-  if (no_block) {
-    lock |= LOCK_NB;
+  for (unsigned int attempt = 1;; attempt++) {
+    struct stat sb_before, sb_after;
+    if (fstat(src, &sb_before) != 0) {
+      LOG_DEBUG("Failed to retrieve mtime from source file (fd = %d): %s", src,
+                strerror(errno));
+      goto FAIL;
+    }
+
+    /* The first attempt copies everything, while retries only rewrite what
+     * changed since the previous attempt. */
+    uint64_t n_bytes = 0;
+    stats->copy_attempts = attempt;
+    if (attempt == 1) {
+      if (!filecopy_whole(src, dst, flags, &n_bytes)) {
+        goto FAIL;
+      }
+    } else {
+      if (!filecopy_update(src, dst, &sums, &n_bytes)) {
+        goto FAIL;
+      }
+      stats->wasted_bytes += n_bytes;
+    }
+    stats->copy_bytes += n_bytes;
+
+    if (fstat(src, &sb_after) != 0) {
+      LOG_DEBUG("Failed to retrieve mtime from source file (fd = %d): %s", src,
+                strerror(errno));
+      goto FAIL;
+    }
+
+    if (same_mtime(&sb_before, &sb_after)) {
+      LOG_DEBUG("Source file (fd = %d) appears to not be modified during file "
+                "copy (attempts = %u, copied = %ju bytes, wasted = %ju bytes)",
+                src, stats->copy_attempts, (uintmax_t)stats->copy_bytes,
+                (uintmax_t)stats->wasted_bytes);
+      if (flags & Z_NOCACHE) {
+        zeugl_drop_cache(src);
+      }
+      success = true;
+      break;
+    }
+
+    LOG_DEBUG("Source file (fd = %d) was modified while copying contents to "
+              "destination file (%d) (attempt %u of %u)",
+              src, dst, attempt, (unsigned int)COPY_MAX_ATTEMPTS);
+    if (flags & Z_NOBLOCK) {
+      errno = EBUSY;
+      goto FAIL;
+    }
+
+    if (attempt >= COPY_MAX_ATTEMPTS) {
+      LOG_DEBUG("Giving up copying source file (fd = %d) after %u attempts",
+                src, attempt);
+      errno = EBUSY;
+      goto FAIL;
+    }
+
+    if (zeugl_now() >= deadline) {
+      LOG_DEBUG("Giving up copying source file (fd = %d) after %d ms", src,
+                COPY_TIMEOUT);
+      errno = EBUSY;
+      goto FAIL;
+    }
+
+    /* Retries compare against what the first attempt wrote */
+    if ((attempt == 1) && !filecopy_checksum(dst, &sums)) {
+      goto FAIL;
+    }
+
+    zeugl_backoff(attempt, deadline);
   }
 
-  if (flock(src, lock) != 0) {
+FAIL:;
+  int save_errno = errno;
+  free(sums.sums);
+  errno = save_errno;
+
+  return success;
+}
+
+bool zeugl_atomic_filecopy(int src, int dst, int flags, int timeout,
+                           struct zstats *stats) {
+  bool success = false;
+
+  uint64_t waited = 0;
+  const bool locked = zeugl_lock(src, LOCK_SH, timeout, &waited);
+  stats->open_lock_wait_ns += waited;
+  if (!locked) {
     LOG_DEBUG("Failed to get shared lock for source file (fd = %d): %s", src,
               strerror(errno));
     return false;
   }
   LOG_DEBUG("Requested shared lock for source file (fd = %d)", src);
 
-  if (!zeugl_safe_filecopy(src, dst, no_block)) {
+  if (!zeugl_safe_filecopy(src, dst, flags, stats)) {
     LOG_DEBUG("Failed to copy content from source file (fd = %d) to "
               "destination file (fd = %d): %s",
               src, dst, strerror(errno));
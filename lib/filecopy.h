@@ -2,11 +2,79 @@
 #define __ZEUGL_FILECOPY_H__
 
 #include <stdbool.h>
+#include <sys/types.h>
 
+struct iovec;
+struct zstats;
+
+enum copy_result {
+  COPY_SUCCESS,     /* Everything was copied */
+  COPY_UNSUPPORTED, /* Method not supported, fallback can resume the copy */
+  COPY_FAILURE,     /* Unrecoverable error, errno is set */
+};
+
+/**
+ * @brief Copy from the current offset of src until End-of-File into dst.
+ * @note The copy is done in kernel when possible, using splice(2) if src is a
+ * pipe, or copy_file_range(2) or sendfile(2) if src is a regular file. Falls
+ * back to a read/write loop otherwise.
+ */
 bool zeugl_filecopy(int src, int dst);
 
-bool zeugl_safe_filecopy(int src, int dst, bool no_block);
+/**
+ * @brief Replace the content of dst with the entire content of src.
+ * @note The source file is cloned (reflink) if the filesystem supports it.
+ * Otherwise the content is copied with zeugl_filecopy(). If the source file is
+ * modified in the meantime, the blocks of dst are checksummed, src is read
+ * again, and only the blocks whose checksum changed are rewritten. This is
+ * retried with backoff up to COPY_MAX_ATTEMPTS times or COPY_TIMEOUT
+ * milliseconds, unless Z_NOBLOCK is set in flags. The copy policies Z_NOCACHE
+ * and Z_DIRECT are also taken from flags. The number of attempts and bytes
+ * copied are added to stats.
+ */
+bool zeugl_safe_filecopy(int src, int dst, int flags, struct zstats *stats);
+
+/**
+ * @brief Same as zeugl_safe_filecopy(), while holding a shared lock on src.
+ * @note The lock is waited for at most timeout milliseconds (see
+ * zeugl_lock()), and the time spent waiting is added to stats.
+ */
+bool zeugl_atomic_filecopy(int src, int dst, int flags, int timeout,
+                           struct zstats *stats);
+
+/**
+ * @brief Write the buffers of an I/O vector to a file, starting at offset 0.
+ * @note Partial writes are resumed, and vectors longer than IOV_MAX are
+ * written in several calls to pwritev(2).
+ */
+bool zeugl_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Check whether two files have the same content.
+ * @param same Set to true if they have, false otherwise.
+ * @return false on error with errno set, true otherwise.
+ * @note The sizes are compared first, so that files of different sizes are
+ * not read at all.
+ */
+bool zeugl_same_content(int a, int b, bool *same);
+
+/**
+ * @brief Reserve disk space for a file without changing its size.
+ * @return false if the space could not be reserved (e.g., errno is set to
+ * ENOSPC), true otherwise. Also returns true if preallocation is not supported.
+ */
+bool zeugl_preallocate(int fd, off_t size);
+
+/**
+ * @brief Release disk space reserved with zeugl_preallocate() that ended up
+ * beyond the End-of-File.
+ */
+bool zeugl_trim(int fd);
 
-bool zeugl_atomic_filecopy(int src, int dst, bool no_block);
+/**
+ * @brief Advise the kernel to drop the cached pages of a file.
+ * @note Dirty pages are written back, but not necessarily dropped.
+ */
+void zeugl_drop_cache(int fd);
 
 #endif /* __ZEUGL_FILECOPY_H__ */
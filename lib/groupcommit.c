@@ -0,0 +1,209 @@
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "groupcommit.h"
+#include "logger.h"
+#include "tunables.h"
+
+#ifdef HAVE_PTHREAD
+
+/**
+ * A caller waiting for its file descriptor to be flushed. Members live on the
+ * stack of their callers, so joining a group does not allocate.
+ */
+struct group_member {
+  int fd;
+  dev_t dev; /* Members with the same device and inode share a flush */
+  ino_t ino;
+  int error; /* Set by the leader, zero on success */
+  bool done;
+  struct group_member *next;
+};
+
+/**
+ * The first caller to join a group becomes its leader. The leader waits for
+ * the group commit window and for the previous group to be flushed, and then
+ * flushes everyone who joined in the meantime.
+ */
+struct group {
+  const char *name;
+  int (*sync)(int fd);
+  pthread_mutex_t mutex; /* Protects the fields below */
+  pthread_cond_t cond;
+  struct group_member *pending; /* Members of the group being collected */
+  bool collecting;              /* A leader is collecting a group */
+  bool flushing;                /* A group is being flushed */
+};
+
+#ifdef HAVE_SYNCFS
+static struct group FILE_GROUP = {
+    .name = "file",
+    .sync = syncfs,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+#endif /* HAVE_SYNCFS */
+
+static struct group DIR_GROUP = {
+    .name = "directory",
+    .sync = fsync,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void flush_group(struct group *group, struct group_member *members) {
+  for (struct group_member *m = members; m != NULL; m = m->next) {
+    m->error = -1;
+  }
+
+  for (struct group_member *m = members; m != NULL; m = m->next) {
+    if (m->error >= 0) {
+      /* Already covered by an earlier flush */
+      continue;
+    }
+
+    int error = 0;
+    if (group->sync(m->fd) == 0) {
+      LOG_DEBUG("Flushed %s group (fd = %d)", group->name, m->fd);
+    } else {
+      error = errno;
+      LOG_DEBUG("Failed to flush %s group (fd = %d): %s", group->name, m->fd,
+                strerror(error));
+    }
+
+    for (struct group_member *n = m; n != NULL; n = n->next) {
+      if ((n->error < 0) && (n->dev == m->dev) && (n->ino == m->ino)) {
+        n->error = error;
+      }
+    }
+  }
+}
+
+static void wait_window(void) {
+  const unsigned long window = zeugl_group_commit_window();
+  if (window == 0) {
+    return;
+  }
+
+  struct timespec ts = {
+      .tv_sec = (time_t)(window / 1000000UL),
+      .tv_nsec = (long)(window % 1000000UL) * 1000L,
+  };
+  while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR)) {
+  }
+}
+
+static bool group_join(struct group *group, struct group_member *self) {
+  self->error = 0;
+  self->done = false;
+
+  pthread_mutex_lock(&group->mutex);
+  self->next = group->pending;
+  group->pending = self;
+
+  if (group->collecting) {
+    /* Somebody else leads this group */
+    while (!self->done) {
+      pthread_cond_wait(&group->cond, &group->mutex);
+    }
+    pthread_mutex_unlock(&group->mutex);
+  } else {
+    group->collecting = true;
+    pthread_mutex_unlock(&group->mutex);
+
+    wait_window();
+
+    /* Everyone who joins while the previous group is flushed is flushed along
+     * with this group */
+    pthread_mutex_lock(&group->mutex);
+    while (group->flushing) {
+      pthread_cond_wait(&group->cond, &group->mutex);
+    }
+    struct group_member *members = group->pending;
+    group->pending = NULL;
+    group->collecting = false;
+    group->flushing = true;
+    pthread_mutex_unlock(&group->mutex);
+
+    flush_group(group, members);
+
+    pthread_mutex_lock(&group->mutex);
+    size_t num_members = 0;
+    for (struct group_member *m = members; m != NULL; m = m->next) {
+      m->done = true;
+      num_members += 1;
+    }
+    group->flushing = false;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->mutex);
+
+    LOG_DEBUG("Flushed %s group of %zu members", group->name, num_members);
+  }
+
+  if (self->error != 0) {
+    errno = self->error;
+    return false;
+  }
+  return true;
+}
+
+#endif /* HAVE_PTHREAD */
+
+bool zeugl_group_sync_file(int fd, bool data_only, bool *grouped) {
+  *grouped = false;
+#if defined(HAVE_PTHREAD) && defined(HAVE_SYNCFS)
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    LOG_DEBUG("Failed to stat file (fd = %d): %s", fd, strerror(errno));
+    return false;
+  }
+
+  /* Files on the same filesystem share a flush */
+  struct group_member self = {.fd = fd, .dev = sb.st_dev, .ino = 0};
+  if (group_join(&FILE_GROUP, &self)) {
+    *grouped = true;
+    return true;
+  }
+
+  /* syncfs(2) reports one error for the whole filesystem, so it does not tell
+   * whether our file made it */
+  LOG_DEBUG("Flushing file (fd = %d) on its own after failed group flush: %s",
+            fd, strerror(errno));
+#endif /* HAVE_PTHREAD && HAVE_SYNCFS */
+
+  if ((data_only ? fdatasync(fd) : fsync(fd)) != 0) {
+    LOG_DEBUG("Failed to synchronize file (fd = %d): %s", fd, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool zeugl_group_sync_dir(int dirfd) {
+#ifdef HAVE_PTHREAD
+  struct stat sb;
+  if (fstat(dirfd, &sb) != 0) {
+    LOG_DEBUG("Failed to stat directory (fd = %d): %s", dirfd,
+              strerror(errno));
+    return false;
+  }
+
+  struct group_member self = {.fd = dirfd, .dev = sb.st_dev, .ino = sb.st_ino};
+  return group_join(&DIR_GROUP, &self);
+#else  /* HAVE_PTHREAD */
+  if (fsync(dirfd) != 0) {
+    LOG_DEBUG("Failed to synchronize directory (fd = %d): %s", dirfd,
+              strerror(errno));
+    return false;
+  }
+  return true;
+#endif /* HAVE_PTHREAD */
+}
@@ -0,0 +1,33 @@
+#ifndef __ZEUGL_GROUPCOMMIT_H__
+#define __ZEUGL_GROUPCOMMIT_H__
+
+#include <stdbool.h>
+
+/**
+ * @brief Flush the content and metadata of a file to disk, together with the
+ * files of concurrent callers.
+ * @param fd File descriptor of the file.
+ * @param data_only Only require the content and the metadata needed to read
+ * it back, as with fdatasync(2), instead of all metadata.
+ * @param grouped Set if the file was flushed by the syncfs(2) of the group
+ * alone, cleared if it was flushed on its own.
+ * @return true on success. On error false is returned and errno is set.
+ * @note Callers that arrive within the group commit window share one
+ * syncfs(2) per filesystem, which flushes their files as well. Only if it
+ * fails, each caller flushes its own file, so that it gets the writeback error
+ * of its own file rather than the one of the whole filesystem. Without
+ * syncfs(2) the file is flushed on its own.
+ */
+bool zeugl_group_sync_file(int fd, bool data_only, bool *grouped);
+
+/**
+ * @brief Flush a directory to disk, together with the directories of
+ * concurrent callers.
+ * @param dirfd File descriptor of the directory.
+ * @return true on success. On error false is returned and errno is set.
+ * @note Callers that arrive within the group commit window share one fsync(2)
+ * per directory.
+ */
+bool zeugl_group_sync_dir(int dirfd);
+
+#endif /* __ZEUGL_GROUPCOMMIT_H__ */
@@ -5,24 +5,24 @@
 
 /**
  * @brief Check if file has immutable attribute.
- * @param path Path to the file to check.
+ * @param fd File descriptor of the file to check.
  * @return true if file is immutable, false otherwise.
  */
-bool zeugl_is_immutable(const char *path);
+bool zeugl_is_immutable(int fd);
 
 /**
  * @brief Remove immutable attribute from file.
- * @param path Path to the file to modify.
+ * @param fd File descriptor of the file to modify.
  * @return true if immutable attribute was successfully cleared, false
  * otherwise.
  */
-bool zeugl_clear_immutable(const char *path);
+bool zeugl_clear_immutable(int fd);
 
 /**
  * @brief Set immutable attribute on file.
- * @param path Path to the file to modify.
+ * @param fd File descriptor of the file to modify.
  * @return true if immutable attribute was successfully set, false otherwise.
  */
-bool zeugl_set_immutable(const char *path);
+bool zeugl_set_immutable(int fd);
 
 #endif /* __ZEUGL_IMMUTABLE_H__ */
@@ -8,27 +8,27 @@
 #include "immutable.h"
 #include "logger.h"
 
-bool zeugl_is_immutable(const char *path) {
+bool zeugl_is_immutable(int fd) {
   struct stat st;
-  if (stat(path, &st) == 0) {
-    LOG_DEBUG("Retrieved file attributes for '%s'", path);
+  if (fstat(fd, &st) == 0) {
+    LOG_DEBUG("Retrieved file attributes (fd = %d)", fd);
   } else {
-    LOG_DEBUG("Failed to retrieve file attributes for '%s': %s", path,
+    LOG_DEBUG("Failed to retrieve file attributes (fd = %d): %s", fd,
               strerror(errno));
     return false;
   }
 
   bool immutable = (st.st_flags & (UF_IMMUTABLE | SF_IMMUTABLE)) != 0;
-  LOG_DEBUG("File '%s' is %s", path, immutable ? "immutable" : "mutable");
+  LOG_DEBUG("File (fd = %d) is %s", fd, immutable ? "immutable" : "mutable");
   return immutable;
 }
 
-bool zeugl_clear_immutable(const char *path) {
+bool zeugl_clear_immutable(int fd) {
   struct stat st;
-  if (stat(path, &st) == 0) {
-    LOG_DEBUG("Retrieved file attributes for '%s'", path);
+  if (fstat(fd, &st) == 0) {
+    LOG_DEBUG("Retrieved file attributes (fd = %d)", fd);
   } else {
-    LOG_DEBUG("Failed to retrieve file attributes for '%s': %s", path,
+    LOG_DEBUG("Failed to retrieve file attributes (fd = %d): %s", fd,
               strerror(errno));
     return false;
   }
@@ -36,22 +36,22 @@ bool zeugl_clear_immutable(const char *path) {
   u_int32_t flags = st.st_flags;
   flags &= (u_int32_t) ~(UF_IMMUTABLE | SF_IMMUTABLE);
 
-  if (chflags(path, flags) < 0) {
-    LOG_DEBUG("Failed to clear immutable flag for '%s': %s", path,
+  if (fchflags(fd, flags) < 0) {
+    LOG_DEBUG("Failed to clear immutable flag (fd = %d): %s", fd,
               strerror(errno));
     return false;
   }
 
-  LOG_DEBUG("Cleared immutable flag from '%s'", path);
+  LOG_DEBUG("Cleared immutable flag (fd = %d)", fd);
   return true;
 }
 
-bool zeugl_set_immutable(const char *path) {
+bool zeugl_set_immutable(int fd) {
   struct stat st;
-  if (stat(path, &st) == 0) {
-    LOG_DEBUG("Retrieved file attributes for '%s'", path);
+  if (fstat(fd, &st) == 0) {
+    LOG_DEBUG("Retrieved file attributes (fd = %d)", fd);
   } else {
-    LOG_DEBUG("Failed to retrieve file attributes for '%s': %s", path,
+    LOG_DEBUG("Failed to retrieve file attributes (fd = %d): %s", fd,
               strerror(errno));
     return false;
   }
@@ -59,12 +59,12 @@ bool zeugl_set_immutable(const char *path) {
   u_int32_t flags = st.st_flags;
   flags |= UF_IMMUTABLE;
 
-  if (chflags(path, flags) < 0) {
-    LOG_DEBUG("Failed to set immutable flag for '%s': %s", path,
+  if (fchflags(fd, flags) < 0) {
+    LOG_DEBUG("Failed to set immutable flag (fd = %d): %s", fd,
               strerror(errno));
     return false;
   }
 
-  LOG_DEBUG("Set immutable flag on '%s'", path);
+  LOG_DEBUG("Set immutable flag (fd = %d)", fd);
   return true;
 }
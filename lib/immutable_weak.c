@@ -6,17 +6,17 @@
 #include "logger.h"
 #include "utils.h"
 
-bool zeugl_is_immutable(ZEUGL_NDEBUG_UNUSED const char *path) {
-  LOG_DEBUG("Immutable operations not supported on this platform", path);
+bool zeugl_is_immutable(__attribute__((unused)) int fd) {
+  LOG_DEBUG("Immutable operations not supported on this platform");
   return false;
 }
 
-bool zeugl_clear_immutable(ZEUGL_NDEBUG_UNUSED const char *path) {
+bool zeugl_clear_immutable(__attribute__((unused)) int fd) {
   LOG_DEBUG("Immutable operations not supported on this platform");
   return true;
 }
 
-bool zeugl_set_immutable(ZEUGL_NDEBUG_UNUSED const char *path) {
+bool zeugl_set_immutable(__attribute__((unused)) int fd) {
   LOG_DEBUG("Immutable operations not supported on this platform");
   return true;
 }
@@ -0,0 +1,69 @@
+#include "config.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+
+#include "backoff.h"
+#include "lock.h"
+#include "logger.h"
+
+#define NSEC_PER_MSEC 1000000ULL
+
+/* Number of times to yield the processor before backing off */
+#define LOCK_SPINS 8
+
+static bool try_lock(int fd, int operation, int timeout) {
+  const uint64_t timeout_ns = (unsigned int)timeout * NSEC_PER_MSEC;
+  const uint64_t deadline = zeugl_now() + timeout_ns;
+
+  for (unsigned int attempt = 1;; attempt++) {
+    if (flock(fd, operation | LOCK_NB) == 0) {
+      return true;
+    }
+    if ((errno != EWOULDBLOCK) || (timeout == 0)) {
+      return false;
+    }
+
+    if (zeugl_now() >= deadline) {
+      LOG_DEBUG("Timed out waiting for lock on file (fd = %d) after %d ms", fd,
+                timeout);
+      errno = ETIMEDOUT;
+      return false;
+    }
+
+    if (attempt <= LOCK_SPINS) {
+      sched_yield();
+    } else {
+      zeugl_backoff(attempt - LOCK_SPINS, deadline);
+    }
+  }
+}
+
+bool zeugl_lock(int fd, int operation, int timeout, uint64_t *waited) {
+  if (timeout == ZEUGL_LOCK_HELD) {
+    LOG_DEBUG("Not locking file (fd = %d): Caller holds a lock", fd);
+    return true;
+  }
+
+  const uint64_t start = zeugl_now();
+
+  bool success;
+  if (timeout == ZEUGL_LOCK_FOREVER) {
+    success = (flock(fd, operation) == 0);
+  } else {
+    success = try_lock(fd, operation, timeout);
+  }
+
+  const uint64_t elapsed = zeugl_now() - start;
+  *waited += elapsed;
+  if (success) {
+    LOG_DEBUG("Acquired %s lock on file (fd = %d) after %llu us",
+              (operation == LOCK_EX) ? "exclusive" : "shared", fd,
+              (unsigned long long)(elapsed / 1000));
+  }
+  return success;
+}
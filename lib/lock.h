@@ -0,0 +1,31 @@
+#ifndef __ZEUGL_LOCK_H__
+#define __ZEUGL_LOCK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Lock timeout to wait as long as it takes */
+#define ZEUGL_LOCK_FOREVER -1
+
+/* Lock timeout for a caller that already holds a lock serializing access to
+ * the file (see zeugl_shmlock_acquire()), so that no lock is applied */
+#define ZEUGL_LOCK_HELD -2
+
+/**
+ * @brief Apply an advisory lock (see flock(2)) to a file, waiting at most
+ * timeout milliseconds for it.
+ * @param fd File descriptor of the file.
+ * @param operation LOCK_SH or LOCK_EX.
+ * @param timeout Maximum number of milliseconds to wait, zero to not wait at
+ * all, ZEUGL_LOCK_FOREVER or ZEUGL_LOCK_HELD.
+ * @param waited Incremented by the number of nanoseconds spent waiting.
+ * @return true on success. On error false is returned and errno is set, to
+ * EWOULDBLOCK if the timeout is zero and the file is locked, or to ETIMEDOUT
+ * if the timeout expired.
+ * @note flock(2) cannot wait with a timeout. A bounded wait first yields the
+ * processor a few times, for locks that are only held briefly, and then
+ * retries with randomized exponential backoff until the deadline.
+ */
+bool zeugl_lock(int fd, int operation, int timeout, uint64_t *waited);
+
+#endif /* __ZEUGL_LOCK_H__ */
@@ -0,0 +1,115 @@
+#include "config.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "registry.h"
+
+/* The registry is a two level table indexed by file descriptor. Pages of
+ * slots are allocated on first use and never freed, so a reader holding a page
+ * pointer can never see it go away. */
+#define REGISTRY_PAGE_BITS 10
+#define REGISTRY_PAGE_SIZE (1 << REGISTRY_PAGE_BITS)
+#define REGISTRY_NUM_PAGES 1024
+
+/* File descriptors from this one and up cannot be registered */
+#define REGISTRY_MAX_FD (REGISTRY_NUM_PAGES * REGISTRY_PAGE_SIZE)
+
+static void **REGISTRY[REGISTRY_NUM_PAGES];
+
+static void **get_page(int fd, bool create) {
+  void ***slot = &REGISTRY[fd >> REGISTRY_PAGE_BITS];
+  void **page = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+  if ((page != NULL) || !create) {
+    return page;
+  }
+
+  void **new_page = calloc(REGISTRY_PAGE_SIZE, sizeof(void *));
+  if (new_page == NULL) {
+    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+    return NULL;
+  }
+
+  /* Another thread may have beaten us to it */
+  if (!__atomic_compare_exchange_n(slot, &page, new_page, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    free(new_page);
+    return page;
+  }
+
+  LOG_DEBUG("Allocated registry page for file descriptors %d to %d",
+            fd & ~(REGISTRY_PAGE_SIZE - 1),
+            (fd | (REGISTRY_PAGE_SIZE - 1)));
+  return new_page;
+}
+
+bool zeugl_registry_add(int fd, void *entry) {
+  if ((fd < 0) || (fd >= REGISTRY_MAX_FD)) {
+    LOG_DEBUG("File descriptor %d is out of range for the registry", fd);
+    errno = EMFILE;
+    return false;
+  }
+
+  void **page = get_page(fd, true);
+  if (page == NULL) {
+    return false;
+  }
+
+  /* Publish the entry only after it was fully initialized */
+  __atomic_store_n(&page[fd & (REGISTRY_PAGE_SIZE - 1)], entry,
+                   __ATOMIC_RELEASE);
+  return true;
+}
+
+void *zeugl_registry_take(int fd) {
+  if ((fd < 0) || (fd >= REGISTRY_MAX_FD)) {
+    return NULL;
+  }
+
+  void **page = get_page(fd, false);
+  if (page == NULL) {
+    return NULL;
+  }
+
+  return __atomic_exchange_n(&page[fd & (REGISTRY_PAGE_SIZE - 1)], NULL,
+                             __ATOMIC_ACQ_REL);
+}
+
+void *zeugl_registry_get(int fd) {
+  if ((fd < 0) || (fd >= REGISTRY_MAX_FD)) {
+    return NULL;
+  }
+
+  void **page = get_page(fd, false);
+  if (page == NULL) {
+    return NULL;
+  }
+
+  return __atomic_load_n(&page[fd & (REGISTRY_PAGE_SIZE - 1)],
+                         __ATOMIC_ACQUIRE);
+}
+
+void zeugl_registry_drain(void (*func)(void *entry)) {
+  for (size_t i = 0; i < REGISTRY_NUM_PAGES; i++) {
+    void **page = __atomic_load_n(&REGISTRY[i], __ATOMIC_ACQUIRE);
+    if (page == NULL) {
+      continue;
+    }
+
+    for (size_t j = 0; j < REGISTRY_PAGE_SIZE; j++) {
+      /* Cheap check first, the exchange makes sure we own the entry */
+      if (__atomic_load_n(&page[j], __ATOMIC_RELAXED) == NULL) {
+        continue;
+      }
+
+      void *entry = __atomic_exchange_n(&page[j], NULL, __ATOMIC_ACQ_REL);
+      if (entry != NULL) {
+        func(entry);
+      }
+    }
+  }
+}
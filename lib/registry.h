@@ -0,0 +1,43 @@
+#ifndef __ZEUGL_REGISTRY_H__
+#define __ZEUGL_REGISTRY_H__
+
+#include <stdbool.h>
+
+/**
+ * @brief Register an entry under a file descriptor.
+ * @param fd File descriptor to register the entry under. It must not already
+ * have an entry.
+ * @param entry Fully initialized entry. It is published to other threads and
+ * signal handlers by this call.
+ * @return true on success. On error false is returned and errno is set (i.e.,
+ * EMFILE if fd is too large for the registry, or ENOMEM).
+ * @note Lookups and insertions take constant time, and no lock is held.
+ */
+bool zeugl_registry_add(int fd, void *entry);
+
+/**
+ * @brief Remove the entry registered under a file descriptor.
+ * @param fd File descriptor of the entry.
+ * @return The entry, or NULL if there is none. If several threads take the
+ * same file descriptor at once, only one of them gets the entry.
+ */
+void *zeugl_registry_take(int fd);
+
+/**
+ * @brief Look up the entry registered under a file descriptor, without
+ * removing it.
+ * @param fd File descriptor of the entry.
+ * @return The entry, or NULL if there is none. The caller must make sure the
+ * entry is not taken and freed by another thread in the meantime.
+ */
+void *zeugl_registry_get(int fd);
+
+/**
+ * @brief Remove every entry and pass it to a function.
+ * @param func Function called once for each entry.
+ * @note This is async-signal-safe, so it can be used from signal handlers.
+ * Entries taken by other threads in the meantime are not passed to func.
+ */
+void zeugl_registry_drain(void (*func)(void *entry));
+
+#endif /* __ZEUGL_REGISTRY_H__ */
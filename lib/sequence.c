@@ -0,0 +1,90 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_FSETXATTR)
+#include <sys/xattr.h>
+#define HAVE_SEQUENCE_XATTR 1
+#endif
+
+#include "logger.h"
+#include "sequence.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/* Extended attribute holding the sequence number, in decimal */
+#define SEQUENCE_XATTR "user.zeugl.seq"
+
+uint64_t zeugl_sequence_next(uint64_t base) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  const uint64_t now =
+      ((uint64_t)ts.tv_sec * NSEC_PER_SEC) + (uint64_t)ts.tv_nsec;
+
+  /* Stay ahead of the original file, even if the clock went backwards */
+  return (now > base) ? now : base + 1;
+}
+
+uint64_t zeugl_sequence_get(int fd) {
+#ifdef HAVE_SEQUENCE_XATTR
+  char value[32];
+#ifdef __APPLE__
+  ssize_t len = fgetxattr(fd, SEQUENCE_XATTR, value, sizeof(value) - 1, 0, 0);
+#else
+  ssize_t len = fgetxattr(fd, SEQUENCE_XATTR, value, sizeof(value) - 1);
+#endif
+  if (len < 0) {
+    return 0;
+  }
+  value[len] = '\0';
+  return strtoull(value, NULL, 10);
+#else  /* HAVE_SEQUENCE_XATTR */
+  (void)fd;
+  return 0;
+#endif /* HAVE_SEQUENCE_XATTR */
+}
+
+uint64_t zeugl_sequence_get_at(int dirfd, const char *name) {
+#ifdef HAVE_SEQUENCE_XATTR
+  int fd = openat(dirfd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return 0;
+  }
+  uint64_t seq = zeugl_sequence_get(fd);
+  close(fd);
+  return seq;
+#else  /* HAVE_SEQUENCE_XATTR */
+  (void)dirfd;
+  (void)name;
+  return 0;
+#endif /* HAVE_SEQUENCE_XATTR */
+}
+
+void zeugl_sequence_set(int fd, uint64_t seq) {
+#ifdef HAVE_SEQUENCE_XATTR
+  char value[32];
+  int len = snprintf(value, sizeof(value), "%" PRIu64, seq);
+#ifdef __APPLE__
+  int ret = fsetxattr(fd, SEQUENCE_XATTR, value, (size_t)len, 0, 0);
+#else
+  int ret = fsetxattr(fd, SEQUENCE_XATTR, value, (size_t)len, 0);
+#endif
+  if (ret != 0) {
+    LOG_DEBUG("Failed to record sequence number %" PRIu64 " (fd = %d): %s",
+              seq, fd, strerror(errno));
+    return;
+  }
+  LOG_DEBUG("Recorded sequence number %" PRIu64 " (fd = %d)", seq, fd);
+#else  /* HAVE_SEQUENCE_XATTR */
+  (void)fd;
+  (void)seq;
+#endif /* HAVE_SEQUENCE_XATTR */
+}
@@ -0,0 +1,37 @@
+#ifndef __ZEUGL_SEQUENCE_H__
+#define __ZEUGL_SEQUENCE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Get a new sequence number for a transaction.
+ * @param base Sequence number of the original file, or zero.
+ * @return A sequence number greater than base. Sequence numbers are taken
+ * from the real time clock in nanoseconds, so they increase across processes.
+ */
+uint64_t zeugl_sequence_next(uint64_t base);
+
+/**
+ * @brief Get the sequence number of the transaction that committed a file.
+ * @param fd File descriptor of the file.
+ * @return The sequence number, or zero if the file has none.
+ */
+uint64_t zeugl_sequence_get(int fd);
+
+/**
+ * @brief Same as zeugl_sequence_get(), for a file relative to a directory.
+ * @return The sequence number, or zero if the file has none or is missing.
+ */
+uint64_t zeugl_sequence_get_at(int dirfd, const char *name);
+
+/**
+ * @brief Record the sequence number of a transaction on its temporary file.
+ * @param fd File descriptor of the temporary file.
+ * @param seq Sequence number.
+ * @note The sequence number is kept in the extended attribute user.zeugl.seq.
+ * It is not recorded if the filesystem has no extended attributes.
+ */
+void zeugl_sequence_set(int fd, uint64_t seq);
+
+#endif /* __ZEUGL_SEQUENCE_H__ */
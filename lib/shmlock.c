@@ -0,0 +1,924 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif /* HAVE_PTHREAD */
+
+#ifdef HAVE_SHM_OPEN
+#include <sys/mman.h>
+#endif /* HAVE_SHM_OPEN */
+
+#ifdef HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif /* HAVE_LINUX_FUTEX_H */
+
+#include "backoff.h"
+#include "lock.h"
+#include "logger.h"
+#include "shmlock.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+
+/* Number of locks per directory that can be held or waited for at the same
+ * time, by all processes together */
+#define SHMLOCK_REQUESTS 1024
+
+/* Number of processes that can use the lock table of a directory at the same
+ * time */
+#define SHMLOCK_OWNERS 1024
+
+/* Set in the claim of a request while its owner sets it up */
+#define SHMLOCK_SETUP ((uint64_t)1 << 63)
+
+/* Nanoseconds to wait before checking whether an owner is still alive */
+#define SHMLOCK_CHECK_NSEC (10 * NSEC_PER_MSEC)
+
+/* Number of unused lock tables kept mapped */
+#define SHMLOCK_CACHE_SIZE 8
+
+/* Number of times to yield the processor while a request is set up, before
+ * sleeping */
+#define SHMLOCK_SPINS 8
+
+/* Number of attempts at opening a lock table that is being removed */
+#define SHMLOCK_OPEN_ATTEMPTS 8
+
+/**
+ * A request for the lock on a file, held or waited for. Requests for the same
+ * file are granted in the order of their tickets, as in Lamport's bakery
+ * algorithm, so that the lock is granted in the order it was requested.
+ */
+struct shmlock_request {
+  /* Owner of the request (see claim_owner()), or zero if the request is free.
+   * The owner is recorded by the same atomic operation that takes the request,
+   * with SHMLOCK_SETUP set until the ticket is drawn. */
+  uint64_t claim;
+  uint64_t ticket;
+  uint64_t hash;           /* Hash of name, to skip comparing most names */
+  uint32_t seq;            /* Incremented whenever the request is freed */
+  uint32_t waiters;        /* Set by those sleeping until seq changes */
+  char name[NAME_MAX + 1]; /* Name of the file in the directory */
+} __attribute__((aligned(64)));
+
+/**
+ * The lock table of a directory, mapped from a shared memory object. A table
+ * filled with zeros is a table without locks.
+ */
+struct shmlock_shared {
+  uint32_t unlinked;     /* Set before the shared memory object is removed */
+  uint32_t num_requests; /* Number of requests that were ever taken */
+  /* Incremented whenever a process takes an owner slot */
+  uint32_t generations[SHMLOCK_OWNERS];
+  struct shmlock_request requests[SHMLOCK_REQUESTS];
+};
+
+/* Owner slot k belongs to the process holding a write lock (see fcntl(2)) on
+ * byte OWNER_OFFSET + k of the shared memory object. The kernel drops the lock
+ * when the process exits, however it exits, so the liveness of an owner can be
+ * told without process IDs, which differ between PID namespaces. */
+#define OWNER_OFFSET ((off_t)sizeof(struct shmlock_shared))
+
+/**
+ * A lock table mapped into this process.
+ */
+struct zeugl_shmlock_table {
+  struct shmlock_shared *shared;
+  int fd; /* Shared memory object, kept open for the lock on the owner slot */
+  dev_t dev;              /* Device of the directory */
+  ino_t ino;              /* Inode of the directory */
+  uint64_t owner;         /* Claim of the requests of this process */
+  unsigned long process;  /* Process that owner belongs to, see process() */
+  size_t refs;            /* Locks held or being acquired in the table */
+  unsigned long last_use; /* For evicting the least recently used table */
+  bool cached;
+  struct zeugl_shmlock_table *next;
+};
+
+#ifdef HAVE_SHM_OPEN
+
+static struct zeugl_shmlock_table *SHMLOCK_CACHE = NULL;
+static unsigned long SHMLOCK_CLOCK = 0;
+static bool SHMLOCK_HANDLERS = false;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t SHMLOCK_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+
+/* Number of times this process was forked off its ancestors */
+static unsigned long SHMLOCK_FORKS = 0;
+#endif /* HAVE_PTHREAD */
+
+static void cache_lock(void) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&SHMLOCK_MUTEX);
+#endif /* HAVE_PTHREAD */
+}
+
+static void cache_unlock(void) {
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&SHMLOCK_MUTEX);
+#endif /* HAVE_PTHREAD */
+}
+
+static bool cache_trylock(void) {
+#ifdef HAVE_PTHREAD
+  return pthread_mutex_trylock(&SHMLOCK_MUTEX) == 0;
+#else
+  return true;
+#endif /* HAVE_PTHREAD */
+}
+
+#ifdef HAVE_PTHREAD
+static void after_fork_in_child(void) {
+  SHMLOCK_FORKS += 1;
+  cache_unlock();
+}
+#endif /* HAVE_PTHREAD */
+
+/**
+ * Identify the calling process without a system call where possible. A forked
+ * child inherits the lock tables of its parent, but not its owner slots.
+ */
+static unsigned long process(void) {
+#ifdef HAVE_PTHREAD
+  return __atomic_load_n(&SHMLOCK_FORKS, __ATOMIC_RELAXED);
+#else
+  return (unsigned long)getpid();
+#endif /* HAVE_PTHREAD */
+}
+
+static void table_name(dev_t dev, ino_t ino, char *name, size_t size) {
+  snprintf(name, size, "/zeugl.%jx.%jx", (uintmax_t)dev, (uintmax_t)ino);
+}
+
+/**
+ * Get the mode of the lock table of a directory: Readable and writable by
+ * those who may write to the directory.
+ */
+static mode_t table_mode(const struct stat *dir) {
+  const mode_t writable = dir->st_mode & 0222;
+  return writable | (writable << 1);
+}
+
+/**
+ * Check that a lock table belongs to somebody who may write to the directory,
+ * and that nobody else may use it, so that nobody else can meddle with the
+ * locks on its files. A table of ours that is too permissive is fixed.
+ */
+static bool is_trusted(int fd, const struct stat *st, const struct stat *dir) {
+  const bool trusted_owner =
+      (st->st_uid == geteuid()) || (st->st_uid == dir->st_uid) ||
+      (st->st_uid == 0) ||
+      ((dir->st_mode & S_IWGRP) && (st->st_gid == dir->st_gid)) ||
+      (dir->st_mode & S_IWOTH);
+  if (!trusted_owner) {
+    LOG_DEBUG("Lock table belongs to user %ju and group %ju, who may not write "
+              "to the directory",
+              (uintmax_t)st->st_uid, (uintmax_t)st->st_gid);
+    return false;
+  }
+
+  const mode_t mode = table_mode(dir);
+  if ((st->st_mode & 0777 & ~mode) == 0) {
+    return true;
+  }
+  if ((st->st_uid == geteuid()) && (fchmod(fd, st->st_mode & mode) == 0)) {
+    LOG_DEBUG("Restricted mode of lock table to %04jo", (uintmax_t)mode);
+    return true;
+  }
+  LOG_DEBUG("Lock table has mode %04jo, which is more permissive than %04jo",
+            (uintmax_t)(st->st_mode & 0777), (uintmax_t)mode);
+  return false;
+}
+
+/**
+ * Open and map the lock table of a directory, creating it if needed.
+ */
+static bool map_table(const struct stat *dir, const char *name,
+                      struct zeugl_shmlock_table *table) {
+  const mode_t mode = table_mode(dir);
+  bool created = true;
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+  if ((fd < 0) && (errno == EEXIST)) {
+    created = false;
+    fd = shm_open(name, O_RDWR, 0);
+  }
+  if (fd < 0) {
+    LOG_DEBUG("Failed to open lock table '%s': %s", name, strerror(errno));
+    return false;
+  }
+
+  if (created) {
+    /* The mode given to shm_open() is subject to the umask */
+    if (fchmod(fd, mode) != 0) {
+      LOG_DEBUG("Failed to change mode of lock table '%s' to %04jo: %s", name,
+                (uintmax_t)mode, strerror(errno));
+      goto FAIL;
+    }
+    /* Members of the group of the directory share its lock table */
+    if ((dir->st_mode & S_IWGRP) && (fchown(fd, (uid_t)-1, dir->st_gid) != 0)) {
+      LOG_DEBUG("Failed to change group of lock table '%s' to %ju: %s", name,
+                (uintmax_t)dir->st_gid, strerror(errno));
+    }
+    LOG_DEBUG("Created lock table '%s' with mode %04jo", name,
+              (uintmax_t)mode);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    LOG_DEBUG("Failed to stat lock table '%s' (fd = %d): %s", name, fd,
+              strerror(errno));
+    goto FAIL;
+  }
+  if (!is_trusted(fd, &st, dir)) {
+    errno = EACCES;
+    goto FAIL;
+  }
+
+  /* Every process grows the table before mapping it, so that no process maps
+   * it before it is large enough */
+  if ((st.st_size < (off_t)sizeof(struct shmlock_shared)) &&
+      (ftruncate(fd, (off_t)sizeof(struct shmlock_shared)) != 0)) {
+    LOG_DEBUG("Failed to resize lock table '%s' (fd = %d): %s", name, fd,
+              strerror(errno));
+    goto FAIL;
+  }
+
+  void *addr = mmap(NULL, sizeof(struct shmlock_shared),
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    LOG_DEBUG("Failed to map lock table '%s' (fd = %d): %s", name, fd,
+              strerror(errno));
+    goto FAIL;
+  }
+  table->shared = addr;
+  table->fd = fd;
+  LOG_DEBUG("Mapped lock table '%s' (fd = %d)", name, fd);
+  return true;
+
+FAIL:;
+  int save_errno = errno;
+  close(fd);
+  errno = save_errno;
+  return false;
+}
+
+/**
+ * Take an unused owner slot for the calling process. Returns false with errno
+ * set to EAGAIN if all slots are in use, or if the table is being removed.
+ */
+static bool claim_owner(struct zeugl_shmlock_table *table) {
+  const uint32_t start = (uint32_t)getpid() % SHMLOCK_OWNERS;
+  for (uint32_t i = 0; i < SHMLOCK_OWNERS; i++) {
+    const uint32_t index = (start + i) % SHMLOCK_OWNERS;
+    struct flock fl = {
+        .l_type = F_WRLCK,
+        .l_whence = SEEK_SET,
+        .l_start = OWNER_OFFSET + (off_t)index,
+        .l_len = 1,
+    };
+    if (fcntl(table->fd, F_SETLK, &fl) != 0) {
+      if ((errno == EACCES) || (errno == EAGAIN)) {
+        continue; /* Slot is in use */
+      }
+      LOG_DEBUG("Failed to lock owner slot %lu of lock table (fd = %d): %s",
+                (unsigned long)index, table->fd, strerror(errno));
+      return false;
+    }
+
+    /* Whoever removes the table sets this while holding all owner slots */
+    if (__atomic_load_n(&table->shared->unlinked, __ATOMIC_SEQ_CST)) {
+      LOG_DEBUG("Lock table (fd = %d) is being removed", table->fd);
+      errno = EAGAIN;
+      return false;
+    }
+
+    const uint32_t generation = __atomic_add_fetch(
+        &table->shared->generations[index], 1, __ATOMIC_SEQ_CST);
+    table->owner = ((uint64_t)(index + 1) << 32) | generation;
+    table->process = process();
+    LOG_DEBUG("Took owner slot %lu of lock table (fd = %d)",
+              (unsigned long)index, table->fd);
+    return true;
+  }
+
+  LOG_DEBUG("All %d owner slots of lock table (fd = %d) are in use",
+            SHMLOCK_OWNERS, table->fd);
+  errno = EAGAIN;
+  return false;
+}
+
+/**
+ * Unmap a lock table and free it. The shared memory object is removed if no
+ * other process uses it.
+ */
+static void close_table(struct zeugl_shmlock_table *table) {
+  struct flock fl = {
+      .l_type = F_WRLCK,
+      .l_whence = SEEK_SET,
+      .l_start = OWNER_OFFSET,
+      .l_len = SHMLOCK_OWNERS,
+  };
+  if ((fcntl(table->fd, F_SETLK, &fl) == 0) &&
+      !__atomic_load_n(&table->shared->unlinked, __ATOMIC_SEQ_CST)) {
+    /* Processes that open the table from now on start over with a new one */
+    __atomic_store_n(&table->shared->unlinked, 1, __ATOMIC_SEQ_CST);
+    char name[64];
+    table_name(table->dev, table->ino, name, sizeof(name));
+    if (shm_unlink(name) == 0) {
+      LOG_DEBUG("Removed lock table '%s'", name);
+    } else {
+      LOG_DEBUG("Failed to remove lock table '%s': %s", name, strerror(errno));
+    }
+  }
+
+  if (munmap(table->shared, sizeof(struct shmlock_shared)) == 0) {
+    LOG_DEBUG("Unmapped lock table (fd = %d)", table->fd);
+  } else {
+    LOG_DEBUG("Failed to unmap lock table (fd = %d): %s", table->fd,
+              strerror(errno));
+  }
+  /* Closing the file descriptor releases our owner slot */
+  close(table->fd);
+  free(table);
+}
+
+/**
+ * Open the lock table of a directory and take an owner slot in it.
+ */
+static struct zeugl_shmlock_table *open_table(const struct stat *dir) {
+  struct zeugl_shmlock_table *table = malloc(sizeof(*table));
+  if (table == NULL) {
+    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+    return NULL;
+  }
+  table->dev = dir->st_dev;
+  table->ino = dir->st_ino;
+  table->refs = 0;
+  table->cached = false;
+  table->next = NULL;
+
+  char name[64];
+  table_name(dir->st_dev, dir->st_ino, name, sizeof(name));
+  for (unsigned int attempt = 1;; attempt++) {
+    if (map_table(dir, name, table)) {
+      if (claim_owner(table)) {
+        return table;
+      }
+      int save_errno = errno;
+      munmap(table->shared, sizeof(struct shmlock_shared));
+      close(table->fd);
+      errno = save_errno;
+    }
+
+    /* A table may be removed while we open it, and a new table may not have
+     * its final mode yet */
+    if (((errno != EAGAIN) && (errno != ENOENT) && (errno != EACCES)) ||
+        (attempt == SHMLOCK_OPEN_ATTEMPTS)) {
+      if (errno == EAGAIN) {
+        errno = ENOLCK;
+      }
+      int save_errno = errno;
+      free(table);
+      errno = save_errno;
+      return NULL;
+    }
+    zeugl_backoff(attempt, UINT64_MAX);
+  }
+}
+
+/**
+ * Take a table out of the cache, and close it unless it is in use.
+ */
+static void uncache_table(struct zeugl_shmlock_table *table) {
+  for (struct zeugl_shmlock_table **t = &SHMLOCK_CACHE; *t != NULL;
+       t = &(*t)->next) {
+    if (*t == table) {
+      *t = table->next;
+      break;
+    }
+  }
+  table->cached = false;
+  if (table->refs == 0) {
+    close_table(table);
+  }
+}
+
+/**
+ * Close the least recently used tables that are not in use, beyond the ones
+ * that are kept mapped.
+ */
+static void evict_tables(void) {
+  for (;;) {
+    size_t unused = 0;
+    struct zeugl_shmlock_table *victim = NULL;
+    for (struct zeugl_shmlock_table *t = SHMLOCK_CACHE; t != NULL;
+         t = t->next) {
+      if (t->refs == 0) {
+        unused += 1;
+        if ((victim == NULL) || (t->last_use < victim->last_use)) {
+          victim = t;
+        }
+      }
+    }
+    if (unused <= SHMLOCK_CACHE_SIZE) {
+      return;
+    }
+    uncache_table(victim);
+  }
+}
+
+/**
+ * Close the tables that are not in use at exit, so that the shared memory
+ * objects are removed once no process uses them anymore.
+ */
+static void close_tables(void) {
+  if (!cache_trylock()) {
+    return;
+  }
+  struct zeugl_shmlock_table *t = SHMLOCK_CACHE;
+  while (t != NULL) {
+    struct zeugl_shmlock_table *next = t->next;
+    if (t->refs == 0) {
+      uncache_table(t);
+    }
+    t = next;
+  }
+  cache_unlock();
+}
+
+static void install_handlers(void) {
+  if (SHMLOCK_HANDLERS) {
+    return;
+  }
+  SHMLOCK_HANDLERS = true;
+#ifdef HAVE_PTHREAD
+  if (pthread_atfork(cache_lock, cache_unlock, after_fork_in_child) != 0) {
+    LOG_DEBUG("Failed to register fork handlers");
+  }
+#endif /* HAVE_PTHREAD */
+  if (atexit(close_tables) != 0) {
+    LOG_DEBUG("Failed to register atexit() handler");
+  }
+}
+
+/**
+ * Get the lock table of a directory and take a reference to it. The directory
+ * is only looked at if its table is not mapped yet.
+ */
+static struct zeugl_shmlock_table *get_table(int dirfd, dev_t dev,
+                                             ino_t ino) {
+  cache_lock();
+  install_handlers();
+
+  struct zeugl_shmlock_table *table = SHMLOCK_CACHE;
+  while ((table != NULL) && ((table->dev != dev) || (table->ino != ino))) {
+    table = table->next;
+  }
+
+  if ((table != NULL) && (table->process != process()) &&
+      !claim_owner(table)) {
+    /* Unless it is being removed, opening the table again would give us a
+     * second file descriptor, and closing either one would release the locks
+     * we take through the other */
+    if (!__atomic_load_n(&table->shared->unlinked, __ATOMIC_SEQ_CST)) {
+      errno = ENOLCK;
+      cache_unlock();
+      return NULL;
+    }
+    uncache_table(table);
+    table = NULL;
+  }
+
+  if (table == NULL) {
+    struct stat sb;
+    if (fstat(dirfd, &sb) != 0) {
+      LOG_DEBUG("Failed to stat directory (fd = %d): %s", dirfd,
+                strerror(errno));
+    } else {
+      table = open_table(&sb);
+    }
+    if (table == NULL) {
+      int save_errno = errno;
+      cache_unlock();
+      errno = save_errno;
+      return NULL;
+    }
+    table->cached = true;
+    table->next = SHMLOCK_CACHE;
+    SHMLOCK_CACHE = table;
+  }
+
+  table->refs += 1;
+  table->last_use = ++SHMLOCK_CLOCK;
+  evict_tables();
+  cache_unlock();
+  return table;
+}
+
+/**
+ * Drop a reference taken with get_table().
+ */
+static void put_table(struct zeugl_shmlock_table *table) {
+  cache_lock();
+  table->refs -= 1;
+  if (!table->cached) {
+    if (table->refs == 0) {
+      close_table(table);
+    }
+  } else {
+    evict_tables();
+  }
+  cache_unlock();
+}
+
+static void futex_wait(uint32_t *addr, uint32_t value, uint64_t timeout_ns,
+                       unsigned int attempt) {
+#ifdef HAVE_LINUX_FUTEX_H
+  (void)attempt;
+  struct timespec ts = {
+      .tv_sec = (time_t)(timeout_ns / NSEC_PER_SEC),
+      .tv_nsec = (long)(timeout_ns % NSEC_PER_SEC),
+  };
+  /* Returns early if the value changed, or on wake ups and signals */
+  syscall(SYS_futex, addr, FUTEX_WAIT, value, &ts, NULL, 0);
+#else
+  (void)addr;
+  (void)value;
+  if (attempt <= SHMLOCK_SPINS) {
+    sched_yield();
+  } else {
+    zeugl_backoff(attempt - SHMLOCK_SPINS, zeugl_now() + timeout_ns);
+  }
+#endif /* HAVE_LINUX_FUTEX_H */
+}
+
+static void futex_wake_all(uint32_t *addr) {
+#ifdef HAVE_LINUX_FUTEX_H
+  syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+  (void)addr;
+#endif /* HAVE_LINUX_FUTEX_H */
+}
+
+/**
+ * Check whether the owner of a claim is still alive.
+ */
+static bool is_alive(const struct zeugl_shmlock_table *table, uint64_t claim) {
+  claim &= ~SHMLOCK_SETUP;
+  if (claim == table->owner) {
+    return true;
+  }
+
+  /* A slot that was taken again belongs to another process by now */
+  const uint64_t index = (claim >> 32) - 1;
+  if ((index >= SHMLOCK_OWNERS) ||
+      (__atomic_load_n(&table->shared->generations[index], __ATOMIC_SEQ_CST) !=
+       (uint32_t)claim)) {
+    return false;
+  }
+
+  struct flock fl = {
+      .l_type = F_WRLCK,
+      .l_whence = SEEK_SET,
+      .l_start = OWNER_OFFSET + (off_t)index,
+      .l_len = 1,
+  };
+  if (fcntl(table->fd, F_GETLK, &fl) != 0) {
+    LOG_DEBUG("Failed to test owner slot %lu of lock table (fd = %d): %s",
+              (unsigned long)index, table->fd, strerror(errno));
+    return true;
+  }
+  return fl.l_type != F_UNLCK;
+}
+
+/**
+ * Free a request whose claim is still the given one, waking up those waiting
+ * for it. Returns false if the request was freed or taken meanwhile.
+ */
+static bool free_request(struct shmlock_request *req, uint64_t claim) {
+  if (!__atomic_compare_exchange_n(&req->claim, &claim, 0, false,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    return false;
+  }
+  __atomic_add_fetch(&req->seq, 1, __ATOMIC_SEQ_CST);
+  /* Only wake waiters if there are any, so that an uncontended lock takes no
+   * system call */
+  if (__atomic_exchange_n(&req->waiters, 0, __ATOMIC_SEQ_CST)) {
+    futex_wake_all(&req->seq);
+  }
+  return true;
+}
+
+/**
+ * Take a free request, recording this process as its owner. Requests of dead
+ * owners are only freed if there is no free request.
+ */
+static int take_request(struct zeugl_shmlock_table *table) {
+  struct shmlock_shared *shared = table->shared;
+  for (int pass = 0; pass < 2; pass++) {
+    for (uint32_t i = 0; i < SHMLOCK_REQUESTS; i++) {
+      struct shmlock_request *req = &shared->requests[i];
+      uint64_t claim = __atomic_load_n(&req->claim, __ATOMIC_SEQ_CST);
+      if ((claim != 0) && ((pass == 0) || is_alive(table, claim) ||
+                           !free_request(req, claim))) {
+        continue;
+      }
+
+      claim = 0;
+      if (!__atomic_compare_exchange_n(&req->claim, &claim,
+                                       SHMLOCK_SETUP | table->owner, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        continue;
+      }
+
+      /* Make the request visible to those scanning the table, before we look
+       * at their tickets */
+      uint32_t num = __atomic_load_n(&shared->num_requests, __ATOMIC_SEQ_CST);
+      while ((num <= i) && !__atomic_compare_exchange_n(
+                               &shared->num_requests, &num, i + 1, false,
+                               __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      }
+      return (int)i;
+    }
+  }
+
+  LOG_DEBUG("All %d requests of lock table (fd = %d) are in use",
+            SHMLOCK_REQUESTS, table->fd);
+  errno = ENOLCK;
+  return -1;
+}
+
+enum request_state {
+  REQUEST_FREE,  /* Request is free */
+  REQUEST_SETUP, /* Request is being set up, its file is not known yet */
+  REQUEST_OTHER, /* Request is for another file */
+  REQUEST_SAME,  /* Request is for the same file */
+};
+
+/**
+ * Look at a request of another thread or process. The fields are read until
+ * they are consistent, like a sequence lock.
+ */
+static enum request_state inspect(struct shmlock_request *req, uint64_t hash,
+                                  const char *name, uint64_t *claim,
+                                  uint64_t *ticket) {
+  for (;;) {
+    const uint32_t seq = __atomic_load_n(&req->seq, __ATOMIC_ACQUIRE);
+    *claim = __atomic_load_n(&req->claim, __ATOMIC_ACQUIRE);
+    if (*claim == 0) {
+      return REQUEST_FREE;
+    }
+    if (*claim & SHMLOCK_SETUP) {
+      return REQUEST_SETUP;
+    }
+
+    const bool same =
+        (__atomic_load_n(&req->hash, __ATOMIC_RELAXED) == hash) &&
+        (strncmp(req->name, name, sizeof(req->name)) == 0);
+    *ticket = __atomic_load_n(&req->ticket, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if ((__atomic_load_n(&req->seq, __ATOMIC_RELAXED) == seq) &&
+        (__atomic_load_n(&req->claim, __ATOMIC_RELAXED) == *claim)) {
+      return same ? REQUEST_SAME : REQUEST_OTHER;
+    }
+  }
+}
+
+/**
+ * Wait for a request that is ahead of ours, or being set up, to change. Its
+ * owner is checked every SHMLOCK_CHECK_NSEC, and the request is freed if the
+ * owner died. Returns false with errno set if the deadline passed.
+ */
+static bool wait_request(const struct zeugl_shmlock_table *table,
+                         struct shmlock_request *req, uint64_t claim,
+                         uint32_t seq, int timeout, uint64_t deadline,
+                         unsigned int attempt) {
+  /* Setting up a request takes no time, unless its owner is preempted */
+  if ((claim & SHMLOCK_SETUP) && (attempt <= SHMLOCK_SPINS)) {
+    sched_yield();
+    return true;
+  }
+
+  uint64_t wait_ns = SHMLOCK_CHECK_NSEC;
+  if (timeout == 0) {
+    wait_ns = 0;
+  } else if (timeout != ZEUGL_LOCK_FOREVER) {
+    const uint64_t now = zeugl_now();
+    if (now >= deadline) {
+      LOG_DEBUG("Timed out waiting for shared-memory lock after %d ms",
+                timeout);
+      errno = ETIMEDOUT;
+      return false;
+    }
+    if (deadline - now < wait_ns) {
+      wait_ns = deadline - now;
+    }
+  }
+
+  if (wait_ns > 0) {
+    __atomic_store_n(&req->waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&req->claim, __ATOMIC_SEQ_CST) != claim) {
+      return true;
+    }
+    futex_wait(&req->seq, seq, wait_ns, attempt);
+    if ((__atomic_load_n(&req->seq, __ATOMIC_SEQ_CST) != seq) ||
+        (__atomic_load_n(&req->claim, __ATOMIC_SEQ_CST) != claim)) {
+      return true;
+    }
+  }
+
+  if (!is_alive(table, claim)) {
+    if (free_request(req, claim)) {
+      LOG_DEBUG("Freed lock request of dead owner (claim = %016llx)",
+                (unsigned long long)claim);
+    }
+    return true;
+  }
+  if (timeout == 0) {
+    errno = EWOULDBLOCK;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Wait until no request for the same file is ahead of ours.
+ */
+static bool wait_turn(const struct zeugl_shmlock_table *table, uint32_t index,
+                      int timeout) {
+  struct shmlock_shared *shared = table->shared;
+  const struct shmlock_request *own = &shared->requests[index];
+  const uint64_t deadline =
+      zeugl_now() + (uint64_t)(unsigned int)timeout * NSEC_PER_MSEC;
+
+  /* Requests taken after our ticket was drawn are behind us */
+  const uint32_t num = __atomic_load_n(&shared->num_requests, __ATOMIC_SEQ_CST);
+  for (uint32_t i = 0; i < num; i++) {
+    if (i == index) {
+      continue;
+    }
+
+    struct shmlock_request *req = &shared->requests[i];
+    for (unsigned int attempt = 1;; attempt++) {
+      const uint32_t seq = __atomic_load_n(&req->seq, __ATOMIC_SEQ_CST);
+      uint64_t claim, ticket = 0;
+      const enum request_state state =
+          inspect(req, own->hash, own->name, &claim, &ticket);
+      if ((state == REQUEST_FREE) || (state == REQUEST_OTHER) ||
+          ((state == REQUEST_SAME) &&
+           ((ticket > own->ticket) ||
+            ((ticket == own->ticket) && (i > index))))) {
+        break;
+      }
+      if (!wait_request(table, req, claim, seq, timeout, deadline, attempt)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static uint64_t name_hash(const char *name) {
+  /* FNV-1a */
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char *c = name; *c != '\0'; c++) {
+    hash ^= (unsigned char)*c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/**
+ * Draw a ticket greater than the tickets of all requests for the same file.
+ */
+static void draw_ticket(const struct zeugl_shmlock_table *table,
+                        uint32_t index) {
+  struct shmlock_shared *shared = table->shared;
+  struct shmlock_request *own = &shared->requests[index];
+
+  uint64_t max = 0;
+  const uint32_t num = __atomic_load_n(&shared->num_requests, __ATOMIC_SEQ_CST);
+  for (uint32_t i = 0; i < num; i++) {
+    uint64_t claim, ticket = 0;
+    if ((i != index) && (inspect(&shared->requests[i], own->hash, own->name,
+                                 &claim, &ticket) == REQUEST_SAME) &&
+        (ticket > max)) {
+      max = ticket;
+    }
+  }
+  __atomic_store_n(&own->ticket, max + 1, __ATOMIC_RELAXED);
+
+  /* Publish the request with its ticket */
+  __atomic_store_n(&own->claim, table->owner, __ATOMIC_SEQ_CST);
+}
+
+#endif /* HAVE_SHM_OPEN */
+
+bool zeugl_shmlock_acquire(int dirfd, dev_t dev, ino_t ino, const char *name,
+                           int timeout, struct zeugl_shmlock *lock,
+                           uint64_t *waited) {
+  lock->table = NULL;
+
+#ifdef HAVE_SHM_OPEN
+  const size_t name_len = strlen(name);
+  if (name_len > NAME_MAX) {
+    LOG_DEBUG("Filename '%s' is too long for a shared-memory lock", name);
+    errno = ENAMETOOLONG;
+    return false;
+  }
+
+  const uint64_t start = zeugl_now();
+  struct zeugl_shmlock_table *table = get_table(dirfd, dev, ino);
+  if (table == NULL) {
+    return false;
+  }
+
+  const int index = take_request(table);
+  if (index < 0) {
+    int save_errno = errno;
+    put_table(table);
+    errno = save_errno;
+    return false;
+  }
+
+  struct shmlock_request *req = &table->shared->requests[index];
+  __atomic_store_n(&req->hash, name_hash(name), __ATOMIC_RELAXED);
+  memcpy(req->name, name, name_len + 1);
+  draw_ticket(table, (uint32_t)index);
+  const bool success = wait_turn(table, (uint32_t)index, timeout);
+
+  const uint64_t elapsed = zeugl_now() - start;
+  *waited += elapsed;
+  if (!success) {
+    int save_errno = errno;
+    free_request(req, table->owner);
+    put_table(table);
+    errno = save_errno;
+    return false;
+  }
+
+  lock->table = table;
+  lock->request = (uint32_t)index;
+  lock->claim = table->owner;
+  lock->process = table->process;
+  LOG_DEBUG("Acquired shared-memory lock on file '%s' with request %d and "
+            "ticket %llu after %llu us",
+            name, index, (unsigned long long)req->ticket,
+            (unsigned long long)(elapsed / 1000));
+#else
+  (void)dirfd;
+  (void)dev;
+  (void)ino;
+  (void)timeout;
+  (void)waited;
+  LOG_DEBUG("Shared-memory locks are not supported: Not locking file '%s'",
+            name);
+#endif /* HAVE_SHM_OPEN */
+
+  return true;
+}
+
+void zeugl_shmlock_release(struct zeugl_shmlock *lock) {
+#ifdef HAVE_SHM_OPEN
+  if (lock->table == NULL) {
+    return;
+  }
+
+  /* A forked child must not release the locks of its parent */
+  struct shmlock_request *req = &lock->table->shared->requests[lock->request];
+  if (lock->process != process()) {
+    LOG_DEBUG("Shared-memory lock with request %lu belongs to the parent "
+              "process",
+              (unsigned long)lock->request);
+  } else if (!free_request(req, lock->claim)) {
+    LOG_DEBUG("Shared-memory lock with request %lu was taken from us",
+              (unsigned long)lock->request);
+  } else {
+    LOG_DEBUG("Released shared-memory lock with request %lu",
+              (unsigned long)lock->request);
+  }
+
+  put_table(lock->table);
+  lock->table = NULL;
+#else
+  (void)lock;
+#endif /* HAVE_SHM_OPEN */
+}
@@ -0,0 +1,50 @@
+#ifndef __ZEUGL_SHMLOCK_H__
+#define __ZEUGL_SHMLOCK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct zeugl_shmlock_table;
+
+/**
+ * A lock taken in a shared-memory lock table.
+ */
+struct zeugl_shmlock {
+  struct zeugl_shmlock_table *table; /* NULL if no lock is held */
+  uint32_t request;                  /* Index of the request in the table */
+  uint64_t claim;                    /* Owner recorded in the request */
+  unsigned long process;             /* Process that took the lock */
+};
+
+/**
+ * @brief Lock a file through the shared-memory lock table of its directory,
+ * waiting at most timeout milliseconds for it.
+ * @param dirfd File descriptor of the directory containing the file.
+ * @param dev Device of the directory, which selects its lock table.
+ * @param ino Inode of the directory.
+ * @param name Name of the file relative to dirfd.
+ * @param timeout Maximum number of milliseconds to wait, zero to not wait at
+ * all, or ZEUGL_LOCK_FOREVER.
+ * @param lock Set to the lock taken, to be passed to zeugl_shmlock_release().
+ * @param waited Incremented by the number of nanoseconds spent waiting.
+ * @return true on success. On error false is returned and errno is set, to
+ * EWOULDBLOCK if the timeout is zero and the file is locked, or to ETIMEDOUT
+ * if the timeout expired.
+ * @note Locks are keyed by the name of the file, so they outlive the renames
+ * that replace it, and granted in the order they were requested. Once the
+ * table of the directory is mapped, acquiring and releasing a lock nobody
+ * waits for takes no system call. If a holder dies,
+ * the lock is passed on once the kernel has released its record locks.
+ */
+bool zeugl_shmlock_acquire(int dirfd, dev_t dev, ino_t ino, const char *name,
+                           int timeout, struct zeugl_shmlock *lock,
+                           uint64_t *waited);
+
+/**
+ * @brief Release a lock taken with zeugl_shmlock_acquire().
+ * @param lock The lock. Nothing is done if no lock is held.
+ */
+void zeugl_shmlock_release(struct zeugl_shmlock *lock);
+
+#endif /* __ZEUGL_SHMLOCK_H__ */
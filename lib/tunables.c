@@ -0,0 +1,90 @@
+#include "config.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "tunables.h"
+
+/* Largest accepted copy buffer (1 GiB) */
+#define MAX_BUFFER_SIZE (1UL << 30)
+
+/* Largest accepted number of threads for a parallel copy */
+#define MAX_COPY_THREADS 64UL
+
+/* Smallest and largest accepted chunk size for a parallel copy */
+#define MIN_COPY_CHUNK_SIZE (1UL << 12)
+#define MAX_COPY_CHUNK_SIZE (1UL << 30)
+
+/* Longest accepted group commit window (1 second) */
+#define MAX_GROUP_COMMIT_WINDOW 1000000UL
+
+unsigned long zeugl_tunable(const char *name, unsigned long def,
+                            unsigned long min, unsigned long max) {
+  const char *value = getenv(name);
+  if (value == NULL) {
+    return def;
+  }
+
+  char *endptr = NULL;
+  errno = 0;
+  unsigned long ret = strtoul(value, &endptr, 10);
+  if ((errno != 0) || (*value == '\0') || (*endptr != '\0') || (ret < min) ||
+      (ret > max)) {
+    LOG_DEBUG("Ignoring bad value '%s' for tunable %s: Expected a number "
+              "between %lu and %lu",
+              value, name, min, max);
+    return def;
+  }
+
+  LOG_DEBUG("Using value %lu for tunable %s", ret, name);
+  return ret;
+}
+
+bool zeugl_tunable_has(const char *name, const char *word) {
+  const char *value = getenv(name);
+  if (value == NULL) {
+    return false;
+  }
+
+  const size_t len = strlen(word);
+  const char *start = value;
+  while (true) {
+    const char *end = strchr(start, ',');
+    if (end == NULL) {
+      end = start + strlen(start);
+    }
+
+    if (((size_t)(end - start) == len) && (strncmp(start, word, len) == 0)) {
+      LOG_DEBUG("Found '%s' in tunable %s", word, name);
+      return true;
+    }
+
+    if (*end == '\0') {
+      return false;
+    }
+    start = end + 1;
+  }
+}
+
+size_t zeugl_buffer_size(void) {
+  return (size_t)zeugl_tunable(ZEUGL_ENV_BUFFER_SIZE, BUFFER_SIZE, 1,
+                               MAX_BUFFER_SIZE);
+}
+
+size_t zeugl_copy_threads(void) {
+  return (size_t)zeugl_tunable(ZEUGL_ENV_COPY_THREADS, COPY_THREADS, 1,
+                               MAX_COPY_THREADS);
+}
+
+size_t zeugl_copy_chunk_size(void) {
+  return (size_t)zeugl_tunable(ZEUGL_ENV_COPY_CHUNK_SIZE, COPY_CHUNK_SIZE,
+                               MIN_COPY_CHUNK_SIZE, MAX_COPY_CHUNK_SIZE);
+}
+
+unsigned long zeugl_group_commit_window(void) {
+  return zeugl_tunable(ZEUGL_ENV_GROUP_COMMIT_WINDOW, GROUP_COMMIT_WINDOW, 0,
+                       MAX_GROUP_COMMIT_WINDOW);
+}
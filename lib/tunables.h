@@ -0,0 +1,76 @@
+#ifndef __ZEUGL_TUNABLES_H__
+#define __ZEUGL_TUNABLES_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Environment variable to override the size of the copy buffer in bytes */
+#define ZEUGL_ENV_BUFFER_SIZE "ZEUGL_BUFFER_SIZE"
+
+/* Environment variable to select copy policies for all calls to zopen(). It
+ * takes a comma separated list of policies (i.e., "nocache", "direct",
+ * "parallel" and "uring"). */
+#define ZEUGL_ENV_COPY_POLICY "ZEUGL_COPY_POLICY"
+
+/* Environment variable to override the number of threads of a parallel copy */
+#define ZEUGL_ENV_COPY_THREADS "ZEUGL_COPY_THREADS"
+
+/* Environment variable to override the chunk size of a parallel copy */
+#define ZEUGL_ENV_COPY_CHUNK_SIZE "ZEUGL_COPY_CHUNK_SIZE"
+
+/* Environment variable to override how many microseconds a group commit waits
+ * for more commits to join */
+#define ZEUGL_ENV_GROUP_COMMIT_WINDOW "ZEUGL_GROUP_COMMIT_WINDOW"
+
+/* Environment variable to select the kind of temporary files. It takes the
+ * value "named" to use named temporary files where anonymous temporary files
+ * would be used. */
+#define ZEUGL_ENV_TEMP_FILE "ZEUGL_TEMP_FILE"
+
+/**
+ * @brief Get a numeric tunable from the environment.
+ * @param name Name of the environment variable.
+ * @param def Value to use if the variable is unset or invalid.
+ * @param min Smallest accepted value.
+ * @param max Largest accepted value.
+ * @return The value of the tunable.
+ */
+unsigned long zeugl_tunable(const char *name, unsigned long def,
+                            unsigned long min, unsigned long max);
+
+/**
+ * @brief Check whether a word is listed in a comma separated tunable from the
+ * environment.
+ * @param name Name of the environment variable.
+ * @param word Word to look for.
+ * @return true if the word is listed, false otherwise.
+ */
+bool zeugl_tunable_has(const char *name, const char *word);
+
+/**
+ * @brief Get the size of the buffer used for copying files.
+ * @return BUFFER_SIZE, unless overridden by ZEUGL_BUFFER_SIZE.
+ */
+size_t zeugl_buffer_size(void);
+
+/**
+ * @brief Get the number of threads used for a parallel copy, including the
+ * calling thread.
+ * @return COPY_THREADS, unless overridden by ZEUGL_COPY_THREADS.
+ */
+size_t zeugl_copy_threads(void);
+
+/**
+ * @brief Get the size of the chunks a parallel copy is split into.
+ * @return COPY_CHUNK_SIZE, unless overridden by ZEUGL_COPY_CHUNK_SIZE.
+ */
+size_t zeugl_copy_chunk_size(void);
+
+/**
+ * @brief Get how long a group commit waits for more commits to join.
+ * @return GROUP_COMMIT_WINDOW in microseconds, unless overridden by
+ * ZEUGL_GROUP_COMMIT_WINDOW.
+ */
+unsigned long zeugl_group_commit_window(void);
+
+#endif /* __ZEUGL_TUNABLES_H__ */
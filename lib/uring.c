@@ -0,0 +1,423 @@
+#include "config.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif /* HAVE_LINUX_IO_URING_H */
+
+#include "filecopy.h"
+#include "logger.h"
+#include "tunables.h"
+#include "uring.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) &&        \
+    defined(__NR_io_uring_enter)
+
+/* Number of chunks in flight. Each chunk takes a read and a write request. */
+#define URING_QUEUE_DEPTH 16
+
+/* Alignment of the chunk buffers */
+#define URING_BUFFER_ALIGNMENT ((size_t)4096)
+
+/* Tells the two requests of a chunk apart in the user data */
+#define URING_WRITE_BIT 1ULL
+
+/**
+ * The submission and completion queues shared with the kernel.
+ */
+struct ring {
+  int fd;
+  void *sq_ptr;
+  size_t sq_len;
+  void *cq_ptr;
+  size_t cq_len;
+  struct io_uring_sqe *sqes;
+  size_t sqes_len;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+/**
+ * A chunk of the file that is being copied.
+ */
+struct chunk {
+  struct iovec read_iov;  /* Must stay valid until the read is done */
+  struct iovec write_iov; /* Must stay valid until the write is done */
+  off_t offset;           /* Offset relative to the start of the copy */
+  size_t len;
+  ssize_t read_res;
+  ssize_t write_res;
+  unsigned int pending; /* Number of requests not completed yet */
+};
+
+static void ring_destroy(struct ring *ring) {
+  if ((ring->sqes != NULL) && (ring->sqes != MAP_FAILED)) {
+    munmap(ring->sqes, ring->sqes_len);
+  }
+  if ((ring->cq_ptr != NULL) && (ring->cq_ptr != MAP_FAILED) &&
+      (ring->cq_ptr != ring->sq_ptr)) {
+    munmap(ring->cq_ptr, ring->cq_len);
+  }
+  if ((ring->sq_ptr != NULL) && (ring->sq_ptr != MAP_FAILED)) {
+    munmap(ring->sq_ptr, ring->sq_len);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+}
+
+static bool ring_setup(struct ring *ring, unsigned int entries) {
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) {
+    LOG_DEBUG("Failed to set up io_uring: %s", strerror(errno));
+    return false;
+  }
+
+  ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_len =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+  single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#endif /* IORING_FEAT_SINGLE_MMAP */
+  if (single_mmap) {
+    /* Both queues are mapped in one go */
+    if (ring->cq_len > ring->sq_len) {
+      ring->sq_len = ring->cq_len;
+    }
+    ring->cq_len = ring->sq_len;
+  }
+
+  ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED) {
+    LOG_DEBUG("Failed to map io_uring submission queue: %s", strerror(errno));
+    goto FAIL;
+  }
+
+  if (single_mmap) {
+    ring->cq_ptr = ring->sq_ptr;
+  } else {
+    ring->cq_ptr =
+        mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED) {
+      LOG_DEBUG("Failed to map io_uring completion queue: %s",
+                strerror(errno));
+      goto FAIL;
+    }
+  }
+
+  ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    LOG_DEBUG("Failed to map io_uring submission queue entries: %s",
+              strerror(errno));
+    goto FAIL;
+  }
+
+  char *sq = ring->sq_ptr;
+  ring->sq_head = (unsigned *)(void *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(void *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(void *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(void *)(sq + params.sq_off.array);
+
+  char *cq = ring->cq_ptr;
+  ring->cq_head = (unsigned *)(void *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(void *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(void *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(void *)(cq + params.cq_off.cqes);
+
+  LOG_DEBUG("Set up io_uring (fd = %d) with %u entries", ring->fd,
+            params.sq_entries);
+  return true;
+
+FAIL:;
+  int save_errno = errno;
+  ring_destroy(ring);
+  errno = save_errno;
+  return false;
+}
+
+static void ring_push(struct ring *ring, uint8_t opcode, int fd,
+                      struct iovec *iov, off_t offset, uint8_t flags,
+                      uint64_t user_data) {
+  /* Only this thread produces submissions, so the tail is ours to read */
+  const unsigned tail = *ring->sq_tail;
+  const unsigned index = tail & *ring->sq_mask;
+
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->flags = flags;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)iov;
+  sqe->len = 1;
+  sqe->off = (uint64_t)offset;
+  sqe->user_data = user_data;
+  ring->sq_array[index] = index;
+
+  /* Publish the entry before the kernel can see the new tail */
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static bool ring_enter(struct ring *ring) {
+  /* Submit whatever the kernel has not consumed yet, and wait for at least one
+   * completion */
+  const unsigned to_submit = *ring->sq_tail -
+                             __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+              IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+    if (errno == EINTR) {
+      /* Interrupted! It happens, the caller just enters again... */
+      return true;
+    }
+
+    LOG_DEBUG("Failed to enter io_uring (fd = %d): %s", ring->fd,
+              strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Queue the next chunk as a read linked to a write, so that the write is only
+ * started once the read is done.
+ */
+static void chunk_submit(struct ring *ring, struct chunk *chunk, size_t index,
+                         int src, off_t src_start, int dst, off_t dst_start) {
+  chunk->read_iov.iov_len = chunk->len;
+  chunk->write_iov.iov_base = chunk->read_iov.iov_base;
+  chunk->write_iov.iov_len = chunk->len;
+  chunk->read_res = 0;
+  chunk->write_res = 0;
+  chunk->pending = 2;
+
+  const uint64_t user_data = (uint64_t)index << 1;
+  ring_push(ring, IORING_OP_READV, src, &chunk->read_iov,
+            src_start + chunk->offset, IOSQE_IO_LINK, user_data);
+  ring_push(ring, IORING_OP_WRITEV, dst, &chunk->write_iov,
+            dst_start + chunk->offset, 0, user_data | URING_WRITE_BIT);
+}
+
+/**
+ * Check the outcome of a chunk whose requests are done. A short read breaks
+ * the link, so the write is cancelled and the data read is written here.
+ * Likewise for the rest of a short write.
+ */
+static bool chunk_complete(const struct chunk *chunk, int dst, off_t dst_start,
+                           bool *eof, size_t *n_copied) {
+  if (chunk->read_res < 0) {
+    errno = (int)-chunk->read_res;
+    LOG_DEBUG("Failed to read from source file: %s", strerror(errno));
+    return false;
+  }
+
+  size_t n_read = (size_t)chunk->read_res;
+  size_t n_written = 0;
+  if (n_read < chunk->len) {
+    /* The source file has shrunk */
+    *eof = true;
+  } else if (chunk->write_res < 0) {
+    errno = (int)-chunk->write_res;
+    LOG_DEBUG("Failed to write content to destination file (fd = %d): %s", dst,
+              strerror(errno));
+    return false;
+  } else {
+    n_written = (size_t)chunk->write_res;
+  }
+
+  while (n_written < n_read) {
+    ssize_t ret = pwrite(dst, (char *)chunk->write_iov.iov_base + n_written,
+                         n_read - n_written,
+                         dst_start + chunk->offset + (off_t)n_written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        /* Interrupted! It happens, just continue... */
+        continue;
+      }
+
+      LOG_DEBUG("Failed to write content to destination file (fd = %d): %s",
+                dst, strerror(errno));
+      return false;
+    }
+    n_written += (size_t)ret;
+  }
+
+  *n_copied = n_read;
+  return true;
+}
+
+enum copy_result zeugl_uring_copy(int src, int dst) {
+  struct stat sb;
+  if (fstat(src, &sb) != 0) {
+    LOG_DEBUG("Failed to retrieve size of source file (fd = %d): %s", src,
+              strerror(errno));
+    return COPY_FAILURE;
+  }
+
+  const off_t src_start = lseek(src, 0, SEEK_CUR);
+  const off_t dst_start = lseek(dst, 0, SEEK_CUR);
+  if ((src_start < 0) || (dst_start < 0)) {
+    LOG_DEBUG("Failed to get file offsets (src = %d, dst = %d): %s", src, dst,
+              strerror(errno));
+    return COPY_FAILURE;
+  }
+
+  const off_t size = (sb.st_size > src_start) ? sb.st_size - src_start : 0;
+  if (size == 0) {
+    return COPY_SUCCESS;
+  }
+
+  struct ring ring;
+  if (!ring_setup(&ring, 2 * URING_QUEUE_DEPTH)) {
+    return COPY_UNSUPPORTED;
+  }
+
+  const size_t chunk_size =
+      (zeugl_buffer_size() + URING_BUFFER_ALIGNMENT - 1) &
+      ~(URING_BUFFER_ALIGNMENT - 1);
+  void *buffer = NULL;
+  int ret = posix_memalign(&buffer, URING_BUFFER_ALIGNMENT,
+                           chunk_size * URING_QUEUE_DEPTH);
+  if (ret != 0) {
+    LOG_DEBUG("Failed to allocate memory: %s", strerror(ret));
+    ring_destroy(&ring);
+    errno = ret;
+    return COPY_FAILURE;
+  }
+
+  struct chunk chunks[URING_QUEUE_DEPTH];
+  size_t free_chunks[URING_QUEUE_DEPTH];
+  size_t n_free = URING_QUEUE_DEPTH;
+  for (size_t i = 0; i < URING_QUEUE_DEPTH; i++) {
+    chunks[i].read_iov.iov_base = (char *)buffer + (i * chunk_size);
+    free_chunks[i] = URING_QUEUE_DEPTH - 1 - i;
+  }
+
+  enum copy_result result = COPY_SUCCESS;
+  int save_errno = 0;
+  bool eof = false;
+  off_t next = 0; /* Offset of the next chunk, relative to the start */
+  off_t end = 0;  /* End of the copied content, relative to the start */
+
+  while (true) {
+    /* Keep the queue full until everything is queued, or we must stop */
+    while ((n_free > 0) && (next < size) && !eof &&
+           (result == COPY_SUCCESS)) {
+      size_t index = free_chunks[--n_free];
+      struct chunk *chunk = &chunks[index];
+      chunk->offset = next;
+      chunk->len = ((size - next) < (off_t)chunk_size) ? (size_t)(size - next)
+                                                       : chunk_size;
+      chunk_submit(&ring, chunk, index, src, src_start, dst, dst_start);
+      next += (off_t)chunk->len;
+    }
+
+    if (n_free == URING_QUEUE_DEPTH) {
+      /* Nothing in flight */
+      break;
+    }
+
+    if (!ring_enter(&ring)) {
+      /* Requests already submitted may still be in flight, so the buffer
+       * must not be freed. Leave it to the exit of the process. */
+      result = COPY_FAILURE;
+      save_errno = errno;
+      buffer = NULL;
+      break;
+    }
+
+    unsigned head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+      const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+      const size_t index = (size_t)(cqe->user_data >> 1);
+      struct chunk *chunk = &chunks[index];
+      if (cqe->user_data & URING_WRITE_BIT) {
+        chunk->write_res = cqe->res;
+      } else {
+        chunk->read_res = cqe->res;
+      }
+      head += 1;
+
+      chunk->pending -= 1;
+      if (chunk->pending > 0) {
+        continue;
+      }
+
+      size_t n_copied = 0;
+      if (result == COPY_SUCCESS) {
+        if (chunk_complete(chunk, dst, dst_start, &eof, &n_copied)) {
+          if (chunk->offset + (off_t)n_copied > end) {
+            end = chunk->offset + (off_t)n_copied;
+          }
+        } else {
+          /* Let the requests in flight finish before bailing out */
+          result = COPY_FAILURE;
+          save_errno = errno;
+        }
+      }
+      free_chunks[n_free++] = index;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  free(buffer);
+  ring_destroy(&ring);
+
+  if (result != COPY_SUCCESS) {
+    LOG_DEBUG("Failed to copy from source file (fd = %d) to destination file "
+              "(fd = %d) with io_uring: %s",
+              src, dst, strerror(save_errno));
+    errno = save_errno;
+    return result;
+  }
+
+  /* Leave the file offsets where a read/write loop would have left them */
+  if ((lseek(src, src_start + end, SEEK_SET) < 0) ||
+      (lseek(dst, dst_start + end, SEEK_SET) < 0)) {
+    LOG_DEBUG("Failed to reposition file offsets (src = %d, dst = %d): %s",
+              src, dst, strerror(errno));
+    return COPY_FAILURE;
+  }
+
+  LOG_DEBUG("Copied %jd bytes from source file (fd = %d) to destination file "
+            "(fd = %d) with io_uring",
+            (intmax_t)end, src, dst);
+  return COPY_SUCCESS;
+}
+
+#else /* HAVE_LINUX_IO_URING_H && __NR_io_uring_setup && __NR_io_uring_enter \
+       */
+
+enum copy_result zeugl_uring_copy(int src, int dst) {
+  LOG_DEBUG("io_uring is not supported on this platform (src = %d, dst = %d)",
+            src, dst);
+  return COPY_UNSUPPORTED;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H && __NR_io_uring_setup &&                     \
+          __NR_io_uring_enter */
@@ -0,0 +1,19 @@
+#ifndef __ZEUGL_URING_H__
+#define __ZEUGL_URING_H__
+
+#include "filecopy.h"
+
+/**
+ * @brief Copy a regular file with io_uring.
+ * @param src Source file descriptor of a regular file.
+ * @param dst Destination file descriptor.
+ * @return COPY_SUCCESS if src was copied from its current offset up to the
+ * size it had when the copy started, COPY_UNSUPPORTED if io_uring is not
+ * available (nothing was copied), or COPY_FAILURE with errno set.
+ * @note Each chunk is read and written by a linked pair of requests, and up
+ * to URING_QUEUE_DEPTH chunks are in flight at once. The file offsets of both
+ * files are moved past the copied content, like the other copy methods do.
+ */
+enum copy_result zeugl_uring_copy(int src, int dst);
+
+#endif /* __ZEUGL_URING_H__ */
@@ -1,125 +1,234 @@
 #include "config.h"
 
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <libgen.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "immutable.h"
+#include "lock.h"
 #include "logger.h"
+#include "sequence.h"
 #include "whackamole.h"
-
-static char *create_a_mole(const char *temp) {
-  char *mole = malloc(strlen(temp) + strlen(".mole") + 1);
-  if (mole == NULL) {
-    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
-    return NULL;
+#include "zeugl.h"
+
+/**
+ * Rename the temporary file to the rendezvous name of the original file. If
+ * the mole of a concurrent commit is already there, it gets whacked by the
+ * rename. Whichever mole sits at the rendezvous name when the original file is
+ * replaced is the one that survives.
+ */
+static bool create_a_mole(int dirfd, const char *temp, const char *mole) {
+  if (renameat(dirfd, temp, dirfd, mole) != 0) {
+    LOG_DEBUG("Failed to rename '%s' to '%s': %s", temp, mole, strerror(errno));
+    return false;
   }
+  LOG_DEBUG("Renamed '%s' to '%s'", temp, mole);
 
-  /* Create mole filename */
-  stpcpy(stpcpy(mole, temp), ".mole");
+  return true;
+}
 
-  if (rename(temp, mole) != 0) {
-    LOG_DEBUG("Failed to rename '%s' to '%s': %s", temp, mole, strerror(errno));
-    free(mole);
-    return NULL;
+static bool replace_original(int dirfd, const char *orig, const char *survivor,
+                             bool is_mole) {
+  if (renameat(dirfd, survivor, dirfd, orig) == 0) {
+    LOG_DEBUG(
+        "Replaced the last survivor (mole '%s') with the original file '%s'",
+        survivor, orig);
+    return true;
   }
-  LOG_DEBUG("Renamed '%s' to '%s'", temp, mole);
 
-  return mole;
+  LOG_DEBUG("Failed to replace last survivor (mole '%s') with the original "
+            "file '%s': %s",
+            survivor, orig, strerror(errno));
+
+  /* We don't really care if it fails due to missing file. It just means that
+   * another agent adopted the mole and beat us to it. A temporary file that is
+   * not a mole belongs to nobody else, though. */
+  return is_mole && (errno == ENOENT);
 }
 
-static bool is_a_mole(const char *orig, const char *mole) {
-  const size_t orig_len = strlen(orig);                  /* Original filename */
-  const size_t mole_len = strlen(mole);                  /* Potential mole */
-  const size_t uid_len = strlen(".XXXXXX");              /* Unique identifier */
-  const size_t suf_len = strlen(".mole");                /* Mole suffix */
-  const size_t exp_len = (orig_len + uid_len + suf_len); /* Expected length */
+/**
+ * Swap the temporary file of a compare-and-swap commit in for the original
+ * file it compared. Other commits take no lock, so one may have replaced the
+ * original file since. Exchanging the two files tells which file was
+ * displaced, and if it was not the one compared, it is swapped back, along
+ * with the file of any commit landing while we do.
+ */
+static bool swap_original(int dirfd, const char *orig, const char *temp,
+                          const struct stat *expected) {
+#ifdef RENAME_EXCHANGE
+  dev_t dev = expected->st_dev;
+  ino_t ino = expected->st_ino;
+  bool swapped_back = false;
+  for (;;) {
+    struct stat put, displaced;
+    if (fstatat(dirfd, temp, &put, AT_SYMLINK_NOFOLLOW) != 0) {
+      LOG_DEBUG("Failed to stat '%s': %s", temp, strerror(errno));
+      return false;
+    }
+
+    if (renameat2(dirfd, temp, dirfd, orig, RENAME_EXCHANGE) != 0) {
+      LOG_DEBUG("Failed to exchange '%s' with '%s': %s", temp, orig,
+                strerror(errno));
+      if (swapped_back || ((errno != EINVAL) && (errno != ENOSYS))) {
+        return false;
+      }
+      /* The filesystem cannot exchange files, so a commit that lands right
+       * before the rename goes unnoticed */
+      return replace_original(dirfd, orig, temp, false);
+    }
+    LOG_DEBUG("Exchanged '%s' with '%s'", temp, orig);
+
+    if (fstatat(dirfd, temp, &displaced, AT_SYMLINK_NOFOLLOW) != 0) {
+      LOG_DEBUG("Failed to stat '%s': %s", temp, strerror(errno));
+      return false;
+    }
+    if ((displaced.st_dev == dev) && (displaced.st_ino == ino)) {
+      break;
+    }
 
-  if (mole_len != exp_len) {
-    /* Potential mole filename has wrong length */
-    return false;
+    /* What we put in place is older than what it displaced */
+    LOG_DEBUG("Original file '%s' was replaced by another commit: Putting it "
+              "back",
+              orig);
+    dev = put.st_dev;
+    ino = put.st_ino;
+    swapped_back = true;
   }
 
-  if (strncmp(mole, orig, orig_len) != 0) {
-    /* Potential mole filename doesn't start with the original filename */
+  if (unlinkat(dirfd, temp, 0) != 0) {
+    LOG_DEBUG("Failed to delete displaced file '%s': %s", temp,
+              strerror(errno));
     return false;
   }
+  LOG_DEBUG("Deleted displaced file '%s'", temp);
 
-  if (strcmp(mole + orig_len + uid_len, ".mole") != 0) {
-    /* Potential mole filename is missing the mole suffix */
+  if (swapped_back) {
+    errno = ESTALE;
     return false;
   }
-
   return true;
+#else  /* RENAME_EXCHANGE */
+  (void)expected;
+  return replace_original(dirfd, orig, temp, false);
+#endif /* RENAME_EXCHANGE */
 }
 
-static bool replace_original(const char *orig, const char *survivor) {
-  if (rename(survivor, orig) == 0) {
-    LOG_DEBUG(
-        "Replaced the last survivor (mole '%s') with the original file '%s'",
-        survivor, orig);
-    return true;
-  }
+/**
+ * Replace the original file with the survivor, or swap it in if the original
+ * file must still be the expected one (see swap_original()).
+ */
+static bool put_in_place(int dirfd, const char *orig, const char *survivor,
+                         bool is_mole, const struct stat *expected) {
+  return (expected != NULL) ? swap_original(dirfd, orig, survivor, expected)
+                            : replace_original(dirfd, orig, survivor, is_mole);
+}
 
-  LOG_DEBUG("Failed to replace last survivor (mole '%s') with the original "
-            "file '%s': %s",
-            survivor, orig, strerror(errno));
+static bool restore_immutable(int dirfd, const char *orig) {
+  /* The original file is a new file now, so it must be opened again */
+  int fd = openat(dirfd, orig, O_RDONLY);
+  if (fd < 0) {
+    LOG_DEBUG("Failed to open original file '%s': %s", orig, strerror(errno));
+    return false;
+  }
 
-  /* We don't really care if it fails due to missing file. It just means that
-   * another agent adopted the mole and beat us to it. */
-  return (errno == ENOENT);
+  bool success = zeugl_set_immutable(fd);
+  int save_errno = errno;
+  close(fd);
+  errno = save_errno;
+  return success;
 }
 
-static bool replace_immutable_original(const char *orig, const char *survivor,
+/**
+ * Replace the original file, clearing its immutable attribute first and
+ * restoring it on the file that takes its place. The incoming file is locked
+ * until then, so that the next commit, which locks whatever is at orig, waits
+ * for the attribute to be restored.
+ */
+static bool replace_immutable_original(int dirfd, int orig_fd,
+                                       const char *orig, const char *survivor,
+                                       bool is_mole, const struct stat *expected,
                                        bool handle_immutable) {
-  bool was_immutable = handle_immutable ? zeugl_is_immutable(orig) : false;
+  bool was_immutable = handle_immutable ? zeugl_is_immutable(orig_fd) : false;
   if (!was_immutable) {
-    return replace_original(orig, survivor);
+    return put_in_place(dirfd, orig, survivor, is_mole, expected);
   }
 
-  if (zeugl_clear_immutable(orig)) {
+  const int survivor_fd = openat(dirfd, survivor, O_RDONLY);
+  if (survivor_fd < 0) {
+    LOG_DEBUG("Failed to open '%s' for locking: %s", survivor, strerror(errno));
+    return false;
+  }
+
+  bool success = false;
+  if (flock(survivor_fd, LOCK_EX) != 0) {
+    LOG_DEBUG("Failed to acquire exclusive lock on '%s' (fd = %d): %s",
+              survivor, survivor_fd, strerror(errno));
+    goto FAIL;
+  }
+  LOG_DEBUG("Acquired exclusive lock on '%s' (fd = %d)", survivor,
+            survivor_fd);
+
+  if (zeugl_clear_immutable(orig_fd)) {
     LOG_DEBUG("Temporarily cleared immutable attribute from '%s'", orig);
   } else {
     LOG_DEBUG("Failed to temporarily clear immutable attribute from '%s'",
               orig);
-    return false;
+    goto FAIL;
   }
 
-  if (!replace_original(orig, survivor)) {
+  if (!put_in_place(dirfd, orig, survivor, is_mole, expected)) {
     /* Error is already logged */
-    return false;
+    goto FAIL;
   }
 
   /* Restore immutable bit before releasing lock */
-  if (!zeugl_set_immutable(orig)) {
+  if (!restore_immutable(dirfd, orig)) {
     LOG_DEBUG("Failed to restore the immutable bit on '%s'", orig);
-    return false;
+    goto FAIL;
   }
   LOG_DEBUG("Restored immutable bit on '%s'", orig);
 
-  return true;
+  success = true;
+FAIL:;
+  /* Closing the file releases its lock */
+  int save_errno = errno;
+  close(survivor_fd);
+  errno = save_errno;
+  return success;
 }
 
-static bool atomic_replace_immutable_original(const char *orig,
+static bool atomic_replace_immutable_original(int dirfd, const char *orig,
                                               const char *survivor,
+                                              bool is_mole,
                                               bool handle_immutable,
-                                              bool no_block) {
+                                              int timeout,
+                                              struct zstats *stats) {
   bool success = false;
 
+  /* The rename is atomic on its own. The lock only keeps concurrent commits
+   * from clearing and restoring the immutable attribute at the same time, so
+   * it is not taken unless the attribute may need clearing. This also keeps
+   * commits from waiting for readers that hold the shared lock. */
+  if (!handle_immutable) {
+    return replace_original(dirfd, orig, survivor, is_mole);
+  }
+
   /* Open original file for locking before clearing immutable flag */
-  int lock_fd = open(orig, O_RDONLY);
+  int lock_fd = openat(dirfd, orig, O_RDONLY);
   if (lock_fd < 0) {
     if (errno == ENOENT) {
       /* Original file doesn't exist yet - this is fine for new files */
       LOG_DEBUG("Original file '%s' does not exist yet", orig);
-      return replace_original(orig, survivor);
+      return replace_original(dirfd, orig, survivor, is_mole);
     } else {
       LOG_DEBUG("Failed to open original file '%s' for locking: %s", orig,
                 strerror(errno));
@@ -129,19 +238,21 @@ static bool atomic_replace_immutable_original(const char *orig,
   LOG_DEBUG("Opened original file '%s' (fd = %d) for locking", orig, lock_fd);
 
   /* Acquire exclusive lock */
-  int lock = LOCK_EX;
-  if (no_block) {
-    lock |= LOCK_NB;
-  }
-  if (flock(lock_fd, lock) != 0) {
+  uint64_t waited = 0;
+  const bool locked = zeugl_lock(lock_fd, LOCK_EX, timeout, &waited);
+  stats->commit_lock_wait_ns += waited;
+  if (!locked) {
     LOG_DEBUG("Failed to acquire exclusive lock on '%s' (fd = %d): %s", orig,
               lock_fd, strerror(errno));
+    int save_errno = errno;
     close(lock_fd);
-    goto FAIL;
+    errno = save_errno;
+    return false;
   }
   LOG_DEBUG("Acquired exclusive lock on '%s' (fd = %d)", orig, lock_fd);
 
-  if (!replace_immutable_original(orig, survivor, handle_immutable)) {
+  if (!replace_immutable_original(dirfd, lock_fd, orig, survivor, is_mole,
+                                  NULL, handle_immutable)) {
     /* Error already logged */
     goto FAIL;
   }
@@ -151,10 +262,10 @@ FAIL:;
   int save_errno = errno;
 
   if (flock(lock_fd, LOCK_UN) == 0) {
-    LOG_DEBUG("Released exclusive lock on file (fd = %d)", orig, lock_fd);
+    LOG_DEBUG("Released exclusive lock on '%s' (fd = %d)", orig, lock_fd);
   } else {
-    LOG_DEBUG("Failed to release exclusive lock on original file (fd = %d): %s",
-              orig, strerror(errno));
+    LOG_DEBUG("Failed to release exclusive lock on '%s' (fd = %d): %s", orig,
+              lock_fd, strerror(errno));
     success = false;
   }
 
@@ -169,111 +280,215 @@ FAIL:;
   return success;
 }
 
-bool zeugl_whack_a_mole(const char *orig, const char *temp,
-                        bool handle_immutable, bool no_block) {
-  bool success = false;
-  DIR *dirp = NULL;
-  char *mole = NULL;
-  char *buf_1 = NULL;    /* Buffer for dirname() */
-  char *buf_2 = NULL;    /* Buffer for basename() */
-  char *survivor = NULL; /* Last survivor mole */
-
-  mole = create_a_mole(temp);
-  if (mole == NULL) {
+/**
+ * Check whether the original file, or the mole about to replace it, comes
+ * from a transaction that began after the one with sequence number seq.
+ */
+static bool is_superseded(int dirfd, const char *orig, const char *mole,
+                          uint64_t seq) {
+  const uint64_t orig_seq = zeugl_sequence_get_at(dirfd, orig);
+  const uint64_t mole_seq = zeugl_sequence_get_at(dirfd, mole);
+  if ((orig_seq > seq) || (mole_seq > seq)) {
+    LOG_DEBUG("Transaction %" PRIu64 " on '%s' is superseded by transaction "
+              "%" PRIu64,
+              seq, orig, (orig_seq > mole_seq) ? orig_seq : mole_seq);
+    return true;
+  }
+  return false;
+}
+
+bool zeugl_whack_a_mole(int dirfd, const char *orig, const char *temp,
+                        bool handle_immutable, int timeout, uint64_t seq,
+                        struct zstats *stats) {
+  /* Create mole filename */
+  char mole[PATH_MAX];
+  if (strlen(orig) + strlen(".mole") >= PATH_MAX) {
+    LOG_DEBUG("Mole filename of '%s' is too long", orig);
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  stpcpy(stpcpy(mole, orig), ".mole");
+
+  /* A newer transaction won already, so this one would only be overwritten.
+   * Losing the race counts as success, as if the mole was whacked. */
+  if ((seq != 0) && is_superseded(dirfd, orig, mole, seq)) {
+    stats->superseded = 1;
+    if (unlinkat(dirfd, temp, 0) != 0) {
+      LOG_DEBUG("Failed to delete temporary file '%s': %s", temp,
+                strerror(errno));
+      return false;
+    }
+    LOG_DEBUG("Deleted superseded temporary file '%s'", temp);
+    return true;
+  }
+
+  if (!create_a_mole(dirfd, temp, mole)) {
     LOG_DEBUG("Failed to create a mole from temporary file '%s'", temp);
-    goto FAIL;
+    return false;
   }
 
-  /* Get original dirname */
-  buf_1 = strdup(orig);
-  if (buf_1 == NULL) {
-    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
-    goto FAIL;
+  /* If another agent adopts the mole before us, the original file gets
+   * replaced by it and the rename below fails with ENOENT */
+  if (!atomic_replace_immutable_original(dirfd, orig, mole, true,
+                                         handle_immutable, timeout, stats)) {
+    /* Error already logged */
+    return false;
   }
-  const char *dname = dirname(buf_1);
 
-  /* Get original basename */
-  buf_2 = strdup(orig);
-  if (buf_2 == NULL) {
-    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
-    goto FAIL;
+  return true;
+}
+
+bool zeugl_replace(int dirfd, const char *orig, const char *temp,
+                   bool handle_immutable, int timeout, struct zstats *stats) {
+  return atomic_replace_immutable_original(dirfd, orig, temp, false,
+                                           handle_immutable, timeout, stats);
+}
+
+static void fingerprint_stat(const struct stat *sb,
+                             struct zeugl_fingerprint *fp) {
+  fp->exists = true;
+  fp->dev = sb->st_dev;
+  fp->ino = sb->st_ino;
+  fp->size = sb->st_size;
+#ifdef __APPLE__
+  fp->mtime = sb->st_mtimespec;
+  fp->ctime = sb->st_ctimespec;
+#else
+  fp->mtime = sb->st_mtim;
+  fp->ctime = sb->st_ctim;
+#endif
+}
+
+static bool same_timespec(const struct timespec *a, const struct timespec *b) {
+  return (a->tv_sec == b->tv_sec) && (a->tv_nsec == b->tv_nsec);
+}
+
+static bool same_fingerprint(const struct zeugl_fingerprint *a,
+                             const struct zeugl_fingerprint *b) {
+  return (a->exists == b->exists) && (a->dev == b->dev) &&
+         (a->ino == b->ino) && (a->size == b->size) &&
+         same_timespec(&a->mtime, &b->mtime) &&
+         same_timespec(&a->ctime, &b->ctime);
+}
+
+bool zeugl_fingerprint(int dirfd, const char *orig,
+                       struct zeugl_fingerprint *fp) {
+  memset(fp, 0, sizeof(struct zeugl_fingerprint));
+
+  struct stat sb;
+  if (fstatat(dirfd, orig, &sb, 0) != 0) {
+    if (errno == ENOENT) {
+      LOG_DEBUG("Fingerprinted original file '%s' as missing", orig);
+      return true;
+    }
+    LOG_DEBUG("Failed to stat original file '%s': %s", orig, strerror(errno));
+    return false;
   }
-  const char *bname = basename(buf_2);
 
-  dirp = opendir(dname);
-  if (dirp == NULL) {
-    LOG_DEBUG("Failed to open directory '%s'", dname);
-    goto FAIL;
+  fingerprint_stat(&sb, fp);
+  LOG_DEBUG("Fingerprinted original file '%s' (ino = %ju, size = %jd)", orig,
+            (uintmax_t)fp->ino, (intmax_t)fp->size);
+  return true;
+}
+
+/**
+ * Create the original file from the temporary file, unless another commit
+ * created it in the meantime.
+ */
+static bool create_original(int dirfd, const char *orig, const char *temp) {
+  if (linkat(dirfd, temp, dirfd, orig, 0) != 0) {
+    LOG_DEBUG("Failed to link '%s' to '%s': %s", temp, orig, strerror(errno));
+    if (errno == EEXIST) {
+      errno = ESTALE;
+    }
+    return false;
   }
-  LOG_DEBUG("Opened directory '%s'", dname);
-
-  errno = 0; /* To distinguish between End-of-Directory and ERROR */
-  struct dirent *dire = readdir(dirp);
-
-  while (dire != NULL) {
-    if (is_a_mole(bname, dire->d_name)) {
-      const char *challenger = dire->d_name;
-
-      LOG_DEBUG("Successfully identified a mole '%s'", challenger);
-
-      if /* Initial survivor */ (survivor == NULL) {
-        survivor = strdup(challenger);
-        if (survivor == NULL) {
-          LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
-          goto FAIL;
-        }
-        LOG_DEBUG("Initial challenger '%s' was appointed as the new survivor",
-                  survivor);
-      } else if /* New survivor */ (strcmp(challenger, survivor) > 0) {
-        unlink(survivor); /* Don't care if it fails */
-        LOG_DEBUG("Previous survivor '%s' got whacked", survivor);
-        free(survivor);
-
-        survivor = strdup(challenger);
-        if (survivor == NULL) {
-          LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
-          goto FAIL;
-        }
-        LOG_DEBUG("New challenger '%s' was appointed as the new survivor",
-                  survivor);
-      } else /* Keep old survivor */ {
-        unlink(challenger); /* Don't care if it fails */
-        LOG_DEBUG("New challenger '%s' got whacked", dire->d_name);
-      }
+  LOG_DEBUG("Linked '%s' to '%s'", temp, orig);
+
+  if (unlinkat(dirfd, temp, 0) != 0) {
+    LOG_DEBUG("Failed to delete temporary file '%s': %s", temp,
+              strerror(errno));
+    return false;
+  }
+  LOG_DEBUG("Deleted temporary file '%s'", temp);
+  return true;
+}
+
+bool zeugl_compare_and_swap(int dirfd, const char *orig, const char *temp,
+                            bool handle_immutable, int timeout,
+                            const struct zeugl_fingerprint *expected,
+                            struct zstats *stats) {
+  if (!expected->exists) {
+    return create_original(dirfd, orig, temp);
+  }
+
+  int lock_fd = openat(dirfd, orig, O_RDONLY);
+  if (lock_fd < 0) {
+    LOG_DEBUG("Failed to open original file '%s' for locking: %s", orig,
+              strerror(errno));
+    if (errno == ENOENT) {
+      /* The original file was deleted since */
+      errno = ESTALE;
     }
+    return false;
+  }
+  LOG_DEBUG("Opened original file '%s' (fd = %d) for locking", orig, lock_fd);
 
-    errno = 0;
-    dire = readdir(dirp);
+  bool success = false;
+  uint64_t waited = 0;
+  const bool locked = zeugl_lock(lock_fd, LOCK_EX, timeout, &waited);
+  stats->commit_lock_wait_ns += waited;
+  if (!locked) {
+    LOG_DEBUG("Failed to acquire exclusive lock on '%s' (fd = %d): %s", orig,
+              lock_fd, strerror(errno));
+    goto FAIL;
   }
+  LOG_DEBUG("Acquired exclusive lock on '%s' (fd = %d)", orig, lock_fd);
 
-  if (errno != 0) {
-    LOG_DEBUG("Failed to read directory '%s': %s", dname, strerror(errno));
+  /* The file we locked must still be the original file, and unchanged */
+  struct stat sb_locked, sb_named;
+  if ((fstat(lock_fd, &sb_locked) != 0) ||
+      (fstatat(dirfd, orig, &sb_named, 0) != 0)) {
+    LOG_DEBUG("Failed to stat original file '%s': %s", orig, strerror(errno));
+    if (errno == ENOENT) {
+      errno = ESTALE;
+    }
     goto FAIL;
   }
-  LOG_DEBUG("Reached End-of-Directory '%s'", dname);
 
-  if (!atomic_replace_immutable_original(orig, survivor, handle_immutable,
-                                         no_block)) {
+  struct zeugl_fingerprint current;
+  fingerprint_stat(&sb_locked, &current);
+  if ((sb_named.st_dev != sb_locked.st_dev) ||
+      (sb_named.st_ino != sb_locked.st_ino) ||
+      !same_fingerprint(expected, &current)) {
+    LOG_DEBUG("Original file '%s' was modified since it was fingerprinted",
+              orig);
+    errno = ESTALE;
+    goto FAIL;
+  }
+  LOG_DEBUG("Original file '%s' matches its fingerprint", orig);
+
+  if (!replace_immutable_original(dirfd, lock_fd, orig, temp, false,
+                                  &sb_locked, handle_immutable)) {
     /* Error already logged */
     goto FAIL;
   }
 
   success = true;
 FAIL:;
-
   int save_errno = errno;
-  free(mole);
-  free(buf_1);
-  free(buf_2);
-  free(survivor);
-  if (dirp != NULL) {
-    if (closedir(dirp) == 0) {
-      LOG_DEBUG("Successfully closed directory '%s'", dname);
-    } else {
-      LOG_DEBUG("Failed to close directory '%s': %s", dname, strerror(errno));
-    }
+
+  if (locked && (flock(lock_fd, LOCK_UN) != 0)) {
+    LOG_DEBUG("Failed to release exclusive lock on '%s' (fd = %d): %s", orig,
+              lock_fd, strerror(errno));
+    success = false;
   }
-  errno = save_errno;
 
+  if (close(lock_fd) != 0) {
+    LOG_DEBUG("Failed to close original file '%s' (fd = %d)", orig, lock_fd);
+    success = false;
+  }
+
+  errno = save_errno;
   return success;
 }
@@ -2,8 +2,110 @@
 #define __ZEUGL_WACKAMOLE_H__
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
 
-bool zeugl_whack_a_mole(const char *orig, const char *temp,
-                        bool handle_immutable, bool no_block);
+struct zstats;
+
+/**
+ * Identity and last modification of an original file, to tell whether it was
+ * replaced or modified since.
+ */
+struct zeugl_fingerprint {
+  bool exists; /* Whether the original file existed at all */
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  struct timespec ctime;
+};
+
+/**
+ * @brief Replace the original file with the temporary file, such that exactly
+ * one of the concurrent commits to the same original file wins.
+ * @param dirfd File descriptor of the directory of the original file.
+ * @param orig Original filename, relative to dirfd.
+ * @param temp Temporary filename, relative to dirfd.
+ * @param handle_immutable Temporarily clear the immutable attribute of orig.
+ * @param timeout Maximum number of milliseconds to wait for the lock of orig
+ * (see zeugl_lock()).
+ * @param seq Sequence number of the transaction (see zeugl_sequence_next()),
+ * or zero to replace the original file no matter which transaction it comes
+ * from.
+ * @param stats Statistics to add the time spent waiting for the lock to.
+ * @return true on success, or if another commit won. On error false is
+ * returned and errno is set.
+ * @note The exclusive lock of orig is only taken if handle_immutable is set,
+ * to clear and restore the immutable attribute under it.
+ * @note If the original file or the mole of a concurrent commit has a greater
+ * sequence number than seq, the temporary file is deleted instead, and the
+ * superseded field of stats is set.
+ * @note The temporary file is renamed to the rendezvous name "<orig>.mole",
+ * whacking the mole of any concurrent commit, and the mole at the rendezvous
+ * name is then renamed to orig. This takes the same time no matter how many
+ * files the directory has.
+ */
+bool zeugl_whack_a_mole(int dirfd, const char *orig, const char *temp,
+                        bool handle_immutable, int timeout, uint64_t seq,
+                        struct zstats *stats);
+
+/**
+ * @brief Replace the original file with the temporary file in one rename(2),
+ * without going through the rendezvous name.
+ * @param dirfd File descriptor of the directory of the original file.
+ * @param orig Original filename, relative to dirfd.
+ * @param temp Temporary filename, relative to dirfd.
+ * @param handle_immutable Temporarily clear the immutable attribute of orig.
+ * @param timeout Maximum number of milliseconds to wait for the lock of orig
+ * (see zeugl_lock()).
+ * @param stats Statistics to add the time spent waiting for the lock to.
+ * @return true on success. On error false is returned and errno is set.
+ * @note The temporary file is at its own name until it is at orig, so that
+ * whoever finishes an interrupted commit finds it at one of the two. The
+ * exclusive lock of orig is only taken if handle_immutable is set.
+ */
+bool zeugl_replace(int dirfd, const char *orig, const char *temp,
+                   bool handle_immutable, int timeout, struct zstats *stats);
+
+/**
+ * @brief Take the fingerprint of an original file.
+ * @param dirfd File descriptor of the directory of the original file.
+ * @param orig Original filename, relative to dirfd.
+ * @param fp Fingerprint to fill in. A missing original file is fingerprinted
+ * as such.
+ * @return true on success. On error false is returned and errno is set.
+ */
+bool zeugl_fingerprint(int dirfd, const char *orig,
+                       struct zeugl_fingerprint *fp);
+
+/**
+ * @brief Replace the original file with the temporary file, only if the
+ * original file still matches a fingerprint.
+ * @param dirfd File descriptor of the directory of the original file.
+ * @param orig Original filename, relative to dirfd.
+ * @param temp Temporary filename, relative to dirfd.
+ * @param handle_immutable Temporarily clear the immutable attribute of orig.
+ * @param timeout Maximum number of milliseconds to wait for the lock of orig
+ * (see zeugl_lock()).
+ * @param expected Fingerprint of the original file taken earlier.
+ * @param stats Statistics to add the time spent waiting for the lock to.
+ * @return true on success. On error false is returned and errno is set, to
+ * ESTALE if the original file no longer matches the fingerprint.
+ * @note The fingerprint is compared and the temporary file is swapped in while
+ * holding the exclusive lock of orig, so that concurrent compare-and-swap
+ * commits to the same original file see each other. Other commits take no
+ * lock, so the temporary file is exchanged with orig and the displaced file
+ * is checked to be the one compared. If another commit replaced it in the
+ * meantime, the files are exchanged back and errno is set to ESTALE. On
+ * filesystems that cannot exchange files, the temporary file is renamed over
+ * orig, and a commit landing right before that goes unnoticed. A missing
+ * original file is created with link(2), which fails if another commit created
+ * it first.
+ */
+bool zeugl_compare_and_swap(int dirfd, const char *orig, const char *temp,
+                            bool handle_immutable, int timeout,
+                            const struct zeugl_fingerprint *expected,
+                            struct zstats *stats);
 
 #endif /* __ZEUGL_WACKAMOLE_H__ */
@@ -1,10 +1,9 @@
 #include "config.h"
 
 #include <assert.h>
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <libgen.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <pthread.h>
 #include <stdarg.h>
@@ -14,125 +13,526 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "cache.h"
+#include "dircache.h"
 #include "filecopy.h"
+#include "groupcommit.h"
+#include "lock.h"
 #include "logger.h"
+#include "registry.h"
+#include "sequence.h"
+#include "shmlock.h"
 #include "signals.h"
+#include "tunables.h"
 #include "whackamole.h"
 #include "zeugl.h"
 
 struct zfile {
-  char *orig;
-  char *temp;
-  char *mole;
+  char orig[PATH_MAX];
+  char temp[PATH_MAX];
+  size_t base; /* Offset of the filename in orig and temp */
+  int dirfd;   /* Directory that orig and temp are relative to */
+  dev_t dir_dev; /* Device and inode of the directory */
+  ino_t dir_ino;
   int fd;
   mode_t mode;
   int flags;
-  struct zfile *next;
+  int timeout;          /* Milliseconds to wait for locks on orig */
+  bool reserved;        /* Disk space may be reserved beyond End-of-File */
+  bool anonymous;       /* Temporary file has no name until it is committed */
+  struct zgroup *group; /* Transaction group the file belongs to, if any */
+  /* Original file as of zopen(), if Z_OPTIMISTIC was specified */
+  struct zeugl_fingerprint fingerprint;
+  uint64_t seq; /* Sequence number, see zeugl_sequence_next() */
+  /* Held from zopen() until the transaction ends, if Z_SHMLOCK was specified */
+  struct zeugl_shmlock lock;
+  void *map;         /* Mapping of the temporary file, see zmap() */
+  size_t map_length; /* Length of the mapping in bytes */
+  struct zstats stats;
 };
 
 #ifdef HAVE_PTHREAD
 /**
- * Mutex to protect list of open files in multithreaded programs
+ * Makes sure the cleanup handlers are installed once in multithreaded programs
  */
-static pthread_mutex_t OPEN_FILES_MUTEX = PTHREAD_MUTEX_INITIALIZER;
-#endif /* HAVE_PTHREADS */
+static pthread_once_t CLEANUP_ONCE = PTHREAD_ONCE_INIT;
+#endif /* HAVE_PTHREAD */
+
+/**
+ * Statistics of the last file transaction in the calling thread
+ */
+static __thread struct zstats LAST_STATS;
+
+/* Number of attempts at finding an unused temporary filename */
+#define TEMP_MAX_ATTEMPTS 100
 
 /**
- * List of files opened with zopen()
+ * Close and remove the temporary file of a file transaction that was never
+ * closed. The record itself is not freed, as this may run in a signal handler.
  */
-static struct zfile *OPEN_FILES = NULL;
+static void cleanup_open_file(void *entry) {
+  const struct zfile *file = entry;
+
+  /* Close file descriptor in case its open */
+  if (close(file->fd) == 0) {
+    LOG_DEBUG("Cleanup: Closed file descriptor %d", file->fd);
+  } else {
+    LOG_DEBUG("Cleanup: Failed to close file descriptor %d", file->fd);
+  }
+
+  /* An anonymous temporary file goes away with its file descriptor */
+  if (file->anonymous) {
+    return;
+  }
+
+  /* Remove temporary file */
+  if (unlinkat(file->dirfd, file->temp + file->base, 0) == 0) {
+    LOG_DEBUG("Cleanup: Removed temporary file '%s'", file->temp);
+  } else {
+    LOG_DEBUG("Cleanup: Failed to remove temporary file '%s': %s", file->temp,
+              strerror(errno));
+  }
+}
 
 /**
  * Cleanup function that removes all temporary files.
  * This is called at normal exit via atexit() or from signal handler.
  */
 static void cleanup_open_files(void) {
-  /* Note: We don't lock the mutex here because:
-   * 1. In atexit() context, we're single-threaded (other threads are gone)
-   * 2. In signal handler context, we can't use pthread functions safely
-   * 3. This is a best-effort cleanup for abnormal termination
-   */
+  /* The registry is walked without taking any lock, so this is safe in
+   * signal handler context. Transactions that are being closed by another
+   * thread right now are left to that thread. */
+  zeugl_registry_drain(cleanup_open_file);
+}
 
-  for (struct zfile *file = OPEN_FILES; file != NULL; file = file->next) {
-    /* Close file descriptor in case its open */
-    if (close(file->fd) == 0) {
-      LOG_DEBUG("Cleanup: Closed file descriptor %d", file->fd);
-    } else {
-      LOG_DEBUG("Cleanup: Failed to close file descriptor %d", file->fd);
+static void install_cleanup_handlers(void) {
+  zeugl_install_signal_handlers(cleanup_open_files);
+}
+
+/**
+ * Get a transaction record. The record of the previous transaction in the
+ * calling thread is reused, so that a steady stream of transactions does not
+ * allocate.
+ */
+static struct zfile *file_alloc(void) {
+  struct zfile *file = zeugl_cache_take(ZEUGL_CACHE_FILE, NULL);
+  if (file == NULL) {
+    file = malloc(sizeof(struct zfile));
+    if (file == NULL) {
+      LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+      return NULL;
     }
+  }
 
-    /* Remove temporary file */
-    if (file->temp != NULL) {
-      if (unlink(file->temp) == 0) {
-        LOG_DEBUG("Cleanup: Removed temporary file '%s'", file->temp);
-      } else {
-        LOG_DEBUG("Cleanup: Failed to remove temporary file '%s': %s",
-                  file->temp, strerror(errno));
+  /* The filename buffers are large, so don't clear them all */
+  file->orig[0] = '\0';
+  file->temp[0] = '\0';
+  file->base = 0;
+  file->dirfd = -1;
+  file->fd = -1;
+  file->mode = 0;
+  file->flags = 0;
+  file->reserved = false;
+  file->anonymous = false;
+  file->group = NULL;
+  file->lock.table = NULL;
+  file->map = NULL;
+  file->map_length = 0;
+  memset(&file->stats, 0, sizeof(file->stats));
+  return file;
+}
+
+/**
+ * Unmap the temporary file if it was mapped with zmap(). With sync, changes
+ * made through the mapping are written back first, and waited for if the file
+ * is to be durable.
+ */
+static bool unmap_file(struct zfile *file, bool sync) {
+  if (file->map == NULL) {
+    return true;
+  }
+
+  const int mode =
+      (file->flags & (Z_DURABLE_DATA | Z_DURABLE_FULL)) ? MS_SYNC : MS_ASYNC;
+  if (sync && (msync(file->map, file->map_length, mode) != 0)) {
+    LOG_DEBUG("Failed to synchronize mapping of temporary file '%s': %s",
+              file->temp, strerror(errno));
+    return false;
+  }
+
+  if (munmap(file->map, file->map_length) != 0) {
+    LOG_DEBUG("Failed to unmap temporary file '%s': %s", file->temp,
+              strerror(errno));
+    return false;
+  }
+  LOG_DEBUG("Unmapped %zu bytes of temporary file '%s'", file->map_length,
+            file->temp);
+  file->map = NULL;
+  file->map_length = 0;
+  return true;
+}
+
+static void file_free(struct zfile *file) {
+  unmap_file(file, false);
+  zeugl_shmlock_release(&file->lock);
+  zeugl_dircache_close(file->dirfd);
+  zeugl_cache_give(ZEUGL_CACHE_FILE, file, sizeof(struct zfile), free);
+}
+
+/**
+ * Open the directory of a file through the directory cache.
+ * @param path Path of the file, shorter than PATH_MAX.
+ * @param base Set to the offset of the filename in path.
+ * @param dir Set to the status of the directory.
+ * @return File descriptor of the directory, or -1 with errno set.
+ */
+static int open_parent(const char *path, size_t *base, struct stat *dir) {
+  char dname[PATH_MAX];
+  const char *slash = strrchr(path, '/');
+  if (slash == NULL) {
+    *base = 0;
+    strcpy(dname, ".");
+  } else {
+    *base = (size_t)(slash - path) + 1;
+    /* Keep the slash if the file is in the root directory */
+    const size_t dname_len = (slash == path) ? 1 : *base - 1;
+    memcpy(dname, path, dname_len);
+    dname[dname_len] = '\0';
+  }
+
+  if (path[*base] == '\0') {
+    LOG_DEBUG("Filename '%s' names a directory", path);
+    errno = EISDIR;
+    return -1;
+  }
+
+  int dirfd = zeugl_dircache_open(dname, dir);
+  if (dirfd < 0) {
+    LOG_DEBUG("Failed to open directory '%s': %s", dname, strerror(errno));
+    return -1;
+  }
+  return dirfd;
+}
+
+/**
+ * Open the directory of the original file, and remember where the filename
+ * starts. Everything else in the transaction is done relative to the
+ * directory, so that the path is only resolved once.
+ */
+static bool open_directory(struct zfile *file) {
+  struct stat sb;
+  file->dirfd = open_parent(file->orig, &file->base, &sb);
+  if (file->dirfd < 0) {
+    return false;
+  }
+  file->dir_dev = sb.st_dev;
+  file->dir_ino = sb.st_ino;
+  return true;
+}
+
+/**
+ * Fill the file->temp buffer with the name of a temporary file next to the
+ * original file, ending in a random suffix like mkstemp(3).
+ */
+static void random_temp_name(struct zfile *file) {
+  static const char letters[] =
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  static __thread uint64_t counter = 0;
+
+  stpcpy(stpcpy(file->temp, file->orig), ".XXXXXX");
+  char *suffix = file->temp + strlen(file->temp) - strlen("XXXXXX");
+
+  /* Mix the time, process, thread and a counter, so that concurrent
+   * transactions are unlikely to collide */
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t value = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec;
+  value ^= ((uint64_t)getpid() << 16) ^ (uint64_t)(uintptr_t)&counter;
+  value ^= ++counter * 0x9e3779b97f4a7c15ULL;
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+
+  for (size_t i = 0; i < strlen("XXXXXX"); i++) {
+    suffix[i] = letters[value % (sizeof(letters) - 1)];
+    value /= sizeof(letters) - 1;
+  }
+}
+
+/**
+ * Create a named temporary file next to the original file. This is
+ * mkstemp(3) relative to the directory of the transaction.
+ */
+static int create_named_file(struct zfile *file) {
+  for (int attempt = 0; attempt < TEMP_MAX_ATTEMPTS; attempt++) {
+    random_temp_name(file);
+    int fd = openat(file->dirfd, file->temp + file->base,
+                    O_RDWR | O_CREAT | O_EXCL, (mode_t)0600);
+    if ((fd >= 0) || (errno != EEXIST)) {
+      return fd;
+    }
+  }
+
+  errno = EEXIST;
+  return -1;
+}
+
+#ifdef O_TMPFILE
+/**
+ * Whether linking by file descriptor was refused, because it requires the
+ * CAP_DAC_READ_SEARCH capability. Anonymous files are then linked through
+ * /proc/self/fd instead.
+ */
+static bool EMPTY_PATH_DENIED = false;
+
+/**
+ * Create an anonymous temporary file in the directory of the original file.
+ * It gets a name only when the transaction is committed, so an aborted or
+ * crashed transaction leaves nothing behind.
+ * @return The file descriptor, or -1 with errno set to EOPNOTSUPP if the
+ * caller should fall back to a named temporary file.
+ */
+static int create_anonymous_file(struct zfile *file) {
+  /* Named temporary files can be forced, e.g., for debugging */
+  if (zeugl_tunable_has(ZEUGL_ENV_TEMP_FILE, "named")) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  /* Without /proc the file can only be linked with CAP_DAC_READ_SEARCH, and
+   * we would find out when it is too late */
+  static int proc_missing = -1;
+  int missing = __atomic_load_n(&proc_missing, __ATOMIC_RELAXED);
+  if (missing < 0) {
+    missing = (access("/proc/self/fd", X_OK) != 0) ? 1 : 0;
+    __atomic_store_n(&proc_missing, missing, __ATOMIC_RELAXED);
+  }
+  if (missing) {
+    LOG_DEBUG("Not using anonymous temporary files: /proc is not available");
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  int fd = openat(file->dirfd, ".", O_RDWR | O_TMPFILE, (mode_t)0600);
+  if ((fd < 0) && ((errno == EISDIR) || (errno == EINVAL))) {
+    /* Kernels without O_TMPFILE mistake it for O_DIRECTORY */
+    errno = EOPNOTSUPP;
+  }
+  return fd;
+}
+
+/**
+ * Give the anonymous temporary file a name next to the original file, so
+ * that it can be renamed like a named temporary file.
+ */
+static bool link_anonymous_file(struct zfile *file, int fd) {
+  char proc_path[sizeof("/proc/self/fd/") + 3 * sizeof(int)];
+  snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+
+  for (int attempt = 0; attempt < TEMP_MAX_ATTEMPTS; attempt++) {
+    random_temp_name(file);
+
+    int ret = -1;
+    if (!__atomic_load_n(&EMPTY_PATH_DENIED, __ATOMIC_RELAXED)) {
+      ret = linkat(fd, "", file->dirfd, file->temp + file->base,
+                   AT_EMPTY_PATH);
+      if ((ret != 0) && ((errno == ENOENT) || (errno == EPERM))) {
+        LOG_DEBUG("Linking by file descriptor is not permitted: "
+                  "Falling back to '%s'",
+                  proc_path);
+        __atomic_store_n(&EMPTY_PATH_DENIED, true, __ATOMIC_RELAXED);
       }
     }
+    if (__atomic_load_n(&EMPTY_PATH_DENIED, __ATOMIC_RELAXED)) {
+      ret = linkat(AT_FDCWD, proc_path, file->dirfd, file->temp + file->base,
+                   AT_SYMLINK_FOLLOW);
+    }
+
+    if (ret == 0) {
+      LOG_DEBUG("Linked anonymous temporary file (fd = %d) to '%s'", fd,
+                file->temp);
+      file->anonymous = false;
+      return true;
+    }
+    if (errno != EEXIST) {
+      LOG_DEBUG("Failed to link anonymous temporary file (fd = %d): %s", fd,
+                strerror(errno));
+      file->temp[0] = '\0';
+      return false;
+    }
   }
 
-  OPEN_FILES = NULL;
+  file->temp[0] = '\0';
+  errno = EEXIST;
+  return false;
 }
+#endif /* O_TMPFILE */
 
-int zopen(const char *fname, int flags, ...) {
+/**
+ * Create the temporary file of the transaction. An anonymous file is preferred
+ * where the platform and filesystem support it.
+ */
+static int create_temp_file(struct zfile *file) {
+#ifdef O_TMPFILE
+  /* Members of a transaction group are named in the intent record */
+  if (file->group != NULL) {
+    return create_named_file(file);
+  }
+
+  int fd = create_anonymous_file(file);
+  if (fd >= 0) {
+    file->anonymous = true;
+    return fd;
+  }
+  if (errno != EOPNOTSUPP) {
+    return -1;
+  }
+  LOG_DEBUG("Falling back to a named temporary file");
+#endif /* O_TMPFILE */
+
+  return create_named_file(file);
+}
+
+static bool group_add(struct zgroup *group, struct zfile *file);
+static bool discard_file(struct zfile *file);
+
+/**
+ * Get the timeout for flock(2) on the original file, which is not needed while
+ * the shared-memory lock is held.
+ */
+static int lock_timeout(const struct zfile *file) {
+  return (file->lock.table != NULL) ? ZEUGL_LOCK_HELD : file->timeout;
+}
+
+/**
+ * Get the timeout for flock(2) on the original file while committing. The
+ * exclusive lock taken for Z_IMMUTABLE and Z_OPTIMISTIC is what serializes the
+ * commit with transactions that do not use the shared-memory lock, so it is
+ * taken even while that lock is held.
+ */
+static int commit_timeout(const struct zfile *file) {
+  return (file->flags & (Z_IMMUTABLE | Z_OPTIMISTIC)) ? file->timeout
+                                                      : lock_timeout(file);
+}
+
+/**
+ * Optional arguments of zopen() and zgroup_open()
+ */
+struct open_args {
+  int mode; /* Avoid using mode_t in va_arg() */
+  off_t size_hint;
+  int timeout;      /* Milliseconds to wait for locks, see zeugl_lock() */
+  bool force_mode; /* Apply mode even if the original file exists */
+};
+
+/**
+ * Begin a file transaction, optionally as a member of a transaction group,
+ * without registering it. Returns NULL with errno set on error.
+ */
+static struct zfile *file_begin(const char *fname, int flags,
+                                const struct open_args *args,
+                                struct zgroup *group) {
   assert(fname != NULL);
 
   struct zfile *file = NULL;
+  memset(&LAST_STATS, 0, sizeof(LAST_STATS));
+
+  const size_t fname_len = strlen(fname);
+  if (fname_len + strlen(".XXXXXX") >= PATH_MAX) {
+    LOG_DEBUG("Filename '%s' is too long", fname);
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
 
-  file = calloc(1, sizeof(struct zfile));
+  file = file_alloc();
   if (file == NULL) {
-    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
-    return -1;
+    return NULL;
+  }
+
+  /* Copy policies can also be selected through the environment */
+  if (zeugl_tunable_has(ZEUGL_ENV_COPY_POLICY, "nocache")) {
+    flags |= Z_NOCACHE;
+  }
+  if (zeugl_tunable_has(ZEUGL_ENV_COPY_POLICY, "direct")) {
+    flags |= Z_DIRECT;
+  }
+  if (zeugl_tunable_has(ZEUGL_ENV_COPY_POLICY, "parallel")) {
+    flags |= Z_PARALLEL;
   }
-  file->fd = -1;
   file->flags = flags;
+  file->timeout = args->timeout;
+  file->group = group;
 
-  file->orig = strdup(fname);
-  if (file->orig == NULL) {
-    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+  memcpy(file->orig, fname, fname_len + 1);
+
+  if (!open_directory(file)) {
     goto FAIL;
   }
 
-  file->temp = malloc(strlen(file->orig) + strlen(".XXXXXX") + 1);
-  if (file->temp == NULL) {
-    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+  /* With Z_SHMLOCK, transactions on the same file take turns, so that they
+   * never conflict */
+  uint64_t waited = 0;
+  const bool locked =
+      !(flags & Z_SHMLOCK) ||
+      zeugl_shmlock_acquire(file->dirfd, file->dir_dev, file->dir_ino,
+                            file->orig + file->base,
+                            file->timeout, &file->lock, &waited);
+  file->stats.open_lock_wait_ns += waited;
+  if (!locked) {
+    LOG_DEBUG("Failed to acquire shared-memory lock on file '%s': %s",
+              file->orig, strerror(errno));
     goto FAIL;
   }
 
-  /* Create template filename */
-  stpcpy(stpcpy(file->temp, file->orig), ".XXXXXX");
+  /* Fingerprint the original file before it is copied. If it changes before
+   * the copy, the commit fails, which is safe. */
+  if ((flags & Z_OPTIMISTIC) &&
+      !zeugl_fingerprint(file->dirfd, file->orig + file->base,
+                         &file->fingerprint)) {
+    goto FAIL;
+  }
 
-  file->fd = mkstemp(file->temp);
+  /* Transactions that begin later get greater sequence numbers. With
+   * Z_NEWEST, also stay ahead of the transaction that committed the original
+   * file, in case the clocks disagree. */
+  file->seq = zeugl_sequence_next(
+      (flags & Z_NEWEST)
+          ? zeugl_sequence_get_at(file->dirfd, file->orig + file->base)
+          : 0);
+
+  file->fd = create_temp_file(file);
   if (file->fd < 0) {
     LOG_DEBUG("Failed to create temporary file: %s", strerror(errno));
     goto FAIL;
   }
-  LOG_DEBUG("Created temporary file '%s' (fd = %d)", file->temp, file->fd);
-
-  /* Extract mode argument from zopen() if Z_CREATE was specified */
-  int mode; /* Avoid using mode_t in va_arg() */
-  if (flags & Z_CREATE) {
-    va_list ap;
-    va_start(ap, flags);
-    mode = va_arg(ap, int) & 0777; /* Don't keep user bit */
-    va_end(ap);
+  if (file->anonymous) {
+    LOG_DEBUG("Created anonymous temporary file for '%s' (fd = %d)",
+              file->orig, file->fd);
+  } else {
+    LOG_DEBUG("Created temporary file '%s' (fd = %d)", file->temp, file->fd);
   }
 
-  if (flags & Z_TRUNCATE) {
+  if (args->force_mode) {
+    file->mode = (mode_t)args->mode;
+    LOG_DEBUG("Using specified mode %04jo for file '%s'", (uintmax_t)file->mode,
+              file->orig);
+  } else if (flags & Z_TRUNCATE) {
     struct stat sb;
-    if (lstat(file->orig, &sb) == 0) {
+    if (fstatat(file->dirfd, file->orig + file->base, &sb,
+                AT_SYMLINK_NOFOLLOW) == 0) {
       file->mode = sb.st_mode & 0777; /* Don't keep user bit */
       LOG_DEBUG("Original file '%s' exists: Using original mode %04jo",
                 file->orig, (uintmax_t)file->mode);
     } else {
       if ((flags & Z_CREATE) && (errno == ENOENT)) {
         /* Use mode specified in argument */
-        file->mode = (mode_t)mode;
+        file->mode = (mode_t)args->mode;
         LOG_DEBUG("Original file '%s' does not exist: "
                   "Using specified mode %04jo",
                   file->orig, (uintmax_t)file->mode);
@@ -143,12 +543,12 @@ int zopen(const char *fname, int flags, ...) {
       }
     }
   } else {
-    int fd = open(file->orig, O_RDONLY);
+    int fd = openat(file->dirfd, file->orig + file->base, O_RDONLY);
     if (fd < 0) {
       if ((flags & Z_CREATE) && (errno == ENOENT)) {
         /* If Z_CREATE was specified, then ENOENT can be expected */
         /* Use mode specified in argument */
-        file->mode = (mode_t)mode;
+        file->mode = (mode_t)args->mode;
         LOG_DEBUG("Original file '%s' does not exist: "
                   "Using specified mode %04jo",
                   file->orig, (uintmax_t)file->mode);
@@ -177,7 +577,8 @@ int zopen(const char *fname, int flags, ...) {
       LOG_DEBUG("Using mode %04jo from original file '%s' (fd = %d)",
                 (uintmax_t)file->mode, file->orig, fd);
 
-      if (!zeugl_atomic_filecopy(fd, file->fd, (flags | Z_NOBLOCK))) {
+      if (!zeugl_atomic_filecopy(fd, file->fd, flags, lock_timeout(file),
+                                 &file->stats)) {
         LOG_DEBUG("Failed to copy content from original file '%s' (fd = %d) "
                   "to temporary file '%s' (fd = %d): %s",
                   file->orig, fd, file->temp, file->fd, strerror(errno));
@@ -192,6 +593,7 @@ int zopen(const char *fname, int flags, ...) {
       LOG_DEBUG("Successfully copied content from original file '%s' (fd = %d) "
                 "to temporary file '%s' (fd = %d)",
                 file->orig, fd, file->temp, file->fd);
+      file->reserved = true;
 
       if (close(fd) == 0) {
         LOG_DEBUG("Closed original file '%s' (fd = %d)", file->orig, fd);
@@ -202,6 +604,19 @@ int zopen(const char *fname, int flags, ...) {
     }
   }
 
+  if (flags & Z_SIZEHINT) {
+    /* Reserve space for the expected size, so that we fail now rather than
+     * halfway through writing if the disk is full */
+    if (!zeugl_preallocate(file->fd, args->size_hint)) {
+      LOG_DEBUG("Failed to reserve %jd bytes for temporary file '%s' "
+                "(fd = %d): %s",
+                (intmax_t)args->size_hint, file->temp, file->fd,
+                strerror(errno));
+      goto FAIL;
+    }
+    file->reserved = true;
+  }
+
   if (!(flags & (Z_APPEND | Z_TRUNCATE))) {
     if (lseek(file->fd, 0, SEEK_SET) != 0) {
       LOG_DEBUG("Failed to reposition file offset to the beginning of the file "
@@ -214,45 +629,15 @@ int zopen(const char *fname, int flags, ...) {
               file->temp, file->fd);
   }
 
-#ifdef HAVE_PTHREAD
-  int ret = pthread_mutex_lock(&OPEN_FILES_MUTEX);
-  if (ret != 0) {
-    LOG_DEBUG("Failed to acquire mutex protecting list of open files: %s",
-              strerror(ret));
-    goto FAIL;
-  }
-  LOG_DEBUG("Successfully acquired mutex protecting list of open files");
-#endif /* HAVE_PTHREAD */
-
-  file->next = OPEN_FILES;
-  OPEN_FILES = file;
-  LOG_DEBUG("Added file to list of open files "
-            "(orig = '%s', temp = '%s', fd = %d, mode = %04jo, flags = 0x%08x)",
-            file->orig, file->temp, file->fd, file->mode, file->flags);
-
-  /* Install cleanup handlers on first successful file creation.
-   * This only happens the first time this function is called.
-   * Subsequent calls results in NOOP.
-   */
-  zeugl_install_signal_handlers(cleanup_open_files);
-
-#ifdef HAVE_PTHREAD
-  ret = pthread_mutex_unlock(&OPEN_FILES_MUTEX);
-  if (ret != 0) {
-    LOG_DEBUG("Failed to release mutex protecting list of open files: %s",
-              strerror(ret));
-    goto FAIL;
-  }
-  LOG_DEBUG("Successfully released mutex protecting list of open files");
-#endif /* HAVE_PTHREAD */
-
-  return file->fd;
+  LAST_STATS = file->stats;
+  return file;
 
 FAIL:
   if (file != NULL) {
     int save_errno = errno;
 
-    free(file->orig);
+    LAST_STATS = file->stats;
+
     if (file->fd >= 0) {
       if (close(file->fd) == 0) {
         LOG_DEBUG("Closed temporary file '%s' (fd = %d)", file->temp, file->fd);
@@ -260,127 +645,1460 @@ FAIL:
         LOG_DEBUG("Failed to close temporary file '%s' (fd = %d): %s",
                   file->temp, file->fd, strerror(errno));
       }
-    }
 
-    if (file->temp != NULL) {
-      if (unlink(file->temp) == 0) {
-        LOG_DEBUG("Deleted temporary file '%s'", file->temp);
-      } else {
-        LOG_DEBUG("Failed to delete temporary file '%s': %s", file->temp,
-                  strerror(errno));
+      /* An anonymous temporary file is gone already */
+      if (!file->anonymous) {
+        if (unlinkat(file->dirfd, file->temp + file->base, 0) == 0) {
+          LOG_DEBUG("Deleted temporary file '%s'", file->temp);
+        } else {
+          LOG_DEBUG("Failed to delete temporary file '%s': %s", file->temp,
+                    strerror(errno));
+        }
       }
-      free(file->temp);
     }
-    free(file);
+    file_free(file);
 
     /* Restore errno */
     errno = save_errno;
   }
 
-  return -1;
+  return NULL;
 }
 
-int zclose(int fd, bool commit) {
-  /* Consider -1 a no-op */
-  if (fd == -1) {
-    return 0;
+/**
+ * Register an open file, so that zclose() can find it and the cleanup handlers
+ * can remove its temporary file.
+ */
+static bool register_file(struct zfile *file) {
+  /* Install cleanup handlers on first successful file creation.
+   * This only happens the first time this function is called.
+   * Subsequent calls results in NOOP.
+   */
+#ifdef HAVE_PTHREAD
+  int ret = pthread_once(&CLEANUP_ONCE, install_cleanup_handlers);
+  if (ret != 0) {
+    LOG_DEBUG("Failed to install cleanup handlers: %s", strerror(ret));
+    errno = ret;
+    return false;
   }
+#else  /* HAVE_PTHREAD */
+  install_cleanup_handlers();
+#endif /* HAVE_PTHREAD */
 
-  /* We don't need the file descriptor anymore */
-  if (close(fd) != 0) {
-    LOG_DEBUG("Failed to close file (fd = %d)", fd);
-    return -1;
+  if (!zeugl_registry_add(file->fd, file)) {
+    LOG_DEBUG("Failed to register open file (fd = %d): %s", file->fd,
+              strerror(errno));
+    return false;
   }
-  LOG_DEBUG("Closed file (fd = %d)", fd);
+  LOG_DEBUG("Registered open file "
+            "(orig = '%s', temp = '%s', fd = %d, mode = %04jo, flags = 0x%08x)",
+            file->orig, file->temp, file->fd, file->mode, file->flags);
+  return true;
+}
 
-#ifdef HAVE_PTHREAD
-  int err = pthread_mutex_lock(&OPEN_FILES_MUTEX);
-  if (err != 0) {
-    LOG_DEBUG("Failed to acquire mutex protecting list of open files: %s",
-              strerror(err));
+/**
+ * Abort a file transaction that failed before it was handed out, and free it.
+ */
+static void file_abort(struct zfile *file) {
+  int save_errno = errno;
+  LAST_STATS = file->stats;
+  discard_file(file);
+  file_free(file);
+  errno = save_errno;
+}
+
+/**
+ * Begin a file transaction, optionally as a member of a transaction group.
+ * This does the work of zopen() once the optional arguments are extracted.
+ */
+static int file_open(const char *fname, int flags,
+                     const struct open_args *args, struct zgroup *group) {
+  struct zfile *file = file_begin(fname, flags, args, group);
+  if (file == NULL) {
     return -1;
   }
-  LOG_DEBUG("Successfully acquired mutex protecting list of open files");
-#endif /* HAVE_PTHREAD */
-
-  int ret = -1;
 
-  LOG_DEBUG("Looking for file with matching file descriptor %d...", fd);
-  struct zfile *prev = NULL, *file = OPEN_FILES;
-  while ((file != NULL) && (file->fd != fd)) {
-    prev = file;
-    file = file->next;
+  if (!register_file(file)) {
+    file_abort(file);
+    return -1;
   }
 
-  if ((file == NULL) || (file->fd != fd)) {
-    LOG_DEBUG("Did not find a file with matching file descriptor (fd = %d): "
-              "This file was not opened with zopen()",
-              fd);
-    /* This file was not opened with zopen(). Hence, no need to perform the
-     * wack-a-mole. */
-    goto FAIL;
+  if ((group != NULL) && !group_add(group, file)) {
+    zeugl_registry_take(file->fd);
+    file_abort(file);
+    return -1;
   }
-  LOG_DEBUG("Found file '%s' with matching file descriptor (fd = %d): "
-            "This file was opened with zopen()",
-            file->temp, file->fd);
 
-  if (commit) {
-    if (chmod(file->temp, file->mode) != 0) {
-      LOG_DEBUG("Failed to change file mode for file '%s' to %04jo: %s",
-                file->temp, (uintmax_t)file->mode, strerror(errno));
-      goto FAIL;
-    }
-    LOG_DEBUG("Changed file mode for file '%s' to %04jo", file->temp,
-              (uintmax_t)file->mode);
+  return file->fd;
+}
 
-    if (!zeugl_whack_a_mole(file->orig, file->temp, file->flags & Z_IMMUTABLE,
-                            file->flags & Z_NOBLOCK)) {
-      LOG_DEBUG("Failed to execute wack-a-mole algorithm "
-                "(orig = '%s', temp = '%s'): %s",
-                file->orig, file->temp, strerror(errno));
-      goto FAIL;
-    }
-    LOG_DEBUG("Successfully executed wack-a-mole algorithm "
-              "(orig = '%s', temp = '%s')",
-              file->orig, file->temp);
-  } else {
-    LOG_DEBUG("Aborting file transaction");
-    if (unlink(file->temp) != 0) {
-      LOG_DEBUG("Failed to delete temporary file '%s': %s", file->temp,
-                strerror(errno));
-      goto FAIL;
+/**
+ * Extract the optional arguments of zopen() and zgroup_open(). The mode
+ * argument is only present if Z_CREATE was specified, the size hint is only
+ * present if Z_SIZEHINT was specified, and the timeout is only present if
+ * Z_TIMEOUT was specified.
+ */
+static void optional_args(int flags, va_list ap, struct open_args *args) {
+  args->mode = 0;
+  args->size_hint = 0;
+  args->timeout = (flags & Z_NOBLOCK) ? 0 : ZEUGL_LOCK_FOREVER;
+  args->force_mode = false;
+  if (flags & Z_CREATE) {
+    args->mode = va_arg(ap, int) & 0777; /* Don't keep user bit */
+  }
+  if (flags & Z_SIZEHINT) {
+    args->size_hint = va_arg(ap, off_t);
+  }
+  if ((flags & Z_TIMEOUT) && !(flags & Z_NOBLOCK)) {
+    args->timeout = va_arg(ap, int);
+    if (args->timeout < 0) {
+      args->timeout = ZEUGL_LOCK_FOREVER;
     }
-    LOG_DEBUG("Deleted temporary file '%s'", file->temp);
   }
+}
 
-  ret = 0;
-FAIL:
+int zopen(const char *fname, int flags, ...) {
+  struct open_args args;
+  va_list ap;
+  va_start(ap, flags);
+  optional_args(flags, ap, &args);
+  va_end(ap);
 
-  if (prev == NULL) {
-    /* The file was the first element in the list */
-    OPEN_FILES = file->next;
-  } else {
-    /* The file was not the first element in the list. We need to merge left
-     * and right before removal. */
-    prev->next = file->next;
-  }
+  return file_open(fname, flags, &args, NULL);
+}
 
-#ifdef HAVE_PTHREAD
-  err = pthread_mutex_unlock(&OPEN_FILES_MUTEX);
-  if (err != 0) {
-    LOG_DEBUG("Failed to release mutex protecting list of open files: %s",
-              strerror(err));
-    ret = -1;
+/**
+ * Get the temporary file ready to replace the original file.
+ */
+static bool prepare_commit(struct zfile *file, int fd) {
+  /* Changes made through a mapping must reach the file before it replaces the
+   * original file */
+  if (!unmap_file(file, true)) {
+    return false;
   }
-  LOG_DEBUG("Successfully released mutex protecting list of open files");
-#endif /* HAVE_PTHREAD */
 
-  if (file != NULL) {
-    free(file->orig);
-    free(file->temp);
-    free(file->mole);
-    free(file);
+  if (file->reserved) {
+    /* Release the space reserved beyond what was actually written */
+    if (!zeugl_trim(fd)) {
+      LOG_DEBUG("Failed to trim temporary file '%s' (fd = %d): %s", file->temp,
+                fd, strerror(errno));
+      return false;
+    }
+  }
+
+  if (file->flags & Z_NOCACHE) {
+    /* Start writing back the new content and keep it out of the cache */
+    zeugl_drop_cache(fd);
+  }
+
+  if (fchmod(fd, file->mode) != 0) {
+    LOG_DEBUG("Failed to change file mode for file '%s' to %04jo: %s",
+              file->temp, (uintmax_t)file->mode, strerror(errno));
+    return false;
+  }
+  LOG_DEBUG("Changed file mode for file '%s' to %04jo", file->temp,
+            (uintmax_t)file->mode);
+
+  /* Let later transactions on the original file tell whether they were
+   * superseded. Only Z_NEWEST commits are ordered, so the others spare
+   * themselves the extended attribute. */
+  if (file->flags & Z_NEWEST) {
+    zeugl_sequence_set(fd, file->seq);
+  }
+  return true;
+}
+
+/**
+ * Check whether a transaction that began later already replaced the original
+ * file.
+ */
+static bool is_superseded(const struct zfile *file) {
+  const uint64_t seq =
+      zeugl_sequence_get_at(file->dirfd, file->orig + file->base);
+  if (seq > file->seq) {
+    LOG_DEBUG("Transaction %" PRIu64 " on '%s' is superseded by transaction "
+              "%" PRIu64,
+              file->seq, file->orig, seq);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Check whether the original file already has the content, mode and owner of
+ * the temporary file, so that replacing it would change nothing. With
+ * Z_NEWEST, the sequence number of the transaction must replace the one of the
+ * original file, so the commit is never skipped.
+ */
+static bool is_identical(struct zfile *file, int fd) {
+  if (file->flags & Z_NEWEST) {
+    LOG_DEBUG("Original file '%s' must take the sequence number %" PRIu64
+              " of the transaction",
+              file->orig, file->seq);
+    return false;
+  }
+
+  /* A symbolic link would be replaced by a regular file */
+  int orig_fd = openat(file->dirfd, file->orig + file->base,
+                       O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (orig_fd < 0) {
+    LOG_DEBUG("Failed to open original file '%s': %s", file->orig,
+              strerror(errno));
+    return false;
+  }
+
+  bool identical = false;
+  struct stat orig_st, temp_st;
+  if ((fstat(orig_fd, &orig_st) != 0) || (fstat(fd, &temp_st) != 0)) {
+    LOG_DEBUG("Failed to get file status of original file '%s' or temporary "
+              "file '%s': %s",
+              file->orig, file->temp, strerror(errno));
+    goto FAIL;
+  }
+  if (!S_ISREG(orig_st.st_mode) ||
+      ((orig_st.st_mode & 07777) != (temp_st.st_mode & 07777)) ||
+      (orig_st.st_uid != temp_st.st_uid) ||
+      (orig_st.st_gid != temp_st.st_gid)) {
+    LOG_DEBUG("Original file '%s' differs in type, mode or owner", file->orig);
+    goto FAIL;
+  }
+
+  /* Read the original file under a shared lock, like the copy in zopen() */
+  uint64_t waited = 0;
+  const bool locked =
+      zeugl_lock(orig_fd, LOCK_SH, lock_timeout(file), &waited);
+  file->stats.commit_lock_wait_ns += waited;
+  if (!locked) {
+    LOG_DEBUG("Failed to get shared lock for original file '%s': %s",
+              file->orig, strerror(errno));
+    goto FAIL;
+  }
+
+  if (!zeugl_same_content(orig_fd, fd, &identical)) {
+    LOG_DEBUG("Failed to compare original file '%s' with temporary file '%s': "
+              "%s",
+              file->orig, file->temp, strerror(errno));
+    goto FAIL;
+  }
+
+  if (identical) {
+    LOG_DEBUG("Original file '%s' is identical to temporary file '%s'",
+              file->orig, file->temp);
+  }
+
+FAIL:
+  /* Closing the file descriptor releases the lock */
+  close(orig_fd);
+  return identical;
+}
+
+/**
+ * Flush the temporary file to disk before it replaces the original file. Only
+ * the content is flushed unless Z_DURABLE_FULL is set.
+ */
+static bool sync_file(struct zfile *file, int fd) {
+  bool success;
+  if (file->flags & Z_GROUP_COMMIT) {
+    bool grouped;
+    success =
+        zeugl_group_sync_file(fd, !(file->flags & Z_DURABLE_FULL), &grouped);
+    file->stats.fs_synced = grouped ? 1 : 0;
+  } else if (file->flags & Z_DURABLE_FULL) {
+    success = (fsync(fd) == 0);
+  } else {
+    success = (fdatasync(fd) == 0);
+  }
+
+  if (!success) {
+    LOG_DEBUG("Failed to synchronize file '%s' (fd = %d): %s", file->temp, fd,
+              strerror(errno));
+    return false;
+  }
+  LOG_DEBUG("Synchronized file '%s' (fd = %d)", file->temp, fd);
+  return true;
+}
+
+/**
+ * Flush the directory of the original file to disk after the original file
+ * was replaced.
+ */
+static bool sync_directory(const struct zfile *file) {
+  bool success;
+  if (file->flags & Z_GROUP_COMMIT) {
+    success = zeugl_group_sync_dir(file->dirfd);
+  } else {
+    success = (fsync(file->dirfd) == 0);
+  }
+
+  if (!success) {
+    LOG_DEBUG("Failed to synchronize directory of file '%s' (fd = %d): %s",
+              file->orig, file->dirfd, strerror(errno));
+    return false;
+  }
+  LOG_DEBUG("Synchronized directory of file '%s' (fd = %d)", file->orig,
+            file->dirfd);
+  return true;
+}
+
+/**
+ * Close a temporary file that is not going to be committed and delete it.
+ */
+static bool discard_file(struct zfile *file) {
+  if (file->fd >= 0) {
+    if (close(file->fd) == 0) {
+      LOG_DEBUG("Closed file (fd = %d)", file->fd);
+    } else {
+      LOG_DEBUG("Failed to close file (fd = %d): %s", file->fd,
+                strerror(errno));
+    }
+    file->fd = -1;
+  }
+
+  if (file->anonymous) {
+    LOG_DEBUG("Discarded anonymous temporary file");
+    return true;
+  }
+
+  if (unlinkat(file->dirfd, file->temp + file->base, 0) != 0) {
+    LOG_DEBUG("Failed to delete temporary file '%s': %s", file->temp,
+              strerror(errno));
+    return false;
+  }
+  LOG_DEBUG("Deleted temporary file '%s'", file->temp);
+  return true;
+}
+
+/**
+ * Replace the original file with the closed temporary file.
+ */
+static bool replace_original_file(struct zfile *file) {
+  if (!(file->flags & Z_OPTIMISTIC)) {
+    if (!zeugl_whack_a_mole(file->dirfd, file->orig + file->base,
+                            file->temp + file->base, file->flags & Z_IMMUTABLE,
+                            commit_timeout(file),
+                            (file->flags & Z_NEWEST) ? file->seq : 0,
+                            &file->stats)) {
+      LOG_DEBUG("Failed to execute wack-a-mole algorithm "
+                "(orig = '%s', temp = '%s'): %s",
+                file->orig, file->temp, strerror(errno));
+      return false;
+    }
+    LOG_DEBUG("Successfully executed wack-a-mole algorithm "
+              "(orig = '%s', temp = '%s')",
+              file->orig, file->temp);
+    return true;
+  }
+
+  if (!zeugl_compare_and_swap(file->dirfd, file->orig + file->base,
+                              file->temp + file->base,
+                              file->flags & Z_IMMUTABLE, commit_timeout(file),
+                              &file->fingerprint, &file->stats)) {
+    LOG_DEBUG("Failed to compare and swap original file '%s': %s", file->orig,
+              strerror(errno));
+
+    /* The temporary file may still be there, unlike a whacked mole */
+    int save_errno = errno;
+    if (unlinkat(file->dirfd, file->temp + file->base, 0) == 0) {
+      LOG_DEBUG("Deleted temporary file '%s'", file->temp);
+    }
+    errno = save_errno;
+    return false;
+  }
+  LOG_DEBUG("Compared and swapped original file '%s' with '%s'", file->orig,
+            file->temp);
+  return true;
+}
+
+/**
+ * Commit or abort a file transaction that is not registered (anymore), and
+ * free it.
+ */
+static int file_close(struct zfile *file, bool commit) {
+  int ret = -1;
+  const int fd = file->fd;
+
+  if (commit) {
+    if (!prepare_commit(file, fd)) {
+      goto FAIL;
+    }
+
+    /* Don't bother flushing a file that would be dropped anyway */
+    if ((file->flags & Z_NEWEST) && is_superseded(file)) {
+      file->stats.superseded = 1;
+      if (discard_file(file)) {
+        ret = 0;
+      }
+      goto FAIL;
+    }
+
+    /* Leave the original file alone if the commit would not change it */
+    if ((file->flags & Z_SKIP_IDENTICAL) && is_identical(file, fd)) {
+      file->stats.identical = 1;
+      if (discard_file(file)) {
+        ret = 0;
+      }
+      goto FAIL;
+    }
+
+    /* Make sure the content is on disk before it can replace the original
+     * file. Otherwise a crash can leave the new file empty. */
+    if ((file->flags & (Z_DURABLE_DATA | Z_DURABLE_FULL)) &&
+        !sync_file(file, fd)) {
+      goto FAIL;
+    }
+
+#ifdef O_TMPFILE
+    /* The file needs a name before it can replace the original file */
+    if (file->anonymous && !link_anonymous_file(file, fd)) {
+      goto FAIL;
+    }
+#endif /* O_TMPFILE */
+  }
+
+  /* We don't need the file descriptor anymore */
+  file->fd = -1;
+  if (close(fd) != 0) {
+    LOG_DEBUG("Failed to close file (fd = %d): %s", fd, strerror(errno));
+    goto FAIL;
+  }
+  LOG_DEBUG("Closed file (fd = %d)", fd);
+
+  if (commit) {
+    if (!replace_original_file(file)) {
+      goto FAIL;
+    }
+
+    /* Make the rename itself survive a crash */
+    if ((file->flags & Z_DURABLE_FULL) && !sync_directory(file)) {
+      goto FAIL;
+    }
+  } else {
+    LOG_DEBUG("Aborting file transaction");
+    if (file->anonymous) {
+      LOG_DEBUG("Discarded anonymous temporary file");
+    } else {
+      if (unlinkat(file->dirfd, file->temp + file->base, 0) != 0) {
+        LOG_DEBUG("Failed to delete temporary file '%s': %s", file->temp,
+                  strerror(errno));
+        goto FAIL;
+      }
+      LOG_DEBUG("Deleted temporary file '%s'", file->temp);
+    }
+  }
+
+  ret = 0;
+FAIL:
+  if (file->fd >= 0) {
+    /* We failed before we got to close the file descriptor */
+    int save_errno = errno;
+    if (close(file->fd) == 0) {
+      LOG_DEBUG("Closed file (fd = %d)", file->fd);
+    } else {
+      LOG_DEBUG("Failed to close file (fd = %d): %s", file->fd,
+                strerror(errno));
+    }
+    errno = save_errno;
   }
 
+  LAST_STATS = file->stats;
+  file_free(file);
   return ret;
 }
+
+int zclose(int fd, bool commit) {
+  /* Consider -1 a no-op */
+  if (fd == -1) {
+    return 0;
+  }
+
+  /* Taking the file out of the registry makes the transaction ours, even if
+   * other threads try to close the same file descriptor */
+  LOG_DEBUG("Looking for file with matching file descriptor %d...", fd);
+  struct zfile *file = zeugl_registry_take(fd);
+  if (file == NULL) {
+    LOG_DEBUG("Did not find a file with matching file descriptor (fd = %d): "
+              "This file was not opened with zopen()",
+              fd);
+    /* This file was not opened with zopen(). Hence, no need to perform the
+     * wack-a-mole. */
+    errno = EINVAL;
+    return -1;
+  }
+  LOG_DEBUG("Found file '%s' with matching file descriptor (fd = %d): "
+            "This file was opened with zopen()",
+            file->temp, file->fd);
+
+  if (file->group != NULL) {
+    LOG_DEBUG("File '%s' (fd = %d) belongs to a transaction group: "
+              "Use zgroup_commit() or zgroup_abort()",
+              file->temp, file->fd);
+    if (!zeugl_registry_add(fd, file)) {
+      LOG_DEBUG("Failed to register open file (fd = %d) again: %s", fd,
+                strerror(errno));
+    }
+    errno = EINVAL;
+    return -1;
+  }
+
+  return file_close(file, commit);
+}
+
+int zreplace(const char *fname, const struct iovec *iov, int iovcnt, int flags,
+             mode_t mode) {
+  /* Flags with optional arguments and Z_APPEND make no sense here */
+  if ((fname == NULL) || (iovcnt < 0) || ((iov == NULL) && (iovcnt > 0)) ||
+      (flags & (Z_APPEND | Z_SIZEHINT | Z_TIMEOUT))) {
+    LOG_DEBUG("Invalid arguments to zreplace() (iovcnt = %d, flags = 0x%08x)",
+              iovcnt, flags);
+    errno = EINVAL;
+    return -1;
+  }
+
+  const struct open_args args = {
+      .mode = (int)(mode & 0777), /* Don't keep user bit */
+      .size_hint = 0,
+      .timeout = (flags & Z_NOBLOCK) ? 0 : ZEUGL_LOCK_FOREVER,
+      .force_mode = true,
+  };
+  struct zfile *file =
+      file_begin(fname, flags | Z_CREATE | Z_TRUNCATE, &args, NULL);
+  if (file == NULL) {
+    return -1;
+  }
+
+  /* Nobody else gets to see the file descriptor, so the transaction is only
+   * registered for the cleanup handlers to remove a named temporary file.
+   * An anonymous one disappears by itself. */
+  const bool registered = !file->anonymous;
+  if (registered && !register_file(file)) {
+    file_abort(file);
+    return -1;
+  }
+
+  const bool written = zeugl_writev(file->fd, iov, iovcnt);
+  if (registered) {
+    zeugl_registry_take(file->fd);
+  }
+  if (!written) {
+    LOG_DEBUG("Failed to write temporary file '%s' (fd = %d): %s", file->temp,
+              file->fd, strerror(errno));
+    file_abort(file);
+    return -1;
+  }
+  LOG_DEBUG("Wrote %d buffers to temporary file '%s' (fd = %d)", iovcnt,
+            file->temp, file->fd);
+
+  return file_close(file, true);
+}
+
+/* Suffixes of the intent record of a transaction group, while its members are
+ * prepared and once the group is committed */
+#define GROUP_PREPARED ".zgp"
+#define GROUP_COMMITTED ".zgc"
+
+/* First line of an intent record. Each following line holds the temporary
+ * filename and the original filename of a member, separated by a tab. */
+#define GROUP_HEADER "zeugl-group 2"
+
+struct zgroup {
+  char record[PATH_MAX]; /* Intent record, without suffix */
+  size_t base;           /* Offset of the filename in record */
+  int dirfd;             /* Directory of the intent record */
+  int fd;                /* Prepared intent record */
+  int flags;
+  struct zfile **members;
+  size_t num_members;
+  size_t max_members;
+};
+
+static void record_name(const struct zgroup *group, const char *suffix,
+                        char *name) {
+  stpcpy(stpcpy(name, group->record + group->base), suffix);
+}
+
+/**
+ * Make a path absolute, so that the intent record can be recovered from any
+ * working directory.
+ */
+static bool absolute_path(const char *path, char *abs) {
+  if (path[0] == '/') {
+    strcpy(abs, path);
+    return true;
+  }
+
+  if (getcwd(abs, PATH_MAX) == NULL) {
+    LOG_DEBUG("Failed to get working directory: %s", strerror(errno));
+    return false;
+  }
+
+  const size_t len = strlen(abs);
+  if (len + strlen("/") + strlen(path) >= PATH_MAX) {
+    LOG_DEBUG("Absolute path of '%s' is too long", path);
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  abs[len] = '/';
+  strcpy(abs + len + 1, path);
+  return true;
+}
+
+/**
+ * Record a new member in the prepared intent record, so that its temporary
+ * file can be recovered.
+ */
+static bool group_add(struct zgroup *group, struct zfile *file) {
+  char orig[PATH_MAX];
+  char temp[PATH_MAX];
+  if (!absolute_path(file->orig, orig) || !absolute_path(file->temp, temp)) {
+    return false;
+  }
+
+  if (group->num_members == group->max_members) {
+    size_t max_members =
+        (group->max_members == 0) ? 4 : 2 * group->max_members;
+    struct zfile **members =
+        realloc(group->members, max_members * sizeof(struct zfile *));
+    if (members == NULL) {
+      LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+      return false;
+    }
+    group->members = members;
+    group->max_members = max_members;
+  }
+
+  if (dprintf(group->fd, "%s\t%s\n", temp, orig) < 0) {
+    LOG_DEBUG("Failed to write intent record '%s" GROUP_PREPARED "': %s",
+              group->record, strerror(errno));
+    return false;
+  }
+
+  group->members[group->num_members++] = file;
+  LOG_DEBUG("Added file '%s' to transaction group '%s'", file->orig,
+            group->record);
+  return true;
+}
+
+static void group_free(struct zgroup *group) {
+  for (size_t i = 0; i < group->num_members; i++) {
+    file_free(group->members[i]);
+  }
+  free(group->members);
+  zeugl_dircache_close(group->dirfd);
+  free(group);
+}
+
+/**
+ * Remove the temporary files of all members and the prepared intent record.
+ */
+static void group_rollback(struct zgroup *group) {
+  for (size_t i = 0; i < group->num_members; i++) {
+    struct zfile *file = group->members[i];
+    zeugl_registry_take(file->fd);
+    discard_file(file);
+  }
+
+  if (group->fd >= 0) {
+    close(group->fd);
+    group->fd = -1;
+  }
+
+  char name[PATH_MAX];
+  record_name(group, GROUP_PREPARED, name);
+  if (unlinkat(group->dirfd, name, 0) == 0) {
+    LOG_DEBUG("Deleted intent record '%s" GROUP_PREPARED "'", group->record);
+  } else {
+    LOG_DEBUG("Failed to delete intent record '%s" GROUP_PREPARED "': %s",
+              group->record, strerror(errno));
+  }
+}
+
+struct zgroup *zgroup_begin(const char *record, int flags) {
+  assert(record != NULL);
+
+  if (strlen(record) + strlen(GROUP_PREPARED) >= PATH_MAX) {
+    LOG_DEBUG("Intent record name '%s' is too long", record);
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+
+  struct zgroup *group = calloc(1, sizeof(struct zgroup));
+  if (group == NULL) {
+    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+    return NULL;
+  }
+  strcpy(group->record, record);
+  group->flags = flags;
+  group->fd = -1;
+
+  struct stat sb;
+  group->dirfd = open_parent(group->record, &group->base, &sb);
+  if (group->dirfd < 0) {
+    goto FAIL;
+  }
+
+  /* Only one group at a time can prepare an intent record */
+  char name[PATH_MAX];
+  record_name(group, GROUP_PREPARED, name);
+  group->fd = openat(group->dirfd, name,
+                     O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+                     (mode_t)0600);
+  if (group->fd < 0) {
+    LOG_DEBUG("Failed to create intent record '%s" GROUP_PREPARED "': %s",
+              group->record, strerror(errno));
+    goto FAIL;
+  }
+  LOG_DEBUG("Created intent record '%s" GROUP_PREPARED "' (fd = %d)",
+            group->record, group->fd);
+
+  /* A committed group that was never finished must be recovered first */
+  record_name(group, GROUP_COMMITTED, name);
+  if (fstatat(group->dirfd, name, &sb, 0) == 0) {
+    LOG_DEBUG("Intent record '%s" GROUP_COMMITTED "' must be recovered first",
+              group->record);
+    errno = EEXIST;
+    goto FAIL;
+  }
+
+  if (dprintf(group->fd, GROUP_HEADER "\n") < 0) {
+    LOG_DEBUG("Failed to write intent record '%s" GROUP_PREPARED "': %s",
+              group->record, strerror(errno));
+    goto FAIL;
+  }
+
+  return group;
+
+FAIL:;
+  int save_errno = errno;
+  if (group->fd >= 0) {
+    group_rollback(group);
+  }
+  group_free(group);
+  errno = save_errno;
+  return NULL;
+}
+
+int zgroup_open(struct zgroup *group, const char *fname, int flags, ...) {
+  assert(group != NULL);
+  assert(fname != NULL);
+
+  struct open_args args;
+  va_list ap;
+  va_start(ap, flags);
+  optional_args(flags, ap, &args);
+  va_end(ap);
+
+  /* Members are replaced after the commit point, when they can't fail or be
+   * left out anymore on their own */
+  if (flags & (Z_OPTIMISTIC | Z_SKIP_IDENTICAL)) {
+    LOG_DEBUG("Z_OPTIMISTIC and Z_SKIP_IDENTICAL are not supported in "
+              "transaction groups");
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* The intent record is line based */
+  if (strpbrk(fname, "\t\n") != NULL) {
+    LOG_DEBUG("Filename '%s' cannot be part of a transaction group", fname);
+    errno = EINVAL;
+    return -1;
+  }
+
+  flags |= group->flags & (Z_DURABLE_DATA | Z_DURABLE_FULL);
+  return file_open(fname, flags, &args, group);
+}
+
+/**
+ * Report the first error in an array of errors, as zclose_many() does.
+ */
+static int first_error(const int *errors, size_t num_errors) {
+  for (size_t i = 0; i < num_errors; i++) {
+    if (errors[i] != 0) {
+      errno = errors[i];
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static bool is_durable(const struct zfile *file) {
+  return (file != NULL) && (file->flags & (Z_DURABLE_DATA | Z_DURABLE_FULL));
+}
+
+#ifdef HAVE_SYNCFS
+/**
+ * A filesystem flushed by sync_files(), found by the device of its first file.
+ */
+struct flushed_fs {
+  bool known; /* Whether the device of the file is known */
+  dev_t dev;
+  int error; /* Error of syncfs(2) on the filesystem, zero on success */
+};
+#endif /* HAVE_SYNCFS */
+
+/**
+ * Flush the durable ones of several temporary files to disk, with one flush
+ * per filesystem where possible. Files that are NULL are skipped. The errors
+ * array is filled in for each durable file, with zero if it was flushed or
+ * with errno if it was not. Returns true if all of them were flushed.
+ */
+static bool sync_files(struct zfile *const *files, int *errors,
+                       size_t num_files) {
+  bool success = true;
+#ifdef HAVE_SYNCFS
+  struct flushed_fs *fs = calloc(num_files, sizeof(struct flushed_fs));
+  if (fs == NULL) {
+    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+    for (size_t i = 0; i < num_files; i++) {
+      if (is_durable(files[i])) {
+        errors[i] = errno;
+      }
+    }
+    return false;
+  }
+
+  for (size_t i = 0; i < num_files; i++) {
+    struct zfile *file = files[i];
+    if (!is_durable(file)) {
+      continue;
+    }
+
+    struct stat sb;
+    if (fstat(file->fd, &sb) != 0) {
+      LOG_DEBUG("Failed to stat file '%s' (fd = %d): %s", file->temp,
+                file->fd, strerror(errno));
+      errors[i] = errno;
+      success = false;
+      continue;
+    }
+    fs[i].known = true;
+    fs[i].dev = sb.st_dev;
+
+    size_t j = 0;
+    while ((j < i) && !(fs[j].known && (fs[j].dev == fs[i].dev))) {
+      j += 1;
+    }
+    if (j < i) {
+      fs[i].error = fs[j].error;
+    } else if (syncfs(file->fd) != 0) {
+      fs[i].error = errno;
+      LOG_DEBUG("Failed to synchronize filesystem of file '%s' (fd = %d): %s",
+                file->temp, file->fd, strerror(errno));
+    } else {
+      LOG_DEBUG("Synchronized filesystem of file '%s' (fd = %d)", file->temp,
+                file->fd);
+    }
+
+    /* syncfs(2) reports one error for the whole filesystem, so it does not
+     * tell whether this file made it. Flushing the file on its own does. */
+    if (fs[i].error == 0) {
+      file->stats.fs_synced = 1;
+      errors[i] = 0;
+    } else if (sync_file(file, file->fd)) {
+      errors[i] = 0;
+    } else {
+      errors[i] = errno;
+      success = false;
+    }
+  }
+
+  free(fs);
+#else  /* HAVE_SYNCFS */
+  for (size_t i = 0; i < num_files; i++) {
+    struct zfile *file = files[i];
+    if (!is_durable(file)) {
+      continue;
+    }
+
+    if (sync_file(file, file->fd)) {
+      errors[i] = 0;
+    } else {
+      errors[i] = errno;
+      success = false;
+    }
+  }
+#endif /* HAVE_SYNCFS */
+  return success;
+}
+
+/**
+ * Flush the directories of several files to disk, once per directory. The
+ * directory cache hands out the same descriptor for the same directory.
+ */
+static bool sync_directories(struct zfile *const *files, size_t num_files) {
+  for (size_t i = 0; i < num_files; i++) {
+    const struct zfile *file = files[i];
+
+    bool flushed = false;
+    for (size_t j = 0; (j < i) && !flushed; j++) {
+      flushed = (files[j]->dirfd == file->dirfd);
+    }
+    if (!flushed && !sync_directory(file)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int zgroup_commit(struct zgroup *group) {
+  assert(group != NULL);
+
+  int ret = -1;
+  bool committed = false;
+  const bool durable = group->flags & (Z_DURABLE_DATA | Z_DURABLE_FULL);
+
+  /* Taking the members out of the registry makes them ours */
+  for (size_t i = 0; i < group->num_members; i++) {
+    struct zfile *file = group->members[i];
+    zeugl_registry_take(file->fd);
+    if (!prepare_commit(file, file->fd)) {
+      goto FAIL;
+    }
+  }
+
+  /* Flush the content of all members at once. The group fails as a whole,
+   * so the first error will do. */
+  if (durable) {
+    int *errors = calloc(group->num_members + 1, sizeof(int));
+    if (errors == NULL) {
+      LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+      goto FAIL;
+    }
+    const bool flushed =
+        sync_files(group->members, errors, group->num_members);
+    if (!flushed) {
+      first_error(errors, group->num_members);
+    }
+    const int save_errno = errno;
+    free(errors);
+    if (!flushed) {
+      errno = save_errno;
+      goto FAIL;
+    }
+  }
+
+  for (size_t i = 0; i < group->num_members; i++) {
+    struct zfile *file = group->members[i];
+    int fd = file->fd;
+    file->fd = -1;
+    if (close(fd) != 0) {
+      LOG_DEBUG("Failed to close file (fd = %d): %s", fd, strerror(errno));
+      goto FAIL;
+    }
+    LOG_DEBUG("Closed file (fd = %d)", fd);
+  }
+
+  if (durable && (fsync(group->fd) != 0)) {
+    LOG_DEBUG("Failed to synchronize intent record '%s" GROUP_PREPARED
+              "': %s",
+              group->record, strerror(errno));
+    goto FAIL;
+  }
+
+  /* Linking the committed intent record is the commit point. Unlike rename(),
+   * this cannot replace the record of another group. */
+  char prepared[PATH_MAX];
+  char name[PATH_MAX];
+  record_name(group, GROUP_PREPARED, prepared);
+  record_name(group, GROUP_COMMITTED, name);
+  if (linkat(group->dirfd, prepared, group->dirfd, name, 0) != 0) {
+    LOG_DEBUG("Failed to commit intent record '%s': %s", group->record,
+              strerror(errno));
+    goto FAIL;
+  }
+  committed = true;
+  LOG_DEBUG("Committed intent record '%s'", group->record);
+
+  close(group->fd);
+  group->fd = -1;
+  if (unlinkat(group->dirfd, prepared, 0) != 0) {
+    LOG_DEBUG("Failed to delete intent record '%s" GROUP_PREPARED "': %s",
+              group->record, strerror(errno));
+    goto FAIL;
+  }
+
+  if (durable && (fsync(group->dirfd) != 0)) {
+    LOG_DEBUG("Failed to synchronize directory of intent record '%s': %s",
+              group->record, strerror(errno));
+    goto FAIL;
+  }
+
+  /* From here on the group can only be rolled forward. The temporary files
+   * are renamed straight over the original files, since zgroup_recover() only
+   * looks for them at the names in the intent record. */
+  int save_errno = 0;
+  for (size_t i = 0; i < group->num_members; i++) {
+    struct zfile *file = group->members[i];
+    if (!zeugl_replace(file->dirfd, file->orig + file->base,
+                       file->temp + file->base, file->flags & Z_IMMUTABLE,
+                       commit_timeout(file), &file->stats)) {
+      LOG_DEBUG("Failed to replace original file '%s': %s", file->orig,
+                strerror(errno));
+      if (save_errno == 0) {
+        save_errno = errno;
+      }
+    }
+  }
+  if (save_errno != 0) {
+    errno = save_errno;
+    goto FAIL;
+  }
+
+  if (durable && !sync_directories(group->members, group->num_members)) {
+    goto FAIL;
+  }
+
+  if (unlinkat(group->dirfd, name, 0) != 0) {
+    LOG_DEBUG("Failed to delete intent record '%s" GROUP_COMMITTED "': %s",
+              group->record, strerror(errno));
+    goto FAIL;
+  }
+  LOG_DEBUG("Committed transaction group '%s' of %zu files", group->record,
+            group->num_members);
+
+  ret = 0;
+FAIL:;
+  int save = errno;
+  if (!committed) {
+    group_rollback(group);
+  }
+  /* Otherwise the committed intent record is left for zgroup_recover() */
+  group_free(group);
+  errno = save;
+  return ret;
+}
+
+int zgroup_abort(struct zgroup *group) {
+  assert(group != NULL);
+
+  LOG_DEBUG("Aborting transaction group '%s'", group->record);
+  group_rollback(group);
+  group_free(group);
+  return 0;
+}
+
+/**
+ * Flush the directory of a file that was renamed during recovery.
+ */
+static void recover_sync_parent(const char *path) {
+  size_t base;
+  struct stat sb;
+  int dirfd = open_parent(path, &base, &sb);
+  if (dirfd < 0) {
+    return;
+  }
+  if (fsync(dirfd) != 0) {
+    LOG_DEBUG("Failed to synchronize directory of file '%s': %s", path,
+              strerror(errno));
+  }
+  zeugl_dircache_close(dirfd);
+}
+
+int zgroup_recover(const char *record) {
+  assert(record != NULL);
+
+  if (strlen(record) + strlen(GROUP_PREPARED) >= PATH_MAX) {
+    LOG_DEBUG("Intent record name '%s' is too long", record);
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  /* A committed record is rolled forward, a prepared record is rolled back */
+  char committed[PATH_MAX];
+  char prepared[PATH_MAX];
+  stpcpy(stpcpy(committed, record), GROUP_COMMITTED);
+  stpcpy(stpcpy(prepared, record), GROUP_PREPARED);
+
+  bool roll_forward = true;
+  FILE *stream = fopen(committed, "r");
+  if ((stream == NULL) && (errno == ENOENT)) {
+    roll_forward = false;
+    stream = fopen(prepared, "r");
+    if ((stream == NULL) && (errno == ENOENT)) {
+      LOG_DEBUG("Nothing to recover for intent record '%s'", record);
+      return 0;
+    }
+  }
+  if (stream == NULL) {
+    LOG_DEBUG("Failed to open intent record '%s': %s", record,
+              strerror(errno));
+    return -1;
+  }
+  LOG_DEBUG("Rolling %s transaction group '%s'",
+            roll_forward ? "forward" : "back", record);
+
+  int save_errno = 0;
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  while ((len = getline(&line, &size, stream)) > 0) {
+    if (line[len - 1] == '\n') {
+      line[len - 1] = '\0';
+    }
+
+    /* Skip the header, and a member that was only partly recorded */
+    char *tab = strchr(line, '\t');
+    if (tab == NULL) {
+      continue;
+    }
+    *tab = '\0';
+    const char *temp = line;
+    const char *orig = tab + 1;
+
+    if (roll_forward) {
+      /* Members that are already in place have no temporary file left */
+      if (rename(temp, orig) == 0) {
+        LOG_DEBUG("Replaced original file '%s' with '%s'", orig, temp);
+        recover_sync_parent(orig);
+      } else if (errno != ENOENT) {
+        LOG_DEBUG("Failed to replace original file '%s' with '%s': %s", orig,
+                  temp, strerror(errno));
+        save_errno = errno;
+      }
+    } else {
+      if (unlink(temp) == 0) {
+        LOG_DEBUG("Deleted temporary file '%s'", temp);
+      } else if (errno != ENOENT) {
+        LOG_DEBUG("Failed to delete temporary file '%s': %s", temp,
+                  strerror(errno));
+        save_errno = errno;
+      }
+    }
+  }
+  free(line);
+  fclose(stream);
+
+  if (save_errno != 0) {
+    errno = save_errno;
+    return -1;
+  }
+
+  /* The prepared record may still be around if the commit was interrupted */
+  if ((roll_forward && (unlink(committed) != 0) && (errno != ENOENT)) ||
+      ((unlink(prepared) != 0) && (errno != ENOENT))) {
+    LOG_DEBUG("Failed to delete intent record '%s': %s", record,
+              strerror(errno));
+    return -1;
+  }
+
+  LOG_DEBUG("Recovered transaction group '%s'", record);
+  return 0;
+}
+
+/**
+ * Fail a file of zclose_many() and remember why.
+ */
+static void fail_file(struct zfile **files, int *errors, size_t i) {
+  int save_errno = errno;
+  errors[i] = save_errno;
+  discard_file(files[i]);
+  LAST_STATS = files[i]->stats;
+  file_free(files[i]);
+  files[i] = NULL;
+  errno = save_errno;
+}
+
+int zclose_many(const int *fds, int *errors, size_t num_fds, bool commit) {
+  assert((fds != NULL) || (num_fds == 0));
+  assert((errors != NULL) || (num_fds == 0));
+
+  if (!commit) {
+    for (size_t i = 0; i < num_fds; i++) {
+      errors[i] = (zclose(fds[i], false) == 0) ? 0 : errno;
+    }
+    return first_error(errors, num_fds);
+  }
+
+  /* Files that are still being committed are kept in files, and the batches
+   * that share disk flushes are collected in batch */
+  struct zfile **files = calloc(2 * num_fds + 1, sizeof(struct zfile *));
+  if (files == NULL) {
+    LOG_DEBUG("Failed to allocate memory: %s", strerror(errno));
+    return -1;
+  }
+  struct zfile **batch = files + num_fds;
+
+  bool durable = false;
+  for (size_t i = 0; i < num_fds; i++) {
+    errors[i] = 0;
+    if (fds[i] == -1) {
+      continue;
+    }
+
+    files[i] = zeugl_registry_take(fds[i]);
+    if (files[i] == NULL) {
+      LOG_DEBUG("Did not find a file with matching file descriptor (fd = %d): "
+                "This file was not opened with zopen()",
+                fds[i]);
+      errors[i] = EINVAL;
+      continue;
+    }
+
+    if (files[i]->group != NULL) {
+      LOG_DEBUG("File '%s' (fd = %d) belongs to a transaction group: "
+                "Use zgroup_commit() or zgroup_abort()",
+                files[i]->temp, fds[i]);
+      if (!zeugl_registry_add(fds[i], files[i])) {
+        LOG_DEBUG("Failed to register open file (fd = %d) again: %s", fds[i],
+                  strerror(errno));
+      }
+      files[i] = NULL;
+      errors[i] = EINVAL;
+      continue;
+    }
+    durable = durable || is_durable(files[i]);
+  }
+
+  /* Without durable files there are no flushes to share, and committing the
+   * files one by one is cheaper */
+  if (!durable) {
+    for (size_t i = 0; i < num_fds; i++) {
+      if ((files[i] != NULL) && (file_close(files[i], true) != 0)) {
+        errors[i] = errno;
+      }
+    }
+    free(files);
+    return first_error(errors, num_fds);
+  }
+
+  for (size_t i = 0; i < num_fds; i++) {
+    if (files[i] == NULL) {
+      continue;
+    }
+
+    if (!prepare_commit(files[i], fds[i])) {
+      fail_file(files, errors, i);
+    } else if ((files[i]->flags & Z_NEWEST) && is_superseded(files[i])) {
+      /* Don't bother flushing a file that would be dropped anyway. Dropping
+       * the commit counts as success. */
+      files[i]->stats.superseded = 1;
+      errno = 0;
+      fail_file(files, errors, i);
+    } else if ((files[i]->flags & Z_SKIP_IDENTICAL) &&
+               is_identical(files[i], fds[i])) {
+      /* Same for a file that would not change */
+      files[i]->stats.identical = 1;
+      errno = 0;
+      fail_file(files, errors, i);
+    }
+  }
+
+  /* Flush the content of all durable files at once. A filesystem that fails
+   * to flush only fails its own files. */
+  if (!sync_files(files, errors, num_fds)) {
+    for (size_t i = 0; i < num_fds; i++) {
+      if ((files[i] != NULL) && (errors[i] != 0)) {
+        errno = errors[i];
+        fail_file(files, errors, i);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < num_fds; i++) {
+    struct zfile *file = files[i];
+    if (file == NULL) {
+      continue;
+    }
+
+#ifdef O_TMPFILE
+    /* The file needs a name before it can replace the original file */
+    if (file->anonymous && !link_anonymous_file(file, file->fd)) {
+      fail_file(files, errors, i);
+      continue;
+    }
+#endif /* O_TMPFILE */
+
+    int fd = file->fd;
+    file->fd = -1;
+    if (close(fd) != 0) {
+      LOG_DEBUG("Failed to close file (fd = %d): %s", fd, strerror(errno));
+      fail_file(files, errors, i);
+      continue;
+    }
+    LOG_DEBUG("Closed file (fd = %d)", fd);
+
+    if (!replace_original_file(file)) {
+      fail_file(files, errors, i);
+      continue;
+    }
+  }
+
+  /* Flush each directory once */
+  size_t batch_size = 0;
+  for (size_t i = 0; i < num_fds; i++) {
+    if ((files[i] != NULL) && (files[i]->flags & Z_DURABLE_FULL)) {
+      batch[batch_size++] = files[i];
+    }
+  }
+  if ((batch_size > 0) && !sync_directories(batch, batch_size)) {
+    /* The files are already in place, so there is nothing to discard */
+    for (size_t i = 0; i < num_fds; i++) {
+      for (size_t j = 0; (files[i] != NULL) && (j < batch_size); j++) {
+        if (files[i] == batch[j]) {
+          errors[i] = errno;
+        }
+      }
+    }
+  }
+
+  for (size_t i = 0; i < num_fds; i++) {
+    if (files[i] != NULL) {
+      LAST_STATS = files[i]->stats;
+      file_free(files[i]);
+    }
+  }
+  free(files);
+
+  return first_error(errors, num_fds);
+}
+
+void *zmap(int fd, size_t *length) {
+  assert(length != NULL);
+
+  struct zfile *file = zeugl_registry_get(fd);
+  if (file == NULL) {
+    LOG_DEBUG("Did not find a file with matching file descriptor (fd = %d): "
+              "This file was not opened with zopen()",
+              fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (file->map != NULL) {
+    *length = file->map_length;
+    return file->map;
+  }
+
+  struct stat sb;
+  if (fstat(file->fd, &sb) != 0) {
+    LOG_DEBUG("Failed to stat temporary file '%s' (fd = %d): %s", file->temp,
+              file->fd, strerror(errno));
+    return NULL;
+  }
+  if (sb.st_size == 0) {
+    /* An empty mapping is not a thing, see zremap() */
+    LOG_DEBUG("Temporary file '%s' (fd = %d) is empty: Not mapping it",
+              file->temp, file->fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((uintmax_t)sb.st_size > SIZE_MAX) {
+    LOG_DEBUG("Temporary file '%s' (fd = %d) is too large to map", file->temp,
+              file->fd);
+    errno = EFBIG;
+    return NULL;
+  }
+
+  const size_t size = (size_t)sb.st_size;
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+  if (map == MAP_FAILED) {
+    LOG_DEBUG("Failed to map temporary file '%s' (fd = %d): %s", file->temp,
+              file->fd, strerror(errno));
+    return NULL;
+  }
+  LOG_DEBUG("Mapped %zu bytes of temporary file '%s' (fd = %d)", size,
+            file->temp, file->fd);
+
+  file->map = map;
+  file->map_length = size;
+  *length = size;
+  return map;
+}
+
+/**
+ * Move or create the mapping of the temporary file to cover length bytes.
+ */
+static void *move_mapping(struct zfile *file, size_t length) {
+  if (file->map == NULL) {
+    return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+  }
+
+#ifdef HAVE_MREMAP
+  return mremap(file->map, file->map_length, length, MREMAP_MAYMOVE);
+#else
+  void *map =
+      mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+  if ((map != MAP_FAILED) && (munmap(file->map, file->map_length) != 0)) {
+    LOG_DEBUG("Failed to unmap temporary file '%s': %s", file->temp,
+              strerror(errno));
+  }
+  return map;
+#endif /* HAVE_MREMAP */
+}
+
+void *zremap(int fd, size_t length) {
+  struct zfile *file = zeugl_registry_get(fd);
+  if ((file == NULL) || (length == 0) || (length > (uintmax_t)INTMAX_MAX)) {
+    LOG_DEBUG("Invalid arguments to zremap() (fd = %d, length = %zu)", fd,
+              length);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if ((file->map != NULL) && (file->map_length == length)) {
+    return file->map;
+  }
+
+  struct stat sb;
+  if (fstat(file->fd, &sb) != 0) {
+    LOG_DEBUG("Failed to stat temporary file '%s' (fd = %d): %s", file->temp,
+              file->fd, strerror(errno));
+    return NULL;
+  }
+
+  /* Grow the file before the mapping, so that no page of the mapping lies
+   * beyond End-of-File. Reserve the disk space, so that a full disk fails
+   * here rather than with SIGBUS on a store. */
+  const off_t size = (off_t)length;
+  if (size > sb.st_size) {
+    if (!zeugl_preallocate(file->fd, size)) {
+      LOG_DEBUG("Failed to reserve %jd bytes for temporary file '%s': %s",
+                (intmax_t)size, file->temp, strerror(errno));
+      return NULL;
+    }
+    file->reserved = true;
+
+    if (ftruncate(file->fd, size) != 0) {
+      LOG_DEBUG("Failed to grow temporary file '%s' to %jd bytes: %s",
+                file->temp, (intmax_t)size, strerror(errno));
+      return NULL;
+    }
+  }
+
+  void *map = move_mapping(file, length);
+  if (map == MAP_FAILED) {
+    LOG_DEBUG("Failed to map %zu bytes of temporary file '%s': %s", length,
+              file->temp, strerror(errno));
+    return NULL;
+  }
+  file->map = map;
+  file->map_length = length;
+
+  /* Shrink the file after the mapping */
+  if ((size < sb.st_size) && (ftruncate(file->fd, size) != 0)) {
+    LOG_DEBUG("Failed to shrink temporary file '%s' to %jd bytes: %s",
+              file->temp, (intmax_t)size, strerror(errno));
+    return NULL;
+  }
+
+  LOG_DEBUG("Mapped %zu bytes of temporary file '%s' (fd = %d)", length,
+            file->temp, file->fd);
+  return map;
+}
+
+int zsuperseded(int fd) {
+  struct zfile *file = zeugl_registry_get(fd);
+  if (file == NULL) {
+    LOG_DEBUG("Did not find a file with matching file descriptor (fd = %d): "
+              "This file was not opened with zopen()",
+              fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  return is_superseded(file) ? 1 : 0;
+}
+
+void zstats(struct zstats *stats) {
+  assert(stats != NULL);
+  *stats = LAST_STATS;
+}
@@ -0,0 +1,145 @@
+#include "config.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Open a transaction on each file and write its number into it */
+static bool open_files(const char *dirname, int *fds, long num_files,
+                       int flags) {
+  char path[PATH_MAX];
+  for (long i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/file-%ld", dirname, i);
+    fds[i] = zopen(path, Z_CREATE | Z_TRUNCATE | flags, 0644);
+    if (fds[i] < 0) {
+      fprintf(stderr, "Failed to open file '%s': %s\n", path, strerror(errno));
+      return false;
+    }
+    if (dprintf(fds[i], "%ld\n", i) < 0) {
+      fprintf(stderr, "Failed to write file '%s': %s\n", path, strerror(errno));
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Check that each file holds its number */
+static bool check_files(const char *dirname, long num_files) {
+  char path[PATH_MAX];
+  for (long i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/file-%ld", dirname, i);
+    FILE *stream = fopen(path, "r");
+    long value = -1;
+    if ((stream == NULL) || (fscanf(stream, "%ld", &value) != 1) ||
+        (value != i)) {
+      fprintf(stderr, "Unexpected content in file '%s'\n", path);
+      if (stream != NULL) {
+        fclose(stream);
+      }
+      return false;
+    }
+    fclose(stream);
+  }
+  return true;
+}
+
+static void empty_directory(const char *dirname, long num_files) {
+  char path[PATH_MAX];
+  for (long i = 0; i < num_files; i++) {
+    snprintf(path, sizeof(path), "%s/file-%ld", dirname, i);
+    unlink(path);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s DIRECTORY [NUM_FILES]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char *dirname = argv[1];
+  const long num_files = (argc > 2) ? atol(argv[2]) : 5000;
+  if (num_files <= 0) {
+    fprintf(stderr, "Bad argument: Expected a positive number of files\n");
+    return EXIT_FAILURE;
+  }
+
+  if ((mkdir(dirname, (mode_t)0755) != 0) && (errno != EEXIST)) {
+    fprintf(stderr, "Failed to create directory '%s': %s\n", dirname,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  int *fds = calloc((size_t)num_files, sizeof(int));
+  int *errors = calloc((size_t)num_files, sizeof(int));
+  if ((fds == NULL) || (errors == NULL)) {
+    perror("calloc");
+    return EXIT_FAILURE;
+  }
+
+  const struct {
+    const char *name;
+    int flags;
+  } levels[] = {
+      {"none", 0},
+      {"data", Z_DURABLE_DATA},
+      {"full", Z_DURABLE_FULL},
+  };
+
+  int ret = EXIT_FAILURE;
+  printf("%-10s %16s %16s\n", "durability", "zclose usec", "zclose_many usec");
+  for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+    /* One zclose() per file */
+    if (!open_files(dirname, fds, num_files, levels[l].flags)) {
+      goto FAIL;
+    }
+    double start = now();
+    for (long i = 0; i < num_files; i++) {
+      if (zclose(fds[i], true) != 0) {
+        fprintf(stderr, "Failed to commit file: %s\n", strerror(errno));
+        goto FAIL;
+      }
+    }
+    double single = now() - start;
+
+    /* One zclose_many() for all files */
+    if (!open_files(dirname, fds, num_files, levels[l].flags)) {
+      goto FAIL;
+    }
+    start = now();
+    if (zclose_many(fds, errors, (size_t)num_files, true) != 0) {
+      fprintf(stderr, "Failed to commit files: %s\n", strerror(errno));
+      goto FAIL;
+    }
+    double many = now() - start;
+
+    if (!check_files(dirname, num_files)) {
+      goto FAIL;
+    }
+
+    printf("%-10s %16.1f %16.1f\n", levels[l].name,
+           single * 1e6 / (double)num_files, many * 1e6 / (double)num_files);
+  }
+
+  ret = EXIT_SUCCESS;
+FAIL:
+  empty_directory(dirname, num_files);
+  rmdir(dirname);
+  free(fds);
+  free(errors);
+  return ret;
+}
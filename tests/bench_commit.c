@@ -0,0 +1,99 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+/* Number of commits measured for each directory size */
+#define COMMITS 1000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Create the empty files with numbers from up to (not including) to */
+static bool fill_directory(const char *dirname, long from, long to) {
+  char path[PATH_MAX];
+  for (long i = from; i < to; i++) {
+    snprintf(path, sizeof(path), "%s/entry-%ld", dirname, i);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, (mode_t)0644);
+    if (fd < 0) {
+      return false;
+    }
+    close(fd);
+  }
+  return true;
+}
+
+static void empty_directory(const char *dirname, long num_entries) {
+  char path[PATH_MAX];
+  for (long i = 0; i < num_entries; i++) {
+    snprintf(path, sizeof(path), "%s/entry-%ld", dirname, i);
+    unlink(path);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s DIRECTORY [MAX_ENTRIES]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char *dirname = argv[1];
+  const long max_entries = (argc > 2) ? atol(argv[2]) : 1000000;
+  if (max_entries <= 0) {
+    fprintf(stderr, "Bad argument: Expected a positive number of entries\n");
+    return EXIT_FAILURE;
+  }
+
+  if ((mkdir(dirname, (mode_t)0755) != 0) && (errno != EEXIST)) {
+    fprintf(stderr, "Failed to create directory '%s': %s\n", dirname,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s/target", dirname);
+
+  printf("%10s %14s\n", "entries", "usec/commit");
+  long num_entries = 0;
+  for (long target = 10; target <= max_entries; target *= 10) {
+    if (!fill_directory(dirname, num_entries, target)) {
+      fprintf(stderr, "Failed to fill directory '%s': %s\n", dirname,
+              strerror(errno));
+      empty_directory(dirname, num_entries);
+      return EXIT_FAILURE;
+    }
+    num_entries = target;
+
+    double start = now();
+    for (int i = 0; i < COMMITS; i++) {
+      int fd = zopen(filename, Z_CREATE | Z_TRUNCATE, 0644);
+      if ((fd < 0) || (zclose(fd, true) != 0)) {
+        fprintf(stderr, "Failed to commit file '%s': %s\n", filename,
+                strerror(errno));
+        empty_directory(dirname, num_entries);
+        return EXIT_FAILURE;
+      }
+    }
+    double elapsed = now() - start;
+
+    printf("%10ld %14.1f\n", num_entries, elapsed * 1e6 / COMMITS);
+  }
+
+  empty_directory(dirname, num_entries);
+  unlink(filename);
+  rmdir(dirname);
+  return EXIT_SUCCESS;
+}
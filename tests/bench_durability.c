@@ -0,0 +1,80 @@
+#include "config.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+/* Size of the content written in each transaction */
+#define CONTENT_SIZE 4096
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static bool transaction(const char *filename, int flags) {
+  static char content[CONTENT_SIZE];
+  memset(content, 'z', sizeof(content));
+
+  int fd = zopen(filename, Z_CREATE | Z_TRUNCATE | flags, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  if (write(fd, content, sizeof(content)) != (ssize_t)sizeof(content)) {
+    int save_errno = errno;
+    zclose(fd, false);
+    errno = save_errno;
+    return false;
+  }
+
+  return zclose(fd, true) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s FILENAME [COMMITS]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char *filename = argv[1];
+  const long num_commits = (argc > 2) ? atol(argv[2]) : 100;
+  if (num_commits <= 0) {
+    fprintf(stderr, "Bad argument: Expected a positive number of commits\n");
+    return EXIT_FAILURE;
+  }
+
+  static const struct {
+    const char *name;
+    int flags;
+  } levels[] = {
+      {"none", 0},
+      {"data", Z_DURABLE_DATA},
+      {"full", Z_DURABLE_FULL},
+  };
+
+  printf("%6s %14s\n", "level", "usec/commit");
+  for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+    double start = now();
+    for (long j = 0; j < num_commits; j++) {
+      if (!transaction(filename, levels[i].flags)) {
+        fprintf(stderr, "Failed to commit file '%s': %s\n", filename,
+                strerror(errno));
+        return EXIT_FAILURE;
+      }
+    }
+    double elapsed = now() - start;
+
+    printf("%6s %14.1f\n", levels[i].name, elapsed * 1e6 / (double)num_commits);
+  }
+
+  unlink(filename);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+struct thread_data {
+  char filename[PATH_MAX];
+  int flags;
+  long num_commits;
+  unsigned int fs_synced; /* Expected way of flushing each commit */
+  bool success;
+};
+
+/* Group commits flush files with a shared syncfs(2) where there is one, and
+ * otherwise each file on its own, like commits without Z_GROUP_COMMIT */
+#if defined(HAVE_PTHREAD) && defined(HAVE_SYNCFS)
+#define GROUP_FS_SYNCED 1
+#else
+#define GROUP_FS_SYNCED 0
+#endif
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Check that the file holds what the last commit wrote */
+static bool check_content(const char *filename, long expected) {
+  FILE *file = fopen(filename, "r");
+  if (file == NULL) {
+    return false;
+  }
+
+  long actual = -1;
+  bool success = (fscanf(file, "%ld", &actual) == 1) && (actual == expected);
+  fclose(file);
+  return success;
+}
+
+static void *worker(void *arg) {
+  struct thread_data *data = arg;
+  data->success = false;
+
+  for (long i = 0; i < data->num_commits; i++) {
+    int fd = zopen(data->filename, Z_CREATE | Z_TRUNCATE | data->flags, 0644);
+    if (fd < 0) {
+      fprintf(stderr, "Failed to open file '%s': %s\n", data->filename,
+              strerror(errno));
+      return NULL;
+    }
+
+    char content[32];
+    int len = snprintf(content, sizeof(content), "%ld\n", i);
+    if (write(fd, content, (size_t)len) != (ssize_t)len) {
+      fprintf(stderr, "Failed to write file '%s': %s\n", data->filename,
+              strerror(errno));
+      zclose(fd, false);
+      return NULL;
+    }
+
+    if (zclose(fd, true) != 0) {
+      fprintf(stderr, "Failed to commit file '%s': %s\n", data->filename,
+              strerror(errno));
+      return NULL;
+    }
+
+    struct zstats stats;
+    zstats(&stats);
+    if (stats.fs_synced != data->fs_synced) {
+      fprintf(stderr, "Expected file '%s' to be flushed %s\n",
+              data->filename,
+              data->fs_synced ? "by syncfs(2)" : "on its own");
+      return NULL;
+    }
+  }
+
+  data->success = check_content(data->filename, data->num_commits - 1);
+  if (!data->success) {
+    fprintf(stderr, "Unexpected content in file '%s'\n", data->filename);
+  }
+  return NULL;
+}
+
+/* Commit files from a number of threads and return commits per second, or a
+ * negative number on error */
+static double run(const char *dirname, int num_threads, long num_commits,
+                  int flags) {
+  pthread_t threads[num_threads];
+  struct thread_data data[num_threads];
+
+  double start = now();
+  for (int i = 0; i < num_threads; i++) {
+    snprintf(data[i].filename, sizeof(data[i].filename), "%s/file-%d", dirname,
+             i);
+    data[i].flags = flags;
+    data[i].num_commits = num_commits;
+    data[i].fs_synced = (flags & Z_GROUP_COMMIT) ? GROUP_FS_SYNCED : 0;
+    if (pthread_create(&threads[i], NULL, worker, &data[i]) != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  bool success = true;
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+    success &= data[i].success;
+    unlink(data[i].filename);
+  }
+  double elapsed = now() - start;
+
+  return success ? (double)num_threads * (double)num_commits / elapsed : -1.0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s DIRECTORY [MAX_THREADS] [COMMITS]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char *dirname = argv[1];
+  const int max_threads = (argc > 2) ? atoi(argv[2]) : 32;
+  const long num_commits = (argc > 3) ? atol(argv[3]) : 50;
+  if ((max_threads <= 0) || (max_threads > 1024) || (num_commits <= 0)) {
+    fprintf(stderr, "Bad argument: Expected 1 to 1024 threads and a positive "
+                    "number of commits\n");
+    return EXIT_FAILURE;
+  }
+
+  if ((mkdir(dirname, (mode_t)0755) != 0) && (errno != EEXIST)) {
+    fprintf(stderr, "Failed to create directory '%s': %s\n", dirname,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  printf("Grouped commits are flushed %s\n",
+         GROUP_FS_SYNCED ? "by one syncfs(2) per group, without fsync(2)"
+                         : "by fsync(2) of each file");
+  printf("%8s %16s %16s\n", "threads", "commits/s", "grouped/s");
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    double single = run(dirname, num_threads, num_commits, Z_DURABLE_FULL);
+    double grouped = run(dirname, num_threads, num_commits,
+                         Z_DURABLE_FULL | Z_GROUP_COMMIT);
+    if ((single < 0.0) || (grouped < 0.0)) {
+      rmdir(dirname);
+      return EXIT_FAILURE;
+    }
+    printf("%8d %16.0f %16.0f\n", num_threads, single, grouped);
+  }
+
+  rmdir(dirname);
+  return EXIT_SUCCESS;
+}
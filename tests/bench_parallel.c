@@ -0,0 +1,114 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+/* Number of times each thread count is measured */
+#define REPETITIONS 3
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static bool file_fill(const char *filename, size_t num_bytes) {
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, (mode_t)0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  /* The content does not matter, as long as it is not all zeros */
+  static char buffer[BUFFER_SIZE];
+  uint32_t state = 2463534242U;
+  for (size_t i = 0; i < sizeof(buffer); i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    buffer[i] = (char)state;
+  }
+
+  size_t tot_written = 0;
+  while (tot_written < num_bytes) {
+    size_t count = num_bytes - tot_written;
+    ssize_t ret =
+        write(fd, buffer, (count < sizeof(buffer)) ? count : sizeof(buffer));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      return false;
+    }
+    tot_written += (size_t)ret;
+  }
+
+  return close(fd) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s FILENAME SIZE_MIB [MAX_THREADS]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char *filename = argv[1];
+  const long size_mib = atol(argv[2]);
+  const long max_threads = (argc > 3) ? atol(argv[3]) : 8;
+  if ((size_mib <= 0) || (max_threads <= 0)) {
+    fprintf(stderr, "Bad argument: Expected positive numbers\n");
+    return EXIT_FAILURE;
+  }
+
+  const size_t num_bytes = (size_t)size_mib << 20;
+  if (!file_fill(filename, num_bytes)) {
+    fprintf(stderr, "Failed to fill file '%s' with %zu bytes: %s\n", filename,
+            num_bytes, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  printf("%8s %10s %10s\n", "threads", "seconds", "MiB/s");
+  for (long num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    char value[32];
+    snprintf(value, sizeof(value), "%ld", num_threads);
+    setenv("ZEUGL_COPY_THREADS", value, 1);
+
+    double best = 0.0;
+    for (int i = 0; i < REPETITIONS; i++) {
+      double start = now();
+      int fd = zopen(filename, Z_PARALLEL);
+      if (fd < 0) {
+        fprintf(stderr, "Failed to open file '%s': %s\n", filename,
+                strerror(errno));
+        return EXIT_FAILURE;
+      }
+      double elapsed = now() - start;
+
+      /* Abort, so that the original file stays the same between runs */
+      if (zclose(fd, false) != 0) {
+        fprintf(stderr, "Failed to close file '%s': %s\n", filename,
+                strerror(errno));
+        return EXIT_FAILURE;
+      }
+
+      if ((i == 0) || (elapsed < best)) {
+        best = elapsed;
+      }
+    }
+
+    printf("%8ld %10.3f %10.1f\n", num_threads, best,
+           (double)size_mib / best);
+  }
+
+  unlink(filename);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,294 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "zeugl.h"
+
+/* Milliseconds to wait for each lock, so that a lock that is never passed on
+ * fails the benchmark rather than hanging it */
+#define LOCK_TIMEOUT 10000
+
+/* Maximum number of processes incrementing the counter */
+#define MAX_WORKERS 256
+
+struct result {
+  double elapsed; /* Seconds until all increments were committed */
+  long conflicts; /* Commits that failed with ESTALE */
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Read-modify-write the counter num_increments times, or forever if
+ * num_increments is negative. Conflicts are retried. */
+static bool increment(const char *filename, int flags, long num_increments,
+                      struct result *result) {
+  const double start = now();
+  result->conflicts = 0;
+  for (long i = 0; (num_increments < 0) || (i < num_increments);) {
+    int fd = zopen(filename, Z_OPTIMISTIC | Z_TIMEOUT | flags, LOCK_TIMEOUT);
+    char buf[32] = {0};
+    if ((fd < 0) || (read(fd, buf, sizeof(buf) - 1) < 0)) {
+      fprintf(stderr, "Failed to open file '%s': %s\n", filename,
+              strerror(errno));
+      return false;
+    }
+
+    char value[32];
+    const int len = snprintf(value, sizeof(value), "%ld\n", atol(buf) + 1);
+    if ((ftruncate(fd, 0) != 0) || (lseek(fd, 0, SEEK_SET) != 0) ||
+        (write(fd, value, (size_t)len) != len)) {
+      perror("write");
+      zclose(fd, false);
+      return false;
+    }
+
+    if (zclose(fd, true) == 0) {
+      i++;
+    } else if (errno == ESTALE) {
+      result->conflicts++;
+    } else {
+      fprintf(stderr, "Failed to commit file '%s': %s\n", filename,
+              strerror(errno));
+      return false;
+    }
+  }
+  result->elapsed = now() - start;
+  return true;
+}
+
+/* Set or clear the immutable attribute of the counter, where supported */
+static bool set_immutable(const char *filename, bool immutable) {
+#ifdef FS_IOC_SETFLAGS
+  int fd = open(filename, O_RDONLY);
+  int attr;
+  if ((fd < 0) || (ioctl(fd, FS_IOC_GETFLAGS, &attr) != 0)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  attr = immutable ? (attr | FS_IMMUTABLE_FL) : (attr & ~FS_IMMUTABLE_FL);
+  const bool success = (ioctl(fd, FS_IOC_SETFLAGS, &attr) == 0);
+  close(fd);
+  return success;
+#else  /* FS_IOC_SETFLAGS */
+  (void)filename;
+  (void)immutable;
+  return false;
+#endif /* FS_IOC_SETFLAGS */
+}
+
+static bool is_immutable(const char *filename) {
+#ifdef FS_IOC_GETFLAGS
+  int fd = open(filename, O_RDONLY);
+  int attr = 0;
+  const bool success = (fd >= 0) && (ioctl(fd, FS_IOC_GETFLAGS, &attr) == 0);
+  if (fd >= 0) {
+    close(fd);
+  }
+  return success && (attr & FS_IMMUTABLE_FL);
+#else  /* FS_IOC_GETFLAGS */
+  (void)filename;
+  return false;
+#endif /* FS_IOC_GETFLAGS */
+}
+
+/* Fork a process incrementing the counter, reporting its result to pipefd */
+static pid_t spawn(const char *filename, int flags, long num_increments,
+                   int pipefd) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    struct result result;
+    if (!increment(filename, flags, num_increments, &result) ||
+        (write(pipefd, &result, sizeof(result)) != sizeof(result))) {
+      _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+  }
+  if (pid < 0) {
+    perror("fork");
+  }
+  return pid;
+}
+
+/* Increment the counter from num_workers processes, every other one of which
+ * uses odd_flags instead of flags */
+static bool run(const char *name, const char *filename, int flags,
+                int odd_flags, long num_workers, long num_increments,
+                long num_victims) {
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ((fd < 0) || (write(fd, "0\n", 2) != 2) || (close(fd) != 0)) {
+    perror("open");
+    return false;
+  }
+  if ((flags & Z_IMMUTABLE) && !set_immutable(filename, true)) {
+    perror("set_immutable");
+    return false;
+  }
+
+  int pipefd[2];
+  if (pipe(pipefd) != 0) {
+    perror("pipe");
+    return false;
+  }
+
+  bool success = true;
+  pid_t workers[MAX_WORKERS];
+  long spawned = 0;
+  for (; spawned < num_workers; spawned++) {
+    workers[spawned] = spawn(filename, (spawned % 2) ? odd_flags : flags,
+                             num_increments, pipefd[1]);
+    if (workers[spawned] < 0) {
+      success = false;
+      break;
+    }
+  }
+
+  /* Victims increment the counter until they are killed, possibly while
+   * holding a lock */
+  for (long i = 0; success && (i < num_victims); i++) {
+    pid_t victim = spawn(filename, flags, -1, pipefd[1]);
+    if (victim < 0) {
+      success = false;
+      break;
+    }
+    usleep((useconds_t)(rand() % 5000));
+    kill(victim, SIGKILL);
+    waitpid(victim, NULL, 0);
+  }
+  close(pipefd[1]);
+
+  double fastest = 0.0, slowest = 0.0;
+  long conflicts = 0;
+  for (long i = 0; i < spawned; i++) {
+    int status;
+    if ((waitpid(workers[i], &status, 0) != workers[i]) ||
+        !WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+      fprintf(stderr, "Worker process %ld failed\n", i);
+      success = false;
+      continue;
+    }
+
+    struct result result;
+    if (read(pipefd[0], &result, sizeof(result)) != sizeof(result)) {
+      perror("read");
+      success = false;
+      continue;
+    }
+    if ((i == 0) || (result.elapsed < fastest)) {
+      fastest = result.elapsed;
+    }
+    if ((i == 0) || (result.elapsed > slowest)) {
+      slowest = result.elapsed;
+    }
+    conflicts += result.conflicts;
+  }
+  close(pipefd[0]);
+
+  /* Each commit restores the attribute before the next one may clear it */
+  if (flags & Z_IMMUTABLE) {
+    if (!is_immutable(filename)) {
+      fprintf(stderr, "File '%s' lost its immutable attribute\n", filename);
+      success = false;
+    }
+    set_immutable(filename, false);
+  }
+  if (!success) {
+    return false;
+  }
+
+  /* Victims may have committed increments of their own */
+  FILE *stream = fopen(filename, "r");
+  long value = -1;
+  if ((stream == NULL) || (fscanf(stream, "%ld", &value) != 1)) {
+    fprintf(stderr, "Failed to read file '%s'\n", filename);
+    if (stream != NULL) {
+      fclose(stream);
+    }
+    return false;
+  }
+  fclose(stream);
+  const long expected = num_workers * num_increments;
+  if ((value < expected) || ((num_victims == 0) && (value != expected))) {
+    fprintf(stderr, "Expected counter %ld, got %ld\n", expected, value);
+    return false;
+  }
+
+  printf("%-10s %16.1f %16.2f %16.2f\n", name,
+         slowest * 1e6 / (double)expected,
+         (double)conflicts / (double)expected, slowest / fastest);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: %s FILENAME [NUM_PROCESSES] [NUM_INCREMENTS] "
+            "[NUM_VICTIMS] [immutable]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char *filename = argv[1];
+  const long num_workers = (argc > 2) ? atol(argv[2]) : 16;
+  const long num_increments = (argc > 3) ? atol(argv[3]) : 200;
+  const long num_victims = (argc > 4) ? atol(argv[4]) : 0;
+  if ((num_workers <= 0) || (num_workers > MAX_WORKERS) ||
+      (num_increments <= 0) || (num_victims < 0)) {
+    fprintf(stderr,
+            "Bad argument: Expected 1 to %d processes, a positive number of "
+            "increments and a non-negative number of victims\n",
+            MAX_WORKERS);
+    return EXIT_FAILURE;
+  }
+
+  /* Commits with Z_IMMUTABLE clear and restore the attribute of the counter,
+   * so those with Z_SHMLOCK must still be serialized with those without */
+  const bool immutable = (argc > 5) && (strcmp(argv[5], "immutable") == 0);
+  if (immutable) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    const bool supported = (fd >= 0) && set_immutable(filename, true) &&
+                           set_immutable(filename, false);
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (!supported) {
+      fprintf(stderr, "Immutable attribute is not supported here: %s\n",
+              strerror(errno));
+      unlink(filename);
+      return 77;
+    }
+  }
+
+  printf("%-10s %16s %16s %16s\n", "lock", "usec/increment",
+         "conflicts/incr", "slowest/fastest");
+  if (immutable ? !run("mixed", filename, Z_IMMUTABLE, Z_IMMUTABLE | Z_SHMLOCK,
+                       num_workers, num_increments, num_victims)
+                : (!run("flock", filename, 0, 0, num_workers, num_increments,
+                        num_victims) ||
+                   !run("shmlock", filename, Z_SHMLOCK, Z_SHMLOCK, num_workers,
+                        num_increments, num_victims))) {
+    unlink(filename);
+    return EXIT_FAILURE;
+  }
+
+  unlink(filename);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,128 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+/* Exit status that makes the test suite skip the test */
+#define EXIT_SKIP 77
+
+/* Number of transactions before and while allocations are counted */
+#define WARMUP_CYCLES 3
+#define COUNTED_CYCLES 100
+
+#ifdef __GLIBC__
+
+/* Interpose the allocator of the C library, so that allocations made by the
+ * library are counted too */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static volatile bool COUNTING = false;
+static volatile size_t NUM_ALLOCATIONS = 0;
+
+static void count_allocation(void) {
+  if (COUNTING) {
+    __atomic_add_fetch(&NUM_ALLOCATIONS, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void *malloc(size_t size) {
+  count_allocation();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  count_allocation();
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  count_allocation();
+  return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+  count_allocation();
+  void *ptr = __libc_memalign(alignment, size);
+  if (ptr == NULL) {
+    return ENOMEM;
+  }
+  *memptr = ptr;
+  return 0;
+}
+
+static bool transaction(const char *filename) {
+  int fd = zopen(filename, Z_CREATE | Z_APPEND, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open file '%s': %s\n", filename,
+            strerror(errno));
+    return false;
+  }
+
+  const char data[] = "Hello zeugl\n";
+  if (write(fd, data, sizeof(data) - 1) != (ssize_t)(sizeof(data) - 1)) {
+    fprintf(stderr, "Failed to write to file '%s': %s\n", filename,
+            strerror(errno));
+    zclose(fd, false);
+    return false;
+  }
+
+  if (zclose(fd, true) != 0) {
+    fprintf(stderr, "Failed to close file '%s': %s\n", filename,
+            strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Missing required argument FILENAME\n");
+    return EXIT_FAILURE;
+  }
+  const char *filename = argv[1];
+
+  /* The first transactions fill the caches */
+  for (int i = 0; i < WARMUP_CYCLES; i++) {
+    if (!transaction(filename)) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  COUNTING = true;
+  for (int i = 0; i < COUNTED_CYCLES; i++) {
+    if (!transaction(filename)) {
+      COUNTING = false;
+      return EXIT_FAILURE;
+    }
+  }
+  COUNTING = false;
+
+  if (NUM_ALLOCATIONS != 0) {
+    fprintf(stderr, "Expected no allocations in %d transactions, got %zu\n",
+            COUNTED_CYCLES, NUM_ALLOCATIONS);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+#else /* __GLIBC__ */
+
+int main(void) {
+  /* The allocator can only be interposed with the GNU C library */
+  return EXIT_SKIP;
+}
+
+#endif /* __GLIBC__ */
@@ -0,0 +1,106 @@
+#!/bin/bash -e
+
+NUM_ARGS=5
+
+# Check arguments
+if [ $# -lt $NUM_ARGS ]; then
+	echo "error: Expected $NUM_ARGS arguments, got $#" >&2
+	exit 1
+fi
+
+# Global variables
+ZEUGL_PATH=$1
+NUM_WRITERS=$2
+NUM_COMMITS=$3
+NUM_BYTES=$4
+FILENAME=$5
+LETTERS=(a b c d e f g h i j k l m n o p q r s t u v w x y z)
+WRITER_PIDS=()
+READER_PIDS=()
+DONE_FILE="$FILENAME.done"
+
+# Print NUM_BYTES copies of a letter
+function content {
+	printf "%${NUM_BYTES}s" "" | tr ' ' "$1"
+}
+
+# Check that a snapshot of the file holds NUM_BYTES copies of a single letter,
+# i.e., the complete content of exactly one commit
+function check_snapshot {
+	num_bytes=$(stat -c %s "$1")
+	if [ "$num_bytes" -ne "$NUM_BYTES" ]; then
+		echo "error: Expected $NUM_BYTES, got $num_bytes" >&2
+		return 1
+	fi
+
+	letter=$(head -c 1 "$1")
+	if [ "$(tr -d "$letter" <"$1" | wc -c)" -ne 0 ]; then
+		echo "error: Found a mix of commits in the file" >&2
+		return 1
+	fi
+}
+
+function writer_task {
+	letter=${LETTERS[$(($1 % ${#LETTERS[@]}))]}
+
+	# Every other writer takes the locked commit path for immutable files
+	flags=()
+	if [ $(($1 % 2)) -eq 1 ]; then
+		flags=(-i)
+	fi
+
+	for _ in $(seq 1 "$NUM_COMMITS"); do
+		content "$letter" | "$ZEUGL_PATH" "${flags[@]}" "$FILENAME"
+	done
+}
+
+function reader_task {
+	snapshot="$FILENAME.snapshot.$1"
+	while [ ! -e "$DONE_FILE" ]; do
+		# cat(1) reads whatever file it opened, unlike cp(1) which gives up when
+		# the file is replaced during the copy
+		cat "$FILENAME" >"$snapshot"
+		check_snapshot "$snapshot"
+	done
+	rm -f "$snapshot"
+}
+
+content a >"$FILENAME"
+rm -f "$DONE_FILE"
+
+# Spawn readers that keep checking the file while it is replaced
+for i in 1 2; do
+	reader_task "$i" &
+	READER_PIDS+=($!)
+done
+
+# Spawn writers that commit whole files concurrently
+for i in $(seq 1 "$NUM_WRITERS"); do
+	writer_task "$i" &
+	echo "Spawned writer process $!"
+	WRITER_PIDS+=($!)
+done
+
+status=0
+for pid in "${WRITER_PIDS[@]}"; do
+	wait "$pid" || status=1
+done
+touch "$DONE_FILE"
+for pid in "${READER_PIDS[@]}"; do
+	wait "$pid" || status=1
+done
+rm -f "$DONE_FILE"
+
+if [ "$status" -ne 0 ]; then
+	echo "error: A writer or reader failed" >&2
+	exit 1
+fi
+
+check_snapshot "$FILENAME"
+
+# Check that no temporary files or moles are left behind
+leftovers=$(find "$(dirname "$FILENAME")" -name "$(basename "$FILENAME").*")
+if [ -n "$leftovers" ]; then
+	echo "error: Found leftover files: $leftovers" >&2
+	exit 1
+fi
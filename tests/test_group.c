@@ -0,0 +1,81 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+/* Usage: test_group MODE RECORD FILE...
+ *
+ * commit   Write the name of each file into it and commit the group.
+ * abort    Write the name of each file into it and abort the group.
+ * crash    Write the name of each file into it and abort() before the group
+ *          is committed.
+ * recover  Recover the group. */
+
+static bool write_member(struct zgroup *group, const char *filename) {
+  int fd = zgroup_open(group, filename, Z_CREATE | Z_TRUNCATE, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open file '%s': %s\n", filename,
+            strerror(errno));
+    return false;
+  }
+
+  const size_t len = strlen(filename);
+  if ((write(fd, filename, len) != (ssize_t)len) || (write(fd, "\n", 1) != 1)) {
+    fprintf(stderr, "Failed to write to file '%s': %s\n", filename,
+            strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s commit|abort|crash|recover RECORD FILE...\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+  const char *mode = argv[1];
+  const char *record = argv[2];
+
+  if (strcmp(mode, "recover") == 0) {
+    if (zgroup_recover(record) != 0) {
+      fprintf(stderr, "Failed to recover group '%s': %s\n", record,
+              strerror(errno));
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  struct zgroup *group = zgroup_begin(record, Z_DURABLE_DATA);
+  if (group == NULL) {
+    fprintf(stderr, "Failed to begin group '%s': %s\n", record,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  for (int i = 3; i < argc; i++) {
+    if (!write_member(group, argv[i])) {
+      zgroup_abort(group);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (strcmp(mode, "crash") == 0) {
+    abort();
+  } else if (strcmp(mode, "abort") == 0) {
+    zgroup_abort(group);
+  } else if (zgroup_commit(group) != 0) {
+    fprintf(stderr, "Failed to commit group '%s': %s\n", record,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
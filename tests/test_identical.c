@@ -0,0 +1,265 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_FSETXATTR)
+#include <sys/xattr.h>
+#endif
+
+#include "zeugl.h"
+
+/* Size of the large file, more than one comparison buffer */
+#define LARGE_SIZE (3 * 1024 * 1024 + 17)
+
+/* Replace the file with the given content and report whether the commit was
+ * skipped. Returns -1 on error. */
+static int replace(const char *filename, const char *content, size_t len,
+                   mode_t mode) {
+  struct iovec iov = {.iov_base = (void *)content, .iov_len = len};
+  if (zreplace(filename, &iov, 1, Z_SKIP_IDENTICAL, mode) != 0) {
+    perror("zreplace");
+    return -1;
+  }
+  struct zstats stats;
+  zstats(&stats);
+  return (int)stats.identical;
+}
+
+static bool get_inode(const char *filename, ino_t *ino) {
+  struct stat sb;
+  if (stat(filename, &sb) != 0) {
+    perror("stat");
+    return false;
+  }
+  *ino = sb.st_ino;
+  return true;
+}
+
+/* Whether the file has the same inode and status change time as before */
+static bool same_status(const struct stat *before, const char *filename) {
+  struct stat after;
+  if (stat(filename, &after) != 0) {
+    perror("stat");
+    return false;
+  }
+  return (after.st_ino == before->st_ino) &&
+         (after.st_ctim.tv_sec == before->st_ctim.tv_sec) &&
+         (after.st_ctim.tv_nsec == before->st_ctim.tv_nsec);
+}
+
+/* Replace the file and check whether it kept its inode */
+static bool expect(const char *filename, const char *content, size_t len,
+                   mode_t mode, bool identical) {
+  ino_t before, after;
+  if (!get_inode(filename, &before)) {
+    return false;
+  }
+  const int skipped = replace(filename, content, len, mode);
+  if ((skipped < 0) || !get_inode(filename, &after)) {
+    return false;
+  }
+  if ((skipped != identical) || ((before == after) != identical)) {
+    fprintf(stderr, "Expected file '%s' to be %s\n", filename,
+            identical ? "left alone" : "replaced");
+    return false;
+  }
+  return true;
+}
+
+/* Small files that differ in content, size or mode are replaced, and a hard
+ * link survives identical commits */
+static bool test_small(const char *filename, const char *linkname) {
+  unlink(filename);
+  unlink(linkname);
+  if ((replace(filename, "same\n", 5, 0644) != 0) ||
+      (link(filename, linkname) != 0)) {
+    fprintf(stderr, "Failed to create file '%s'\n", filename);
+    return false;
+  }
+
+  if (!expect(filename, "same\n", 5, 0644, true) ||
+      !expect(filename, "same\n", 5, 0644, true)) {
+    return false;
+  }
+  struct stat sb;
+  if ((stat(filename, &sb) != 0) || (sb.st_nlink != 2)) {
+    fprintf(stderr, "Expected hard link to file '%s' to survive\n", filename);
+    return false;
+  }
+
+  if (!expect(filename, "SAME\n", 5, 0644, false) ||
+      !expect(filename, "SAME!\n", 6, 0644, false) ||
+      !expect(filename, "SAME!\n", 6, 0600, false) ||
+      !expect(filename, "SAME!\n", 6, 0600, true)) {
+    return false;
+  }
+
+  unlink(linkname);
+  return true;
+}
+
+/* Large files are compared in several blocks */
+static bool test_large(const char *filename) {
+  char *content = malloc(LARGE_SIZE);
+  if (content == NULL) {
+    perror("malloc");
+    return false;
+  }
+  for (size_t i = 0; i < LARGE_SIZE; i++) {
+    content[i] = (char)('a' + (i % 26));
+  }
+
+  unlink(filename);
+  bool success = (replace(filename, content, LARGE_SIZE, 0644) == 0) &&
+                 expect(filename, content, LARGE_SIZE, 0644, true);
+  content[LARGE_SIZE - 1] = '\n';
+  success = success && expect(filename, content, LARGE_SIZE, 0644, false);
+  free(content);
+  return success;
+}
+
+/* A transaction that copied the original file and changed nothing is skipped,
+ * with zclose() as well as zclose_many() */
+static bool test_unchanged(const char *filename) {
+  int fds[2];
+  fds[0] = zopen(filename, Z_SKIP_IDENTICAL);
+  fds[1] = zopen(filename, Z_SKIP_IDENTICAL);
+  if ((fds[0] < 0) || (fds[1] < 0)) {
+    perror("zopen");
+    return false;
+  }
+
+  /* Not even the status change time of the original file changes */
+  struct stat before;
+  struct zstats stats;
+  if ((stat(filename, &before) != 0) || (zclose(fds[0], true) != 0)) {
+    perror("zclose");
+    return false;
+  }
+  zstats(&stats);
+  if ((stats.identical != 1) || !same_status(&before, filename)) {
+    fprintf(stderr, "Expected unchanged file '%s' to be left alone\n",
+            filename);
+    return false;
+  }
+
+  int errors[2];
+  fds[0] = -1;
+  if (zclose_many(fds, errors, 2, true) != 0) {
+    perror("zclose_many");
+    return false;
+  }
+  zstats(&stats);
+  if ((stats.identical != 1) || !same_status(&before, filename)) {
+    fprintf(stderr, "Expected zclose_many() to leave file '%s' alone\n",
+            filename);
+    return false;
+  }
+  return true;
+}
+
+/* With Z_NEWEST an unchanged transaction is committed all the same, so that
+ * the original file carries its sequence number and an older transaction
+ * committing later is superseded */
+static bool test_newest(const char *filename) {
+  int older = zopen(filename, Z_NEWEST);
+  int newer = zopen(filename, Z_NEWEST | Z_SKIP_IDENTICAL);
+  if ((older < 0) || (newer < 0)) {
+    perror("zopen");
+    return false;
+  }
+
+  struct stat before;
+  struct zstats stats;
+  if ((stat(filename, &before) != 0) || (zclose(newer, true) != 0)) {
+    perror("zclose");
+    return false;
+  }
+  zstats(&stats);
+  if ((stats.identical != 0) || same_status(&before, filename)) {
+    fprintf(stderr, "Expected file '%s' to be replaced with Z_NEWEST\n",
+            filename);
+    return false;
+  }
+
+  if (write(older, "older\n", 6) != 6) {
+    perror("write");
+    return false;
+  }
+  if (zclose(older, true) != 0) {
+    perror("zclose");
+    return false;
+  }
+
+  /* Sequence numbers are kept in extended attributes */
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_FSETXATTR) && !defined(__APPLE__)
+  char value[32];
+  if (getxattr(filename, "user.zeugl.seq", value, sizeof(value)) < 0) {
+    return true;
+  }
+  zstats(&stats);
+  if (stats.superseded != 1) {
+    fprintf(stderr, "Expected older transaction on file '%s' to be "
+                    "superseded\n",
+            filename);
+    return false;
+  }
+#endif
+  return true;
+}
+
+/* A missing original file is created */
+static bool test_missing(const char *filename) {
+  unlink(filename);
+  if (replace(filename, "new\n", 4, 0644) != 0) {
+    fprintf(stderr, "Expected missing file '%s' to be created\n", filename);
+    return false;
+  }
+  return true;
+}
+
+static bool test_group(const char *filename) {
+  char record[4096];
+  snprintf(record, sizeof(record), "%s.group", filename);
+  struct zgroup *group = zgroup_begin(record, 0);
+  if (group == NULL) {
+    perror("zgroup_begin");
+    return false;
+  }
+  if ((zgroup_open(group, filename, Z_SKIP_IDENTICAL) >= 0) ||
+      (errno != EINVAL)) {
+    fprintf(stderr, "Expected EINVAL for Z_SKIP_IDENTICAL in a group\n");
+    zgroup_abort(group);
+    return false;
+  }
+  zgroup_abort(group);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Missing required argument FILENAME\n");
+    return EXIT_FAILURE;
+  }
+  const char *filename = argv[1];
+
+  char linkname[4096];
+  snprintf(linkname, sizeof(linkname), "%s.link", filename);
+
+  if (!test_small(filename, linkname) || !test_large(filename) ||
+      !test_unchanged(filename) || !test_newest(filename) ||
+      !test_missing(filename) ||
+      !test_group(filename)) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
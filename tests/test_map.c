@@ -0,0 +1,219 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+/* Size of the original file, and the size it grows to */
+#define ORIG_SIZE (1024 * 1024)
+#define GROWN_SIZE (3 * ORIG_SIZE + 123)
+
+/* Fill a buffer with a pattern that depends on the offset */
+static void fill(char *buf, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = (char)('a' + (i % 26));
+  }
+}
+
+static bool create_file(const char *filename) {
+  char *buf = malloc(ORIG_SIZE);
+  if (buf == NULL) {
+    perror("malloc");
+    return false;
+  }
+  fill(buf, ORIG_SIZE);
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool success = (fd >= 0) && (write(fd, buf, ORIG_SIZE) == ORIG_SIZE);
+  if ((fd < 0) || (close(fd) != 0)) {
+    success = false;
+  }
+  free(buf);
+  if (!success) {
+    perror("write");
+  }
+  return success;
+}
+
+/* Read a whole file into a newly allocated buffer */
+static char *read_file(const char *filename, size_t *len) {
+  struct stat sb;
+  int fd = open(filename, O_RDONLY);
+  if ((fd < 0) || (fstat(fd, &sb) != 0)) {
+    perror("open");
+    return NULL;
+  }
+
+  char *buf = malloc((size_t)sb.st_size + 1);
+  if ((buf == NULL) ||
+      (read(fd, buf, (size_t)sb.st_size) != (ssize_t)sb.st_size)) {
+    perror("read");
+    free(buf);
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+  *len = (size_t)sb.st_size;
+  return buf;
+}
+
+/* Patch a few bytes in place, grow the file and write at the end */
+static bool test_edit(const char *filename, int flags) {
+  int fd = zopen(filename, flags);
+  if (fd < 0) {
+    perror("zopen");
+    return false;
+  }
+
+  size_t length = 0;
+  char *map = zmap(fd, &length);
+  if ((map == NULL) || (length != ORIG_SIZE)) {
+    fprintf(stderr, "Failed to map file '%s': %s\n", filename,
+            strerror(errno));
+    return false;
+  }
+  if (zmap(fd, &length) != map) {
+    fprintf(stderr, "Expected the same mapping again\n");
+    return false;
+  }
+
+  /* The mapping holds the copy of the original file */
+  char *expected = malloc(GROWN_SIZE);
+  if (expected == NULL) {
+    perror("malloc");
+    return false;
+  }
+  fill(expected, ORIG_SIZE);
+  if (memcmp(map, expected, ORIG_SIZE) != 0) {
+    fprintf(stderr, "Unexpected content in mapping\n");
+    return false;
+  }
+
+  memcpy(map + 1000, "PATCHED", 7);
+  memcpy(expected + 1000, "PATCHED", 7);
+
+  map = zremap(fd, GROWN_SIZE);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to grow mapping: %s\n", strerror(errno));
+    return false;
+  }
+  memset(expected + ORIG_SIZE, 0, GROWN_SIZE - ORIG_SIZE);
+  memcpy(map + GROWN_SIZE - 4, "END\n", 4);
+  memcpy(expected + GROWN_SIZE - 4, "END\n", 4);
+
+  if (zclose(fd, true) != 0) {
+    perror("zclose");
+    return false;
+  }
+
+  size_t len = 0;
+  char *content = read_file(filename, &len);
+  bool success = (content != NULL) && (len == GROWN_SIZE) &&
+                 (memcmp(content, expected, GROWN_SIZE) == 0);
+  if (!success) {
+    fprintf(stderr, "Unexpected content in file '%s'\n", filename);
+  }
+  free(content);
+  free(expected);
+  return success;
+}
+
+/* Shrink the file through the mapping, then abort */
+static bool test_abort(const char *filename) {
+  size_t len_before = 0;
+  char *before = read_file(filename, &len_before);
+  if (before == NULL) {
+    return false;
+  }
+
+  int fd = zopen(filename, 0);
+  char *map = (fd >= 0) ? zremap(fd, 100) : NULL;
+  if (map == NULL) {
+    fprintf(stderr, "Failed to map file '%s': %s\n", filename,
+            strerror(errno));
+    return false;
+  }
+  memset(map, 'x', 100);
+  if (zclose(fd, false) != 0) {
+    perror("zclose");
+    return false;
+  }
+
+  size_t len_after = 0;
+  char *after = read_file(filename, &len_after);
+  bool success = (after != NULL) && (len_after == len_before) &&
+                 (memcmp(before, after, len_before) == 0);
+  if (!success) {
+    fprintf(stderr, "Aborted transaction modified file '%s'\n", filename);
+  }
+  free(before);
+  free(after);
+  return success;
+}
+
+/* An empty file cannot be mapped until it is given a size */
+static bool test_empty(const char *filename) {
+  int fd = zopen(filename, Z_TRUNCATE);
+  size_t length = 0;
+  if ((fd < 0) || (zmap(fd, &length) != NULL) || (errno != EINVAL)) {
+    fprintf(stderr, "Expected EINVAL when mapping an empty file\n");
+    return false;
+  }
+
+  char *map = zremap(fd, 6);
+  if ((map == NULL) || (zremap(fd, 0) != NULL) || (errno != EINVAL)) {
+    fprintf(stderr, "Failed to map empty file: %s\n", strerror(errno));
+    return false;
+  }
+  memcpy(map, "small\n", 6);
+  if (zclose(fd, true) != 0) {
+    perror("zclose");
+    return false;
+  }
+
+  size_t len = 0;
+  char *content = read_file(filename, &len);
+  bool success =
+      (content != NULL) && (len == 6) && (memcmp(content, "small\n", 6) == 0);
+  if (!success) {
+    fprintf(stderr, "Unexpected content in file '%s'\n", filename);
+  }
+  free(content);
+  return success;
+}
+
+static bool test_invalid(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  size_t length = 0;
+  if ((fd < 0) || (zmap(fd, &length) != NULL) || (errno != EINVAL) ||
+      (zremap(fd, 100) != NULL) || (errno != EINVAL)) {
+    fprintf(stderr, "Expected EINVAL for a file not opened with zopen()\n");
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Missing required argument FILENAME\n");
+    return EXIT_FAILURE;
+  }
+  const char *filename = argv[1];
+
+  if (!create_file(filename) || !test_edit(filename, 0) ||
+      !create_file(filename) || !test_edit(filename, Z_DURABLE_FULL) ||
+      !test_abort(filename) || !test_empty(filename) ||
+      !test_invalid(filename)) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_FSETXATTR)
+#include <sys/xattr.h>
+#endif
+
+#include "zeugl.h"
+
+/* Exit status that makes the test suite skip the test */
+#define EXIT_SKIP 77
+
+static bool write_string(int fd, const char *str) {
+  const size_t len = strlen(str);
+  return write(fd, str, len) == (ssize_t)len;
+}
+
+static bool check_content(const char *filename, const char *expected) {
+  char buf[64] = {0};
+  int fd = open(filename, O_RDONLY);
+  if ((fd < 0) || (read(fd, buf, sizeof(buf) - 1) < 0)) {
+    perror("read");
+    return false;
+  }
+  close(fd);
+  if (strcmp(buf, expected) != 0) {
+    fprintf(stderr, "Expected '%s' in file '%s', got '%s'\n", expected,
+            filename, buf);
+    return false;
+  }
+  return true;
+}
+
+/* Begin an older and a newer transaction, and commit the newer one first.
+ * Only a newer commit with Z_NEWEST supersedes the older transaction. */
+static bool test_order(const char *filename, int flags, const char *expected,
+                       unsigned int superseded) {
+  int older = zopen(filename, Z_TRUNCATE | flags);
+  int newer = zopen(filename, Z_TRUNCATE | flags);
+  if ((older < 0) || (newer < 0)) {
+    perror("zopen");
+    return false;
+  }
+
+  if (!write_string(older, "older\n") || !write_string(newer, "newer\n")) {
+    perror("write");
+    return false;
+  }
+
+  if ((zsuperseded(older) != 0) || (zclose(newer, true) != 0)) {
+    perror("zclose");
+    return false;
+  }
+
+  if (zsuperseded(older) != (int)superseded) {
+    fprintf(stderr, "Expected zsuperseded() to return %u\n", superseded);
+    return false;
+  }
+
+  if (zclose(older, true) != 0) {
+    perror("zclose");
+    return false;
+  }
+
+  struct zstats stats;
+  zstats(&stats);
+  if (stats.superseded != superseded) {
+    fprintf(stderr, "Expected superseded to be %u, got %u\n", superseded,
+            stats.superseded);
+    return false;
+  }
+
+  return check_content(filename, expected);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Missing required argument FILENAME\n");
+    return EXIT_FAILURE;
+  }
+  const char *filename = argv[1];
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ((fd < 0) || !write_string(fd, "initial\n")) {
+    perror("open");
+    return EXIT_FAILURE;
+  }
+
+  /* Sequence numbers are kept in extended attributes */
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_FSETXATTR) && !defined(__APPLE__)
+  if (fsetxattr(fd, "user.zeugl.test", "1", 1, 0) != 0) {
+    close(fd);
+    return EXIT_SKIP;
+  }
+#else
+  close(fd);
+  return EXIT_SKIP;
+#endif
+  close(fd);
+
+  /* With Z_NEWEST the newer transaction wins, otherwise the last commit */
+  if (!test_order(filename, Z_NEWEST, "newer\n", 1) ||
+      !test_order(filename, 0, "older\n", 0)) {
+    return EXIT_FAILURE;
+  }
+
+  /* Commits without Z_NEWEST record no sequence number */
+#if defined(HAVE_SYS_XATTR_H) && defined(HAVE_FSETXATTR) && !defined(__APPLE__)
+  char value[32];
+  if (getxattr(filename, "user.zeugl.seq", value, sizeof(value)) >= 0) {
+    fprintf(stderr, "Expected no sequence number on file '%s'\n", filename);
+    return EXIT_FAILURE;
+  }
+#endif
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+/* Number of threads incrementing the counter, and increments per thread */
+#define NUM_THREADS 4
+#define NUM_INCREMENTS 50
+
+/* Lines appended per thread by concurrent plain and optimistic commits. A
+ * plain commit only rarely lands in the window it used to slip through. */
+#define NUM_APPENDS 1000
+
+static bool write_string(int fd, const char *str) {
+  const size_t len = strlen(str);
+  return write(fd, str, len) == (ssize_t)len;
+}
+
+static bool check_content(const char *filename, const char *expected) {
+  char buf[64] = {0};
+  int fd = open(filename, O_RDONLY);
+  if ((fd < 0) || (read(fd, buf, sizeof(buf) - 1) < 0)) {
+    perror("read");
+    return false;
+  }
+  close(fd);
+  if (strcmp(buf, expected) != 0) {
+    fprintf(stderr, "Expected '%s' in file '%s', got '%s'\n", expected,
+            filename, buf);
+    return false;
+  }
+  return true;
+}
+
+/* Two transactions on the same file: the first commit wins and the second
+ * one fails */
+static bool test_conflict(const char *filename, int flags) {
+  int fd1 = zopen(filename, Z_OPTIMISTIC | Z_TRUNCATE | flags, 0644);
+  int fd2 = zopen(filename, Z_OPTIMISTIC | Z_TRUNCATE | flags, 0644);
+  if ((fd1 < 0) || (fd2 < 0)) {
+    perror("zopen");
+    return false;
+  }
+
+  if (!write_string(fd1, "first\n") || !write_string(fd2, "second\n")) {
+    perror("write");
+    return false;
+  }
+
+  if (zclose(fd1, true) != 0) {
+    perror("zclose");
+    return false;
+  }
+  if ((zclose(fd2, true) == 0) || (errno != ESTALE)) {
+    fprintf(stderr, "Expected second commit to fail with ESTALE: %s\n",
+            strerror(errno));
+    return false;
+  }
+
+  return check_content(filename, "first\n");
+}
+
+/* Append a line to a file in a transaction. Returns 1 if it was committed, 0
+ * on a conflict and -1 on error. */
+static int append_line(const char *filename, int flags, const char *line) {
+  int fd = zopen(filename, flags);
+  if ((fd < 0) || (lseek(fd, 0, SEEK_END) < 0) || !write_string(fd, line)) {
+    perror("append");
+    if (fd >= 0) {
+      zclose(fd, false);
+    }
+    return -1;
+  }
+
+  if (zclose(fd, true) == 0) {
+    return 1;
+  }
+  if (errno == ESTALE) {
+    return 0;
+  }
+  perror("zclose");
+  return -1;
+}
+
+/* Append numbered lines without Z_OPTIMISTIC. Each commit begins after the
+ * previous one, so its line must stay unless an optimistic commit loses it. */
+static void *append_plain(void *arg) {
+  const char *filename = arg;
+  for (int i = 0; i < NUM_APPENDS; i++) {
+    char line[32];
+    snprintf(line, sizeof(line), "plain %d\n", i);
+    if (append_line(filename, 0, line) != 1) {
+      return (void *)1;
+    }
+  }
+  return NULL;
+}
+
+/* Append lines with Z_OPTIMISTIC, retrying on conflicts */
+static void *append_optimistic(void *arg) {
+  const char *filename = arg;
+  for (int i = 0; i < NUM_APPENDS;) {
+    const int ret = append_line(filename, Z_OPTIMISTIC, "optimistic\n");
+    if (ret < 0) {
+      return (void *)1;
+    }
+    i += ret;
+  }
+  return NULL;
+}
+
+/* Check that all lines of append_plain() are in a file, in order */
+static bool check_plain_lines(const char *filename) {
+  /* Room for every line of every thread */
+  static char buf[NUM_THREADS * NUM_APPENDS * 16];
+  memset(buf, 0, sizeof(buf));
+  int fd = open(filename, O_RDONLY);
+  if ((fd < 0) || (read(fd, buf, sizeof(buf) - 1) < 0)) {
+    perror("read");
+    return false;
+  }
+  close(fd);
+
+  const char *pos = buf;
+  for (int i = 0; i < NUM_APPENDS; i++) {
+    char line[32];
+    snprintf(line, sizeof(line), "plain %d\n", i);
+    pos = strstr(pos, line);
+    if (pos == NULL) {
+      fprintf(stderr, "Line '%.*s' of a plain commit was lost\n",
+              (int)strlen(line) - 1, line);
+      return false;
+    }
+  }
+  return true;
+}
+
+/* A commit without Z_OPTIMISTIC also counts as a conflict */
+static bool test_external(const char *filename) {
+  int fd = zopen(filename, Z_OPTIMISTIC);
+  if (fd < 0) {
+    perror("zopen");
+    return false;
+  }
+
+  int other = zopen(filename, Z_TRUNCATE);
+  if ((other < 0) || !write_string(other, "other\n") ||
+      (zclose(other, true) != 0)) {
+    perror("zopen");
+    return false;
+  }
+
+  if ((zclose(fd, true) == 0) || (errno != ESTALE)) {
+    fprintf(stderr, "Expected commit to fail with ESTALE: %s\n",
+            strerror(errno));
+    return false;
+  }
+
+  if (!check_content(filename, "other\n")) {
+    return false;
+  }
+
+  /* Even when it lands between the comparison and the replacement of a
+   * concurrent optimistic commit */
+  pthread_t threads[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; i++) {
+    if (pthread_create(&threads[i], NULL,
+                       (i == 0) ? append_plain : append_optimistic,
+                       (void *)filename) != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      return false;
+    }
+  }
+
+  bool success = true;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    success = success && (ret == NULL);
+  }
+
+  return success && check_plain_lines(filename);
+}
+
+/* Read-modify-write a counter, retrying on conflicts */
+static void *increment(void *arg) {
+  const char *filename = arg;
+  for (int i = 0; i < NUM_INCREMENTS;) {
+    int fd = zopen(filename, Z_OPTIMISTIC);
+    char buf[32] = {0};
+    if ((fd < 0) || (read(fd, buf, sizeof(buf) - 1) < 0)) {
+      perror("zopen");
+      return (void *)1;
+    }
+
+    char value[32];
+    snprintf(value, sizeof(value), "%ld\n", atol(buf) + 1);
+    if ((ftruncate(fd, 0) != 0) || (lseek(fd, 0, SEEK_SET) != 0) ||
+        !write_string(fd, value)) {
+      perror("write");
+      zclose(fd, false);
+      return (void *)1;
+    }
+
+    if (zclose(fd, true) == 0) {
+      i++;
+    } else if (errno != ESTALE) {
+      perror("zclose");
+      return (void *)1;
+    }
+  }
+  return NULL;
+}
+
+static bool test_counter(const char *filename) {
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ((fd < 0) || !write_string(fd, "0\n") || (close(fd) != 0)) {
+    perror("open");
+    return false;
+  }
+
+  pthread_t threads[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; i++) {
+    if (pthread_create(&threads[i], NULL, increment, (void *)filename) != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      return false;
+    }
+  }
+
+  bool success = true;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    success = success && (ret == NULL);
+  }
+
+  char expected[32];
+  snprintf(expected, sizeof(expected), "%d\n", NUM_THREADS * NUM_INCREMENTS);
+  return success && check_content(filename, expected);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Missing required argument FILENAME\n");
+    return EXIT_FAILURE;
+  }
+  const char *filename = argv[1];
+
+  /* Conflicting creates, then conflicting replacements */
+  unlink(filename);
+  if (!test_conflict(filename, Z_CREATE) || !test_conflict(filename, 0) ||
+      !test_external(filename) || !test_counter(filename)) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,190 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+/* Number of threads replacing the same file, and replacements per thread */
+#define NUM_THREADS 8
+#define NUM_REPLACEMENTS 50
+
+/* Number of buffers in a vector, more than fits in one pwritev() call */
+#define NUM_BUFFERS 3000
+
+/* Size of each version of the file written by the threads */
+#define VERSION_SIZE 4096
+
+static bool check_file(const char *filename, const char *expected, size_t len,
+                       mode_t mode) {
+  struct stat sb;
+  if (stat(filename, &sb) != 0) {
+    perror("stat");
+    return false;
+  }
+  if ((sb.st_mode & 0777) != mode) {
+    fprintf(stderr, "Expected mode %04o for file '%s', got %04o\n",
+            (unsigned int)mode, filename, (unsigned int)(sb.st_mode & 0777));
+    return false;
+  }
+
+  char *buf = malloc(len + 1);
+  int fd = open(filename, O_RDONLY);
+  ssize_t n = ((buf != NULL) && (fd >= 0)) ? read(fd, buf, len + 1) : -1;
+  if (fd >= 0) {
+    close(fd);
+  }
+  const bool match = (n == (ssize_t)len) && (memcmp(buf, expected, len) == 0);
+  free(buf);
+  if (!match) {
+    fprintf(stderr, "Unexpected content in file '%s'\n", filename);
+    return false;
+  }
+  return true;
+}
+
+/* Replace a file with a single buffer, applying the mode to an existing file */
+static bool test_buffer(const char *filename) {
+  char content[] = "Hello, zreplace!\n";
+  struct iovec iov = {.iov_base = content, .iov_len = strlen(content)};
+  if ((zreplace(filename, &iov, 1, 0, 0600) != 0) ||
+      !check_file(filename, content, strlen(content), 0600)) {
+    return false;
+  }
+  if ((zreplace(filename, &iov, 1, Z_DURABLE_FULL, 0644) != 0) ||
+      !check_file(filename, content, strlen(content), 0644)) {
+    return false;
+  }
+
+  /* An empty vector leaves an empty file */
+  if ((zreplace(filename, NULL, 0, 0, 0644) != 0) ||
+      !check_file(filename, "", 0, 0644)) {
+    return false;
+  }
+  return true;
+}
+
+/* Replace a file with more buffers than one system call takes */
+static bool test_vector(const char *filename) {
+  struct iovec *iov = calloc(NUM_BUFFERS, sizeof(struct iovec));
+  char *expected = malloc(NUM_BUFFERS * 8);
+  if ((iov == NULL) || (expected == NULL)) {
+    perror("malloc");
+    return false;
+  }
+
+  size_t len = 0;
+  for (int i = 0; i < NUM_BUFFERS; i++) {
+    /* Every third buffer is empty */
+    const int n = (i % 3 == 0) ? 0 : sprintf(expected + len, "%d\n", i);
+    iov[i].iov_base = expected + len;
+    iov[i].iov_len = (size_t)n;
+    len += (size_t)n;
+  }
+
+  bool success = (zreplace(filename, iov, NUM_BUFFERS, 0, 0644) == 0) &&
+                 check_file(filename, expected, len, 0644);
+  free(iov);
+  free(expected);
+  return success;
+}
+
+static bool test_invalid(const char *filename) {
+  struct iovec iov = {.iov_base = "x", .iov_len = 1};
+  const int flags[] = {Z_APPEND, Z_SIZEHINT, Z_TIMEOUT};
+  for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+    if ((zreplace(filename, &iov, 1, flags[i], 0644) == 0) ||
+        (errno != EINVAL)) {
+      fprintf(stderr, "Expected EINVAL for flags 0x%x\n", flags[i]);
+      return false;
+    }
+  }
+  if ((zreplace(filename, &iov, -1, 0, 0644) == 0) || (errno != EINVAL)) {
+    fprintf(stderr, "Expected EINVAL for a negative number of buffers\n");
+    return false;
+  }
+  return true;
+}
+
+/* Replace the file with a version made of one repeated character */
+static void *replace(void *arg) {
+  const char *filename = arg;
+  char content[VERSION_SIZE];
+  for (int i = 0; i < NUM_REPLACEMENTS; i++) {
+    memset(content, 'a' + (i % 26), sizeof(content));
+    struct iovec iov[2] = {
+        {.iov_base = content, .iov_len = sizeof(content) / 2},
+        {.iov_base = content + sizeof(content) / 2,
+         .iov_len = sizeof(content) / 2},
+    };
+    if (zreplace(filename, iov, 2, 0, 0644) != 0) {
+      perror("zreplace");
+      return (void *)1;
+    }
+  }
+  return NULL;
+}
+
+/* Replace the same file from many threads, and check that it always holds a
+ * whole version */
+static bool test_threads(const char *filename) {
+  pthread_t threads[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; i++) {
+    if (pthread_create(&threads[i], NULL, replace, (void *)filename) != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      return false;
+    }
+  }
+
+  bool success = true;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    success = success && (ret == NULL);
+  }
+  if (!success) {
+    return false;
+  }
+
+  char content[VERSION_SIZE];
+  int fd = open(filename, O_RDONLY);
+  ssize_t n = (fd >= 0) ? read(fd, content, sizeof(content)) : -1;
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (n != (ssize_t)sizeof(content)) {
+    fprintf(stderr, "Unexpected size of file '%s'\n", filename);
+    return false;
+  }
+  for (size_t i = 1; i < sizeof(content); i++) {
+    if (content[i] != content[0]) {
+      fprintf(stderr, "Mixed versions in file '%s'\n", filename);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Missing required argument FILENAME\n");
+    return EXIT_FAILURE;
+  }
+  const char *filename = argv[1];
+
+  unlink(filename);
+  if (!test_buffer(filename) || !test_vector(filename) ||
+      !test_invalid(filename) || !test_threads(filename)) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
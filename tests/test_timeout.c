@@ -0,0 +1,172 @@
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "zeugl.h"
+
+/* Milliseconds the lock holder keeps the lock, and the timeouts used */
+#define HOLD_MSEC 500
+#define SHORT_TIMEOUT 50
+#define LONG_TIMEOUT 5000
+
+#define NSEC_PER_MSEC 1000000ULL
+
+/* Fork a child process that holds an exclusive lock on filename for
+ * HOLD_MSEC milliseconds. Returns once the lock is taken. */
+static pid_t hold_lock(const char *filename) {
+  int pipefd[2];
+  if (pipe(pipefd) != 0) {
+    perror("pipe");
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return -1;
+  }
+
+  if (pid == 0) {
+    close(pipefd[0]);
+    int fd = open(filename, O_RDONLY);
+    if ((fd < 0) || (flock(fd, LOCK_EX) != 0)) {
+      perror("flock");
+      _exit(EXIT_FAILURE);
+    }
+    if (write(pipefd[1], "x", 1) != 1) {
+      _exit(EXIT_FAILURE);
+    }
+    usleep(HOLD_MSEC * 1000);
+    _exit(EXIT_SUCCESS);
+  }
+
+  close(pipefd[1]);
+  char c;
+  if (read(pipefd[0], &c, 1) != 1) {
+    fprintf(stderr, "Lock holder failed\n");
+    close(pipefd[0]);
+    return -1;
+  }
+  close(pipefd[0]);
+  return pid;
+}
+
+static bool wait_child(pid_t pid) {
+  int status;
+  return (waitpid(pid, &status, 0) == pid) && WIFEXITED(status) &&
+         (WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Missing required argument FILENAME\n");
+    return EXIT_FAILURE;
+  }
+  const char *filename = argv[1];
+
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ((fd < 0) || (write(fd, "old\n", 4) != 4) || (close(fd) != 0)) {
+    perror("open");
+    return EXIT_FAILURE;
+  }
+
+  /* The shared lock in zopen() times out */
+  pid_t pid = hold_lock(filename);
+  if (pid < 0) {
+    return EXIT_FAILURE;
+  }
+  fd = zopen(filename, Z_TIMEOUT, SHORT_TIMEOUT);
+  if ((fd >= 0) || (errno != ETIMEDOUT)) {
+    fprintf(stderr, "Expected zopen() to time out, got fd %d: %s\n", fd,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+  struct zstats stats;
+  zstats(&stats);
+  if (stats.open_lock_wait_ns < SHORT_TIMEOUT * NSEC_PER_MSEC) {
+    fprintf(stderr, "Expected a lock wait of at least %d ms, got %llu ns\n",
+            SHORT_TIMEOUT, stats.open_lock_wait_ns);
+    return EXIT_FAILURE;
+  }
+
+  /* A longer timeout outlasts the lock holder */
+  fd = zopen(filename, Z_TIMEOUT, LONG_TIMEOUT);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open file '%s': %s\n", filename,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (!wait_child(pid)) {
+    return EXIT_FAILURE;
+  }
+  zstats(&stats);
+  printf("Waited %llu us for the shared lock\n",
+         stats.open_lock_wait_ns / 1000);
+  if (zclose(fd, true) != 0) {
+    fprintf(stderr, "Failed to commit file '%s': %s\n", filename,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  /* A plain commit does not wait for the lock at all */
+  fd = zopen(filename, Z_TIMEOUT, SHORT_TIMEOUT);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open file '%s': %s\n", filename,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+  pid = hold_lock(filename);
+  if (pid < 0) {
+    return EXIT_FAILURE;
+  }
+  if ((write(fd, "new\n", 4) != 4) || (zclose(fd, true) != 0)) {
+    fprintf(stderr, "Failed to commit file '%s': %s\n", filename,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+  zstats(&stats);
+  if (stats.commit_lock_wait_ns != 0) {
+    fprintf(stderr, "Expected no lock wait, got %llu ns\n",
+            stats.commit_lock_wait_ns);
+    return EXIT_FAILURE;
+  }
+  if (!wait_child(pid)) {
+    return EXIT_FAILURE;
+  }
+
+  /* The exclusive lock in zclose() times out with Z_OPTIMISTIC */
+  fd = zopen(filename, Z_OPTIMISTIC | Z_TIMEOUT, SHORT_TIMEOUT);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open file '%s': %s\n", filename,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+  pid = hold_lock(filename);
+  if (pid < 0) {
+    return EXIT_FAILURE;
+  }
+  if ((write(fd, "new\n", 4) != 4) || (zclose(fd, true) == 0) ||
+      (errno != ETIMEDOUT)) {
+    fprintf(stderr, "Expected zclose() to time out: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  zstats(&stats);
+  if (stats.commit_lock_wait_ns < SHORT_TIMEOUT * NSEC_PER_MSEC) {
+    fprintf(stderr, "Expected a lock wait of at least %d ms, got %llu ns\n",
+            SHORT_TIMEOUT, stats.commit_lock_wait_ns);
+    return EXIT_FAILURE;
+  }
+  if (!wait_child(pid)) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}